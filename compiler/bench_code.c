@@ -0,0 +1,81 @@
+#include "improved.c"
+#include "bench_gen.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compiling and running a generated file of expression statements, a
+ * statement per line: the time to parse it into three-address code, to
+ * translate that to bytecode, and to run each, the three-address code on
+ * registers and the bytecode on the stack machine. Variables are set to
+ * small numbers. Both give a result per statement, which are compared.
+ *
+ * BUILD: cc -O2 -pthread -o bench_code bench_code.c
+ * USAGE: ./bench_code [file] [size in MB]
+ */
+
+#define RUNS 5
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : LEX_PATH;
+  size_t size = (size_t)(argc > 2 ? atol(argv[2]) : LEX_SIZE_MB) << 20;
+  ensure_input(path, size, generate_lex);
+  if (!freopen(path, "rb", stdin)) {
+    fprintf(stderr, "Could not open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  double start = now();
+  statements();
+  double parsed = now();
+  Bytecode bytecode = ir_to_bytecode(&ir);
+  double translated = now();
+  printf("%zu statements, %zu instructions, %zu variables\n", ir.statements,
+         ir.count, code_variables());
+  printf("parse to IR    %8.3f s\n", parsed - start);
+  printf("IR to bytecode %8.3f s\n", translated - parsed);
+
+  int64_t *variables = malloc(sizeof(int64_t) * (code_variables() + 1));
+  int64_t *expected  = malloc(sizeof(int64_t) * (ir.statements + 1));
+  int64_t *results   = malloc(sizeof(int64_t) * (ir.statements + 1));
+  if (!variables || !expected || !results) {
+    fprintf(stderr, "Could not allocate the results\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < code_variables(); ++i) {
+    variables[i] = i % 13 + 1;
+  }
+
+  printf("%-9s %10s %14s %14s\n", "run", "ms", "Mstatements/s",
+         "Minstrs/s");
+  const char *machines[] = {"registers", "stack"};
+  for (int stack = 0; stack < 2; ++stack) {
+    double best = 0;
+    for (int run = 0; run < RUNS; ++run) {
+      start = now();
+      if (stack) {
+        run_bytecode(&bytecode, variables, results);
+      } else {
+        run_ir(&ir, variables, expected);
+      }
+      double elapsed = now() - start;
+      best = run == 0 || elapsed < best ? elapsed : best;
+    }
+    printf("%-9s %10.2f %14.1f %14.1f\n", machines[stack], best * 1e3,
+           ir.statements / best / 1e6, ir.count / best / 1e6);
+  }
+
+  size_t mismatch = 0;
+  for (size_t i = 0; i < ir.statements; ++i) {
+    mismatch += expected[i] != results[i];
+  }
+  printf("%zu results differ\n", mismatch);
+
+  free(results);
+  free(expected);
+  free(variables);
+  bytecode_free(&bytecode);
+  ir_free(&ir);
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Timing and the generated input of the benchmarks: expression statements, a
+ * statement per line, with numbers, identifiers and parentheses nested up to
+ * MAX_DEPTH. Lines are kept under MAX_LINE bytes so the fgets() lexer of
+ * bench_lex.c sees the same tokens.
+ */
+
+#define LEX_PATH "/tmp/compiler_lex.txt"
+#define LEX_SIZE_MB 64
+#define MAX_DEPTH 3
+#define MAX_LINE 120
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned seed = 1;
+
+unsigned next_random(void) {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+char *gen_expression(char *at, int depth);
+
+char *gen_factor(char *at, int depth) {
+  if (depth < MAX_DEPTH && next_random() % 4 == 0) {
+    *at++ = '(';
+    at = gen_expression(at, depth + 1);
+    *at++ = ')';
+    return at;
+  }
+  if (next_random() % 2) {
+    return at + sprintf(at, "%u", next_random() % 10000);
+  }
+  return at + sprintf(at, "%c%u", 'a' + next_random() % 26,
+                      next_random() % 100);
+}
+
+char *gen_expression(char *at, int depth) {
+  at = gen_factor(at, depth);
+  for (unsigned terms = next_random() % 3; terms > 0; --terms) {
+    at += sprintf(at, next_random() % 2 ? " + " : " * ");
+    at = gen_factor(at, depth);
+  }
+  return at;
+}
+
+void generate_lex(const char *path, size_t size) {
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "Could not create %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  // A statement is at most 642 bytes at MAX_DEPTH 3, those over MAX_LINE go
+  char line[1024];
+  size_t written = 0;
+  while (written < size) {
+    char *end = gen_expression(line, 0);
+    end += sprintf(end, ";\n");
+    if (end - line < MAX_LINE) {
+      written += fwrite(line, 1, end - line, fp);
+    }
+  }
+  fclose(fp);
+}
+
+// Generates `size` bytes into `path` unless it already holds about that
+void ensure_input(const char *path, size_t size,
+                  void (*generate)(const char *path, size_t size)) {
+  FILE *fp = fopen(path, "rb");
+  long length = -1;
+  if (fp) {
+    fseek(fp, 0, SEEK_END);
+    length = ftell(fp);
+    fclose(fp);
+  }
+  if (length < 0 || (size_t)length < size || (size_t)length > size + 4096) {
+    printf("Generating %zu MB into %s...\n", size >> 20, path);
+    generate(path, size);
+  }
+}
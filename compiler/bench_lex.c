@@ -0,0 +1,118 @@
+#include "lex.h"
+#include "lex.c"
+#include "bench_gen.c"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Tokens per second through lex() on a generated file of expression
+ * statements, a statement per line, against the lexer as it was: fgets()
+ * into a 128-byte buffer a line at a time, isspace()/isalnum() per character.
+ * Lines are kept under 128 bytes so both see the same tokens, which is
+ * checked. Each lexer runs once, as lex() keeps the input it read.
+ *
+ * BUILD: cc -O2 -pthread -o bench_lex bench_lex.c
+ * USAGE: ./bench_lex [file] [size in MB]
+ */
+
+/*
+ * The lexer as it was, with its own lexeme, and with the test for the end of
+ * the buffered line the right way round so it reads the first line
+ */
+char *fgets_text = "";
+int   fgets_len  = 0;
+
+int lex_fgets(void) {
+  static char input_buffer[128];
+  char*       current;
+
+  current = fgets_text + fgets_len;
+
+  while (1) {
+    while (!*current) {
+      current = input_buffer;
+      if (!fgets(input_buffer, 128, stdin)) {
+        *current = '\0';
+        return EOI;
+      }
+
+      while (isspace(*current)) {
+        ++current;
+      }
+    }
+
+    for (; *current; ++current) {
+      fgets_text = current;
+      fgets_len = 1;
+
+      switch (*current) {
+        case ';': return SEMI;
+        case '+': return PLUS;
+        case '*': return TIMES;
+        case '(': return LP;
+        case ')': return RP;
+
+        case '\n':
+        case '\t':
+        case ' ' : break;
+
+        default:
+          if (isalnum(*current)) {
+            while (isalnum(*current)) {
+              ++current;
+            }
+            fgets_len = current - fgets_text;
+            return NUM_OR_ID;
+          }
+          break;
+      }
+    }
+  }
+}
+
+// Returns the seconds it took, counting the tokens and summing their lengths
+double run(const char *path, int buffered, size_t *tokens, size_t *bytes) {
+  if (!freopen(path, "rb", stdin)) {
+    fprintf(stderr, "Could not open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  *tokens = 0;
+  *bytes  = 0;
+  double start = now();
+  if (buffered) {
+    while (lex() != EOI) {
+      *tokens += 1;
+      *bytes  += yylen;
+    }
+  } else {
+    while (lex_fgets() != EOI) {
+      *tokens += 1;
+      *bytes  += fgets_len;
+    }
+  }
+  return now() - start;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : LEX_PATH;
+  size_t size = (size_t)(argc > 2 ? atol(argv[2]) : LEX_SIZE_MB) << 20;
+  ensure_input(path, size, generate_lex);
+
+  printf("%-8s %10s %12s %12s\n", "lexer", "seconds", "Mtokens/s", "MB/s");
+  const char *lexers[] = {"fgets", "buffered"};
+  size_t counts[2][2];
+  for (int buffered = 0; buffered < 2; ++buffered) {
+    size_t *count = counts[buffered];
+    double elapsed = run(path, buffered, &count[0], &count[1]);
+    printf("%-8s %10.3f %12.1f %12.1f\n", lexers[buffered], elapsed,
+           count[0] / elapsed / 1e6, (size >> 20) / elapsed);
+  }
+
+  printf("%zu tokens, %s\n", counts[1][0],
+         counts[0][0] == counts[1][0] && counts[0][1] == counts[1][1]
+             ? "same tokens"
+             : "TOKENS DIFFER");
+  return 0;
+}
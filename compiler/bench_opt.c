@@ -0,0 +1,167 @@
+#include "improved.c"
+#include "optimize.c"
+#include "bench_gen.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The optimizer on a generated file of statements written to give it work:
+ * variables from a short list, numbers that are often 0, 1 or small, and
+ * parenthesized subexpressions that come back later in the statement, like
+ * (a1 + b2) * (a1 + b2). Reports the instructions before and after, the time
+ * it takes, and how long the code takes to run each way on both machines.
+ * The results have to stay the same.
+ *
+ * BUILD: cc -O2 -pthread -o bench_opt bench_opt.c
+ * USAGE: ./bench_opt [file] [size in MB]
+ */
+
+#define OPT_PATH "/tmp/compiler_opt.txt"
+#define OPT_SIZE_MB 32
+#define MAX_REPEATS 16
+#define RUNS 5
+
+typedef struct {
+  char *begin;
+  int   len;
+} Repeat;
+
+static Repeat repeats[MAX_REPEATS];
+static int    num_repeats = 0;
+static char   line[1 << 16];
+static char  *line_limit  = line + sizeof(line) / 2;   // For repeats
+
+char *opt_expression(char *at, int depth);
+
+char *opt_factor(char *at, int depth) {
+  static const char *numbers[] = {"0", "1", "1", "2", "3", "10", "100"};
+  unsigned pick = next_random() % 10;
+
+  if (pick < 2 && num_repeats > 0) {
+    Repeat *repeat = &repeats[next_random() % num_repeats];
+    if (at + repeat->len < line_limit) {
+      memmove(at, repeat->begin, repeat->len);
+      return at + repeat->len;
+    }
+  }
+  if (pick < 5 && depth < MAX_DEPTH) {
+    char *begin = at;
+    *at++ = '(';
+    at = opt_expression(at, depth + 1);
+    *at++ = ')';
+    if (num_repeats < MAX_REPEATS) {
+      repeats[num_repeats].begin = begin;
+      repeats[num_repeats].len   = at - begin;
+      ++num_repeats;
+    }
+    return at;
+  }
+  if (pick < 7) {
+    return at + sprintf(at, "%s", numbers[next_random() % 7]);
+  }
+  return at + sprintf(at, "%c%u", 'a' + next_random() % 4, next_random() % 4);
+}
+
+char *opt_expression(char *at, int depth) {
+  at = opt_factor(at, depth);
+  for (unsigned terms = next_random() % 3; terms > 0; --terms) {
+    at += sprintf(at, next_random() % 2 ? " + " : " * ");
+    at = opt_factor(at, depth);
+  }
+  return at;
+}
+
+void generate_opt(const char *path, size_t size) {
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "Could not create %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  // Repeats can hold repeats, so a line isn't bounded by MAX_DEPTH
+  size_t written = 0;
+  while (written < size) {
+    num_repeats = 0;
+    char *end = opt_expression(line, 0);
+    end += sprintf(end, ";\n");
+    if (end - line < 4 * MAX_LINE) {
+      written += fwrite(line, 1, end - line, fp);
+    }
+  }
+  fclose(fp);
+}
+
+// Returns the best time of RUNS runs of the code on either machine
+double run(const Ir_Code *code, const Bytecode *bytecode, int stack,
+           const int64_t *variables, int64_t *results) {
+  double best = 0;
+  for (int run = 0; run < RUNS; ++run) {
+    double start = now();
+    if (stack) {
+      run_bytecode(bytecode, variables, results);
+    } else {
+      run_ir(code, variables, results);
+    }
+    double elapsed = now() - start;
+    best = run == 0 || elapsed < best ? elapsed : best;
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : OPT_PATH;
+  size_t size = (size_t)(argc > 2 ? atol(argv[2]) : OPT_SIZE_MB) << 20;
+
+  ensure_input(path, size, generate_opt);
+  if (!freopen(path, "rb", stdin)) {
+    fprintf(stderr, "Could not open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  statements();
+  double  start     = now();
+  Ir_Code optimized = optimize_ir(&ir);
+  double  elapsed   = now() - start;
+
+  Bytecode plain_bc     = ir_to_bytecode(&ir);
+  Bytecode optimized_bc = ir_to_bytecode(&optimized);
+  printf("%zu statements, optimized in %.3f s\n", ir.statements, elapsed);
+  printf("instructions %10zu -> %10zu (%.1f%% fewer)\n", ir.count,
+         optimized.count, 100.0 * (ir.count - optimized.count) / ir.count);
+
+  int64_t *variables = malloc(sizeof(int64_t) * (code_variables() + 1));
+  int64_t *expected  = malloc(sizeof(int64_t) * (ir.statements + 1));
+  int64_t *results   = malloc(sizeof(int64_t) * (ir.statements + 1));
+  if (!variables || !expected || !results) {
+    fprintf(stderr, "Could not allocate the results\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < code_variables(); ++i) {
+    variables[i] = i * 7 + 3;
+  }
+
+  printf("%-9s %12s %12s %9s %10s\n", "machine", "plain ms", "optimized ms",
+         "speedup", "mismatch");
+  const char *machines[] = {"registers", "stack"};
+  for (int stack = 0; stack < 2; ++stack) {
+    double plain = run(&ir, &plain_bc, stack, variables, expected);
+    double fast  = run(&optimized, &optimized_bc, stack, variables, results);
+
+    size_t mismatch = 0;
+    for (size_t i = 0; i < ir.statements; ++i) {
+      mismatch += expected[i] != results[i];
+    }
+    printf("%-9s %12.2f %12.2f %8.2fx %10zu\n", machines[stack], plain * 1e3,
+           fast * 1e3, plain / fast, mismatch);
+  }
+
+  free(results);
+  free(expected);
+  free(variables);
+  bytecode_free(&optimized_bc);
+  bytecode_free(&plain_bc);
+  ir_free(&optimized);
+  ir_free(&ir);
+  return 0;
+}
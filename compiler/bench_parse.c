@@ -0,0 +1,73 @@
+#include "improved.c"
+#include "bench_gen.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Parse time of improved.c's statements() on a generated file of expression
+ * statements, a statement per line, with
+ * - stream: match() and advance() calling lex() a token at a time
+ * - tokens: lex_tokens() lexing it all up front, with 1 to N threads, and
+ *           statements() walking the token buffer
+ * Reading the input counts as lexing. The lexer keeps its input and its
+ * position, so each run is a child process of its own.
+ *
+ * BUILD: cc -O2 -pthread -o bench_parse bench_parse.c
+ * USAGE: ./bench_parse [file] [size in MB] [max threads]
+ */
+
+#define MAX_THREADS 4
+
+// Parses `path` in a child, printing a line for the run
+void run(const char *path, int threads) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "Could not fork\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pid > 0) {
+    int status;
+    waitpid(pid, &status, 0);
+    return;
+  }
+
+  if (!freopen(path, "rb", stdin)) {
+    fprintf(stderr, "Could not open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  double start = now();
+  double lexed = start;
+  if (threads > 0) {
+    lex_tokens(threads);
+    lexed = now();
+  }
+  statements();
+  double end = now();
+
+  if (threads > 0) {
+    printf("tokens %-3d %10.3f %10.3f %10.3f\n", threads, lexed - start,
+           end - lexed, end - start);
+  } else {
+    printf("stream     %10s %10s %10.3f\n", "-", "-", end - start);
+  }
+  exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : LEX_PATH;
+  size_t size = (size_t)(argc > 2 ? atol(argv[2]) : LEX_SIZE_MB) << 20;
+  int max_threads = argc > 3 ? atoi(argv[3]) : MAX_THREADS;
+  ensure_input(path, size, generate_lex);
+
+  printf("%-10s %10s %10s %10s\n", "mode", "lex s", "parse s", "total s");
+  run(path, 0);
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    run(path, threads);
+  }
+  return 0;
+}
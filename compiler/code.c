@@ -0,0 +1,361 @@
+#include "code.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Ir_Code ir = {0};
+
+static uint32_t next_register = 0;    // The lowest free register
+
+/*
+ * Variables: a number per distinct name, in order of first use, found through
+ * an open addressing table of ids + 1 (0 is an empty slot). Names point into
+ * the input, which the lexer keeps.
+ */
+static char   **variable_names   = NULL;
+static int     *variable_lengths = NULL;
+static size_t   num_variables    = 0;
+static uint32_t *variable_slots  = NULL;
+static size_t   num_slots        = 0;      // A power of 2, at least twice ids
+
+static void *grow(void *array, size_t *capacity, size_t size) {
+  *capacity = *capacity ? *capacity * 2 : 256;
+  array = realloc(array, *capacity * size);
+  if (!array) {
+    fprintf(stderr, "Could not allocate the code\n");
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+static uint32_t hash_name(char *name, int len) {
+  uint32_t hash = 2166136261u;    // FNV-1a
+  for (int i = 0; i < len; ++i) {
+    hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// The slot of `name`, or the empty one it would go in
+static uint32_t *find_slot(char *name, int len) {
+  size_t mask = num_slots - 1;
+  for (size_t i = hash_name(name, len) & mask;; i = (i + 1) & mask) {
+    uint32_t id = variable_slots[i];
+    if (id == 0 || (variable_lengths[id - 1] == len &&
+                    memcmp(variable_names[id - 1], name, len) == 0)) {
+      return &variable_slots[i];
+    }
+  }
+}
+
+static void rehash(void) {
+  num_slots = num_slots ? num_slots * 2 : 1024;
+  free(variable_slots);
+  variable_slots = calloc(num_slots, sizeof(uint32_t));
+  if (!variable_slots) {
+    fprintf(stderr, "Could not allocate the variables\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t id = 0; id < num_variables; ++id) {
+    *find_slot(variable_names[id], variable_lengths[id]) = id + 1;
+  }
+}
+
+static uint32_t variable(char *name, int len) {
+  static size_t capacity = 0;
+
+  if (2 * (num_variables + 1) > num_slots) {
+    rehash();
+  }
+
+  uint32_t *slot = find_slot(name, len);
+  if (*slot == 0) {
+    if (num_variables == capacity) {
+      size_t lengths = capacity;
+      variable_names   = grow(variable_names, &capacity, sizeof(char *));
+      variable_lengths = grow(variable_lengths, &lengths, sizeof(int));
+    }
+    variable_names[num_variables]   = name;
+    variable_lengths[num_variables] = len;
+    *slot = ++num_variables;
+  }
+  return *slot - 1;
+}
+
+size_t code_variables(void) {
+  return num_variables;
+}
+
+char *code_variable_name(size_t id, int *len) {
+  *len = variable_lengths[id];
+  return variable_names[id];
+}
+
+long code_variable_id(char *name, int len) {
+  if (num_slots == 0) {
+    return -1;
+  }
+  uint32_t id = *find_slot(name, len);
+  return (long)id - 1;
+}
+
+static Ir *emit(int op, uint32_t dest) {
+  if (ir.count == ir.capacity) {
+    ir.code = grow(ir.code, &ir.capacity, sizeof(Ir));
+  }
+
+  Ir *instruction = &ir.code[ir.count++];
+  memset(instruction, 0, sizeof(Ir));
+  instruction->op   = op;
+  instruction->dest = dest;
+  return instruction;
+}
+
+static uint32_t new_register(void) {
+  if (++next_register > ir.registers) {
+    ir.registers = next_register;
+  }
+  return next_register - 1;
+}
+
+// Loads a number, or a variable if it isn't all digits, into a new register
+int code_load(char *text, int len) {
+  uint64_t number = 0;
+  int      i      = 0;
+  for (; i < len && text[i] >= '0' && text[i] <= '9'; ++i) {
+    number = number * 10 + (text[i] - '0');    // Wrapping around, like the code
+  }
+  if (i == len) {
+    return code_number((int64_t)number);
+  }
+
+  uint32_t reg = new_register();
+  emit(IR_VARIABLE, reg)->value = variable(text, len);
+  return reg;
+}
+
+int code_number(int64_t number) {
+  uint32_t reg = new_register();
+  emit(IR_NUMBER, reg)->value = number;
+  return reg;
+}
+
+// left = left op right, freeing right, the register above left
+void code_binary(int op, int left, int right) {
+  Ir *instruction = emit(op, left);
+  instruction->left  = left;
+  instruction->right = right;
+  --next_register;
+}
+
+void code_result(int reg) {
+  emit(IR_RESULT, 0)->left = reg;
+  --next_register;
+  ++ir.statements;
+}
+
+void print_ir(FILE *fp, const Ir_Code *code) {
+  for (size_t i = 0; i < code->count; ++i) {
+    const Ir *in = &code->code[i];
+    int   len;
+    char *name;
+
+    switch (in->op) {
+      case IR_NUMBER:
+        fprintf(fp, "t%u = %lld\n", in->dest, (long long)in->value);
+        break;
+      case IR_VARIABLE:
+        name = code_variable_name(in->value, &len);
+        fprintf(fp, "t%u = %.*s\n", in->dest, len, name);
+        break;
+      case IR_ADD:
+      case IR_MUL:
+        fprintf(fp, "t%u = t%u %c t%u\n", in->dest, in->left,
+                in->op == IR_ADD ? '+' : '*', in->right);
+        break;
+      case IR_RESULT:
+        fprintf(fp, "result t%u\n", in->left);
+        break;
+      case IR_SAVE:
+      case IR_RESTORE:
+        fprintf(fp, "t%u = t%u\n", in->dest, in->left);
+        break;
+    }
+  }
+}
+
+// Arithmetic wraps around, as on the machine
+static inline int64_t add(int64_t a, int64_t b) {
+  return (int64_t)((uint64_t)a + (uint64_t)b);
+}
+
+static inline int64_t mul(int64_t a, int64_t b) {
+  return (int64_t)((uint64_t)a * (uint64_t)b);
+}
+
+// Runs the code on registers, a result per statement
+void run_ir(const Ir_Code *code, const int64_t *variables, int64_t *results) {
+  int64_t *t = malloc(sizeof(int64_t) * (code->registers + 1));
+  if (!t) {
+    fprintf(stderr, "Could not allocate the registers\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (const Ir *in = code->code, *end = in + code->count; in < end; ++in) {
+    switch (in->op) {
+      case IR_NUMBER:   t[in->dest] = in->value;                         break;
+      case IR_VARIABLE: t[in->dest] = variables[in->value];              break;
+      case IR_ADD:      t[in->dest] = add(t[in->left], t[in->right]);    break;
+      case IR_MUL:      t[in->dest] = mul(t[in->left], t[in->right]);    break;
+      case IR_RESULT:   *results++  = t[in->left];                       break;
+      case IR_SAVE:
+      case IR_RESTORE:  t[in->dest] = t[in->left];                       break;
+    }
+  }
+  free(t);
+}
+
+void ir_free(Ir_Code *code) {
+  free(code->code);
+  memset(code, 0, sizeof(Ir_Code));
+}
+
+static Bc *emit_bc(Bytecode *bytecode, size_t *capacity, uint32_t op,
+                   uint32_t arg) {
+  if (bytecode->count == *capacity) {
+    bytecode->code = grow(bytecode->code, capacity, sizeof(Bc));
+  }
+
+  Bc *bc = &bytecode->code[bytecode->count++];
+  bc->op  = op;
+  bc->arg = arg;
+  return bc;
+}
+
+/*
+ * As registers are handed out as a stack, t<n> is an entry of the machine's
+ * stack: loads push, operations pop their right operand into the left one.
+ * Saved registers are locals of the same number.
+ */
+Bytecode ir_to_bytecode(const Ir_Code *code) {
+  Bytecode bytecode  = {0};
+  size_t   capacity  = code->count;    // An instruction each
+  size_t   constants = 0;
+
+  bytecode.code = malloc(sizeof(Bc) * (capacity + 1));
+  if (!bytecode.code) {
+    fprintf(stderr, "Could not allocate the bytecode\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < code->count; ++i) {
+    const Ir *in = &code->code[i];
+    switch (in->op) {
+      case IR_NUMBER:
+        if (in->value >= INT32_MIN && in->value <= INT32_MAX) {
+          emit_bc(&bytecode, &capacity, BC_SMALL, (uint32_t)in->value);
+          break;
+        }
+        if (bytecode.num_constants == constants) {
+          bytecode.constants =
+              grow(bytecode.constants, &constants, sizeof(int64_t));
+        }
+        bytecode.constants[bytecode.num_constants] = in->value;
+        emit_bc(&bytecode, &capacity, BC_CONSTANT, bytecode.num_constants++);
+        break;
+      case IR_VARIABLE:
+        emit_bc(&bytecode, &capacity, BC_VARIABLE, in->value);
+        break;
+      case IR_ADD:
+        emit_bc(&bytecode, &capacity, BC_ADD, 0);
+        break;
+      case IR_MUL:
+        emit_bc(&bytecode, &capacity, BC_MUL, 0);
+        break;
+      case IR_RESULT:
+        emit_bc(&bytecode, &capacity, BC_RESULT, 0);
+        break;
+      case IR_SAVE:
+        emit_bc(&bytecode, &capacity, BC_TEE, in->dest);
+        break;
+      case IR_RESTORE:
+        emit_bc(&bytecode, &capacity, BC_LOAD, in->left);
+        break;
+    }
+  }
+
+  bytecode.statements = code->statements;
+  bytecode.stack_size = code->registers;
+  return bytecode;
+}
+
+void print_bytecode(FILE *fp, const Bytecode *bytecode) {
+  for (size_t i = 0; i < bytecode->count; ++i) {
+    const Bc *bc = &bytecode->code[i];
+    int   len;
+    char *name;
+
+    switch (bc->op) {
+      case BC_SMALL:
+        fprintf(fp, "push %d\n", (int32_t)bc->arg);
+        break;
+      case BC_CONSTANT:
+        fprintf(fp, "push %lld\n", (long long)bytecode->constants[bc->arg]);
+        break;
+      case BC_VARIABLE:
+        name = code_variable_name(bc->arg, &len);
+        fprintf(fp, "push %.*s\n", len, name);
+        break;
+      case BC_ADD:
+        fprintf(fp, "add\n");
+        break;
+      case BC_MUL:
+        fprintf(fp, "mul\n");
+        break;
+      case BC_RESULT:
+        fprintf(fp, "result\n");
+        break;
+      case BC_TEE:
+        fprintf(fp, "tee l%u\n", bc->arg);
+        break;
+      case BC_LOAD:
+        fprintf(fp, "push l%u\n", bc->arg);
+        break;
+    }
+  }
+}
+
+// Runs the bytecode, a result per statement
+void run_bytecode(const Bytecode *bytecode, const int64_t *variables,
+                  int64_t *results) {
+  int64_t *locals = malloc(sizeof(int64_t) * 2 * (bytecode->stack_size + 1));
+  if (!locals) {
+    fprintf(stderr, "Could not allocate the stack\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const int64_t *constants = bytecode->constants;
+  int64_t       *top       = locals + bytecode->stack_size + 1;  // Above it
+
+  for (const Bc *bc = bytecode->code, *end = bc + bytecode->count; bc < end;
+       ++bc) {
+    switch (bc->op) {
+      case BC_SMALL:    *top++ = (int32_t)bc->arg;              break;
+      case BC_CONSTANT: *top++ = constants[bc->arg];            break;
+      case BC_VARIABLE: *top++ = variables[bc->arg];            break;
+      case BC_ADD:      --top; top[-1] = add(top[-1], *top);    break;
+      case BC_MUL:      --top; top[-1] = mul(top[-1], *top);    break;
+      case BC_RESULT:   *results++ = *--top;                    break;
+      case BC_TEE:      locals[bc->arg] = top[-1];              break;
+      case BC_LOAD:     *top++ = locals[bc->arg];               break;
+    }
+  }
+  free(locals);
+}
+
+void bytecode_free(Bytecode *bytecode) {
+  free(bytecode->code);
+  free(bytecode->constants);
+  memset(bytecode, 0, sizeof(Bytecode));
+}
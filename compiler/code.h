@@ -0,0 +1,91 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Three-address code: an instruction per operation, each setting register
+ * `dest`. The parser hands out registers as a stack, t0 for the outermost
+ * value of a statement, so an operation's left operand is always its dest
+ * and its right one the register above. The optimizer keeps values it uses
+ * more than once in registers below the stack, copying them out of it with
+ * IR_SAVE and back onto it with IR_RESTORE.
+ */
+#define IR_NUMBER    0    // dest = value
+#define IR_VARIABLE  1    // dest = variable number `value`
+#define IR_ADD       2    // dest = left + right
+#define IR_MUL       3    // dest = left * right
+#define IR_RESULT    4    // The statement's value is in left
+#define IR_SAVE      5    // dest = left, left being the top of the stack
+#define IR_RESTORE   6    // dest = left, dest being above the stack
+
+typedef struct {
+  uint8_t  op;
+  uint32_t dest;
+  uint32_t left;
+  uint32_t right;
+  int64_t  value;
+} Ir;
+
+typedef struct {
+  Ir      *code;
+  size_t   count;
+  size_t   capacity;
+  size_t   statements;
+  uint32_t registers;     // Most registers in use at once
+} Ir_Code;
+
+extern Ir_Code ir;        // What the parser emits
+
+int  code_load(char *text, int len);
+int  code_number(int64_t number);
+void code_binary(int op, int left, int right);
+void code_result(int reg);
+
+size_t code_variables(void);
+char  *code_variable_name(size_t id, int *len);
+long   code_variable_id(char *name, int len);
+
+Ir_Code optimize_ir(const Ir_Code *code);
+
+void print_ir(FILE *fp, const Ir_Code *code);
+void run_ir(const Ir_Code *code, const int64_t *variables, int64_t *results);
+void ir_free(Ir_Code *code);
+
+/*
+ * Stack machine bytecode: an opcode and a 32-bit argument per instruction,
+ * operands and results on a stack, and saved values in locals. Numbers that
+ * don't fit in the argument go in a constant pool.
+ */
+#define BC_SMALL     0    // Push arg, a signed 32-bit number
+#define BC_CONSTANT  1    // Push constants[arg]
+#define BC_VARIABLE  2    // Push variables[arg]
+#define BC_ADD       3    // Pop two, push their sum
+#define BC_MUL       4    // Pop two, push their product
+#define BC_RESULT    5    // Pop the statement's value into the results
+#define BC_TEE       6    // Copy the top of the stack into locals[arg]
+#define BC_LOAD      7    // Push locals[arg]
+
+typedef struct {
+  uint32_t op;
+  uint32_t arg;
+} Bc;
+
+typedef struct {
+  Bc      *code;
+  size_t   count;
+  int64_t *constants;
+  size_t   num_constants;
+  size_t   statements;
+  size_t   stack_size;    // Also the number of locals
+} Bytecode;
+
+Bytecode ir_to_bytecode(const Ir_Code *code);
+void     print_bytecode(FILE *fp, const Bytecode *bytecode);
+void     run_bytecode(const Bytecode *bytecode, const int64_t *variables,
+                      int64_t *results);
+void     bytecode_free(Bytecode *bytecode);
+
+#endif
@@ -1,12 +1,20 @@
 #include "lex.h"
 #include "lex.c"
+#include "code.h"
+#include "code.c"
 #include <stdarg.h>
 #include <stdio.h>
 
-void expression(void);
-void term(void);
-void factor(void);
-int legal_lookahead(int first_arg);
+/*
+ * Emits three-address code (code.c) into `ir` as it parses: expression(),
+ * term() and factor() each return the register their value ends up in,
+ * loading 0 where the input has no value to give
+ */
+
+int expression(void);
+int term(void);
+int factor(void);
+int legal_lookahead(int first_arg, ...);
 
 void statements(void) {
   /*
@@ -14,68 +22,76 @@ void statements(void) {
    */
 
   while (!match(EOI)) {
-    expression();
+    code_result(expression());
     if (match(SEMI)) {
       advance();
     } else {
-      fprintf(stderr, "%d: Inserting missing semicolon\n", yylineno);
+      fprintf(stderr, "%d: Inserting missing semicolon\n", lex_lineno());
     }
   }
 }
 
-void expression(void) {
+int expression(void) {
   /*
    * expression -> term expression'
    *             | PLUS term expression' 
    *             | epsilon
    */
   if (!legal_lookahead(NUM_OR_ID, LP, 0)) {
-    return;
+    return code_number(0);
   }
 
-  term();
+  int reg = term();
   while (match(PLUS)) {
     advance();
-    term();
+    code_binary(IR_ADD, reg, term());
   }
+  return reg;
 }
 
-void term(void) {
+int term(void) {
   if (!legal_lookahead(NUM_OR_ID, LP, 0)) {
-    return;
+    return code_number(0);
   }
 
-  factor();
+  int reg = factor();
   while ( match(TIMES) ) {
     advance();
-    factor();
+    code_binary(IR_MUL, reg, factor());
   }
+  return reg;
 }
 
-void factor(void) {
+int factor(void) {
   if (!legal_lookahead(NUM_OR_ID, LP, 0)) {
-    return;
+    return code_number(0);
   }
 
+  int reg;
   if (match(NUM_OR_ID)) {
+    int   len;
+    char *text = lex_lexeme(&len);
+    reg = code_load(text, len);
     advance();
   } else if (match(LP)) {
     advance();
-    expression();
+    reg = expression();
     if (match(RP)) {
       advance();
     } else {
-      fprintf(stderr, "%d: Mismatched paranthesis\n", yylineno);
+      fprintf(stderr, "%d: Mismatched paranthesis\n", lex_lineno());
     }
   } else {
-    fprintf(stderr, "%d: Number or identifier expected\n", yylineno);
+    fprintf(stderr, "%d: Number or identifier expected\n", lex_lineno());
+    reg = code_number(0);
   }
+  return reg;
 }
 
 #define MAXFIRST  16
 #define SYNCH     SEMI
 
-int legal_lookahead(int first_arg) {
+int legal_lookahead(int first_arg, ...) {
   va_list args;
   int tok;
   int lookaheads[MAXFIRST], *p = lookaheads, *current;
@@ -91,10 +107,10 @@ int legal_lookahead(int first_arg) {
   } else {
     *p++ = first_arg;
     while ( (tok = va_arg(args, int)) && p < &lookaheads[MAXFIRST] ) {
-      *++p = tok;
+      *p++ = tok;
     }
 
-    while( !match(SYNCH) ) {
+    while( !match(SYNCH) && !match(EOI) ) {
       for (current = lookaheads; current < p; ++current) {
         if (match(*current)) {
           rval = 1;
@@ -103,7 +119,7 @@ int legal_lookahead(int first_arg) {
       }
 
       if (!error_printed) {
-        fprintf(stderr, "Line %d: Syntax error\n", yylineno);
+        fprintf(stderr, "Line %d: Syntax error\n", lex_lineno());
         error_printed = 1;
       }
 
@@ -0,0 +1,130 @@
+/* Iterative parser: the grammar of improved.c, with no recursion */
+
+#include "lex.h"
+#include "lex.c"
+#include "code.h"
+#include "code.c"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Operator precedence parsing with an explicit stack of the operators and
+ * open parentheses waiting for their right side, so the native stack stays
+ * the same depth however deep the input nests, and statements are a loop.
+ * Operands are registers, handed out as a stack as in improved.c: the
+ * statement's i-th pending value is in t<i>, and an operator applies to the
+ * top two. Emits the same code as improved.c for the same valid input.
+ *
+ * statements -> expression SEMI | expression SEMI statements
+ * expression -> expression PLUS expression
+ *             | expression TIMES expression
+ *             | LP expression RP
+ *             | NUM_OR_ID
+ *             | epsilon
+ *
+ * with TIMES binding tighter than PLUS and both to the left.
+ */
+
+static unsigned char *operators         = NULL;   // PLUS, TIMES and LP
+static size_t         operators_capacity = 0;
+
+static void push_operator(size_t *count, int token) {
+  if (*count == operators_capacity) {
+    operators_capacity = operators_capacity ? operators_capacity * 2 : 256;
+    operators = realloc(operators, operators_capacity);
+    if (!operators) {
+      fprintf(stderr, "Could not allocate the parser stack\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  operators[(*count)++] = token;
+}
+
+static int precedence(int token) {
+  return token == TIMES ? 2 : token == PLUS ? 1 : 0;
+}
+
+// Applies the operators on top that bind at least as tight as `token`
+static void reduce(size_t *count, int token, int *values) {
+  while (*count > 0 && precedence(operators[*count - 1]) > 0 &&
+         precedence(operators[*count - 1]) >= precedence(token)) {
+    int op = operators[--*count] == PLUS ? IR_ADD : IR_MUL;
+    code_binary(op, *values - 2, *values - 1);
+    --*values;
+  }
+}
+
+// Skips to a token that can start an operand, or to the end of the statement
+static void skip_to_operand(void) {
+  if (match(NUM_OR_ID) || match(LP) || match(SEMI) || match(EOI)) {
+    return;
+  }
+
+  fprintf(stderr, "Line %d: Syntax error\n", lex_lineno());
+  while (!match(NUM_OR_ID) && !match(LP) && !match(SEMI) && !match(EOI)) {
+    advance();
+  }
+}
+
+void statements(void) {
+  size_t count = 0;       // Operators on the stack
+
+  while (!match(EOI)) {
+    int    values  = 0;   // Registers holding pending values
+    int    operand = 1;   // Expecting an operand, not an operator
+    size_t open    = 0;   // LPs on the stack
+
+    while (1) {
+      if (operand) {
+        skip_to_operand();
+        if (match(NUM_OR_ID)) {
+          int   len;
+          char *text = lex_lexeme(&len);
+          code_load(text, len);
+          ++values;
+          operand = 0;
+          advance();
+        } else if (match(LP)) {
+          push_operator(&count, LP);
+          ++open;
+          advance();
+        } else {
+          // Nothing where an operand goes, as in "a + ;"
+          code_number(0);
+          ++values;
+          operand = 0;
+        }
+      } else if (match(PLUS) || match(TIMES)) {
+        int token = match(PLUS) ? PLUS : TIMES;
+        reduce(&count, token, &values);
+        push_operator(&count, token);
+        operand = 1;
+        advance();
+      } else if (match(RP) && open > 0) {
+        reduce(&count, LP, &values);
+        --count;
+        --open;
+        advance();
+      } else {
+        break;
+      }
+    }
+
+    // The end of the statement closes what's still open, with one message
+    reduce(&count, LP, &values);
+    if (open > 0) {
+      fprintf(stderr, "%d: Mismatched paranthesis\n", lex_lineno());
+      for (; open > 0; --open) {
+        --count;
+        reduce(&count, LP, &values);
+      }
+    }
+    code_result(0);
+
+    if (match(SEMI)) {
+      advance();
+    } else {
+      fprintf(stderr, "%d: Inserting missing semicolon\n", lex_lineno());
+    }
+  }
+}
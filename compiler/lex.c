@@ -1,72 +1,400 @@
+#define _POSIX_C_SOURCE 200809L // pthreads
 #include "lex.h"
-#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 char *yytext = "";    // Lexeme
 int yylen    = 0;     // Lexeme length
 int yylineno = 0;     // Input Line Number
 
-int lex(void) {
-  static char input_buffer[128];
-  char*       current;
+/*
+ * The whole of stdin is read into one buffer on the first call to lex(), so
+ * lines can be any length and a lexeme is never split across reads. The buffer
+ * ends in a '\0' which lex() stops at, so scanning a lexeme needs no bounds
+ * check. Characters are told apart by a lookup in char_class rather than by
+ * calls to isspace()/isalnum().
+ */
+
+#define INPUT_BLOCK (1 << 20)   // Bytes read from stdin at a time
+
+// Classes of characters past the tokens of lex.h
+#define CLASS_SPACE    (NUM_OR_ID + 1)
+#define CLASS_NEWLINE  (NUM_OR_ID + 2)
+#define CLASS_ILLEGAL  (NUM_OR_ID + 3)
+
+/*
+ * The token a character starts, or its class if it doesn't start one: EOI for
+ * '\0', a single character token, NUM_OR_ID for letters and digits
+ */
+static unsigned char char_class[256];
+
+static char *input_buffer = NULL;
+static char *input_end    = NULL;   // The '\0' after the input
+
+static void init_classes(void) {
+  for (int c = 0; c < 256; ++c) {
+    char_class[c] = CLASS_ILLEGAL;
+  }
+  for (int c = '0'; c <= '9'; ++c) {
+    char_class[c] = NUM_OR_ID;
+  }
+  for (int c = 'a'; c <= 'z'; ++c) {
+    char_class[c] = NUM_OR_ID;
+    char_class[c - 'a' + 'A'] = NUM_OR_ID;
+  }
+
+  char_class['\0'] = EOI;
+  char_class[';']  = SEMI;
+  char_class['+']  = PLUS;
+  char_class['*']  = TIMES;
+  char_class['(']  = LP;
+  char_class[')']  = RP;
+
+  char_class[' ']  = CLASS_SPACE;
+  char_class['\t'] = CLASS_SPACE;
+  char_class['\r'] = CLASS_SPACE;
+  char_class['\v'] = CLASS_SPACE;
+  char_class['\f'] = CLASS_SPACE;
+  char_class['\n'] = CLASS_NEWLINE;
+}
 
-  current = yytext + yylen;     // Skip current lexeme
+// The bytes left in stdin if it is a file, or -1
+static long input_size(void) {
+  long at = ftell(stdin);
+  if (at < 0 || fseek(stdin, 0, SEEK_END) != 0) {
+    return -1;
+  }
+
+  long size = ftell(stdin);
+  if (fseek(stdin, at, SEEK_SET) != 0) {
+    return -1;
+  }
+  return size - at;
+}
+
+static void load_input(void) {
+  // Sized to the file if stdin is one, so it's read with no reallocations
+  long   size     = input_size();
+  size_t capacity = size + 2 > INPUT_BLOCK ? (size_t)size + 2 : INPUT_BLOCK;
+  size_t length   = 0;
+  char  *buffer   = malloc(capacity);
+
+  while (buffer) {
+    length += fread(buffer + length, 1, capacity - length - 1, stdin);
+    if (length < capacity - 1) {
+      break;
+    }
+
+    capacity *= 2;
+    char *grown = realloc(buffer, capacity);
+    if (!grown) {
+      free(buffer);
+    }
+    buffer = grown;
+  }
+
+  if (!buffer || ferror(stdin)) {
+    fprintf(stderr, "Could not read the input\n");
+    exit(EXIT_FAILURE);
+  }
+
+  buffer[length] = '\0';
+  input_buffer = buffer;
+  input_end    = buffer + length;
+
+  init_classes();
+  yytext   = input_buffer;
+  yylen    = 0;
+  yylineno = 1;
+}
+
+/*
+ * Scans the token at *current, leaving *current past it and the lexeme in
+ * *text and *len, and counting the newlines it skips in *lineno. Returns
+ * CLASS_ILLEGAL, as a lexeme of its own, for a character that can't start a
+ * token.
+ */
+static inline int scan_token(char **current, char **text, int *len,
+                             int *lineno) {
+  char *at = *current;
 
   while (1) {
-    while (*current) {
-      /*
-       * Get new lines, skipping any leading whitespace on the line,
-       * until a non-blank line is found
-       */
-      current = input_buffer;
-      if (!fgets(input_buffer, 128, stdin)) {
-        *current = '\0';
-        return EOI;
-      }
+    int token = char_class[(unsigned char)*at];
+    while (token == CLASS_SPACE) {
+      token = char_class[(unsigned char)*++at];
+    }
 
-      ++yylineno;
+    if (token == CLASS_NEWLINE) {
+      ++*lineno;
+      ++at;
+      continue;
+    }
 
-      while (isspace(*current)) {
-        ++current;
+    *text = at;
+    if (token == NUM_OR_ID) {
+      while (char_class[(unsigned char)*++at] == NUM_OR_ID) {
       }
+    } else if (token != EOI) {
+      ++at;
+    } else if (at != input_end) {
+      // A '\0' inside the input
+      token = CLASS_ILLEGAL;
+      ++at;
     }
 
-    for (; *current; ++current) {
-      // Get the next token
-      yytext = current;
-      yylen = 1;
-
-      switch (*current) {
-        case EOF: return EOI; 
-        case ';': return SEMI;
-        case '+': return PLUS;
-        case '*': return TIMES;
-        case '(': return LP;
-        case ')': return RP;
-
-        case '\n':
-        case '\t':
-        case ' ' : break;
-
-        default:
-          if (!isalnum(*current)) {
-            fprintf(stdin, "Ignoring illegal input <%c>\n", *current);
-          } else {
-            while (isalnum(*current)) {
-              ++current;
-            }
-            yylen = current - yytext;
-            return NUM_OR_ID;
-          }
-          break;
-      }
+    *len = at - *text;
+    *current = at;
+    return token;
+  }
+}
+
+int lex(void) {
+  if (!input_buffer) {
+    load_input();
+  }
+
+  char *current = yytext + yylen;     // Skip current lexeme
+  int   token;
+
+  while ((token = scan_token(&current, &yytext, &yylen, &yylineno)) ==
+         CLASS_ILLEGAL) {
+    fprintf(stderr, "%d: Ignoring illegal input <%c>\n", yylineno, *yytext);
+  }
+  return token;
+}
+
+/*
+ * Token buffer: the rest of the input lexed up front by lex_tokens(), which
+ * match() and advance() then walk by index instead of calling lex(). A token
+ * is an entry in each of the arrays, its lexeme an offset into the input
+ * buffer, which limits the input to 4 GB. The last token is EOI.
+ *
+ * Parsing only reads the kinds, a byte per token. yytext, yylen and yylineno
+ * are lex()'s and stay where it left them, lex_lineno() and lex_lexeme() have
+ * the line and the lexeme of the lookahead.
+ */
+typedef struct {
+  unsigned char *kinds;
+  uint32_t      *offsets;
+  uint32_t      *lengths;
+  uint32_t      *lines;
+  size_t         count;
+  size_t         capacity;
+} Tokens;
+
+static Tokens tokens;
+static size_t token_at;        // Index of the lookahead
+static int    token_mode = 0;  // match() and advance() walk tokens
+
+/*
+ * The input is split after a ';' into a chunk per thread, each lexed into
+ * its own Tokens with lines counted from 1, then copied into its place in
+ * the token buffer by the same thread, shifting the lines by those of the
+ * chunks before it
+ */
+typedef struct {
+  char     *begin;
+  char     *end;
+  Tokens    tokens;
+  int       lines;      // yylineno at the end of the chunk
+  size_t    illegal;    // CLASS_ILLEGAL tokens in it
+  size_t    first;      // Index of its first token in the token buffer
+  int       base;       // Lines before it
+  pthread_t thread;
+} Lex_Chunk;
+
+static void tokens_alloc(Tokens *t, size_t capacity) {
+  t->kinds    = malloc(capacity);
+  t->offsets  = malloc(capacity * sizeof(uint32_t));
+  t->lengths  = malloc(capacity * sizeof(uint32_t));
+  t->lines    = malloc(capacity * sizeof(uint32_t));
+  t->count    = 0;
+  t->capacity = capacity;
+  if (!t->kinds || !t->offsets || !t->lengths || !t->lines) {
+    fprintf(stderr, "Could not allocate the tokens\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void tokens_free(Tokens *t) {
+  free(t->kinds);
+  free(t->offsets);
+  free(t->lengths);
+  free(t->lines);
+}
+
+static void tokens_push(Tokens *t, int kind, char *text, int len, int line) {
+  if (t->count == t->capacity) {
+    Tokens grown;
+    tokens_alloc(&grown, t->capacity * 2);
+    memcpy(grown.kinds, t->kinds, t->count);
+    memcpy(grown.offsets, t->offsets, t->count * sizeof(uint32_t));
+    memcpy(grown.lengths, t->lengths, t->count * sizeof(uint32_t));
+    memcpy(grown.lines, t->lines, t->count * sizeof(uint32_t));
+    grown.count = t->count;
+    tokens_free(t);
+    *t = grown;
+  }
+
+  t->kinds[t->count]   = kind;
+  t->offsets[t->count] = text - input_buffer;
+  t->lengths[t->count] = len;
+  t->lines[t->count]   = line;
+  ++t->count;
+}
+
+static void *lex_chunk(void *arg) {
+  Lex_Chunk *chunk   = arg;
+  char      *current = chunk->begin;
+  char      *text;
+  int        len;
+  int        token;
+
+  // Guessing a token per 2 bytes, when they take 2.5 on average
+  tokens_alloc(&chunk->tokens, (chunk->end - chunk->begin) / 2 + 16);
+  chunk->lines = 1;
+  while (current < chunk->end &&
+         (token = scan_token(&current, &text, &len, &chunk->lines)) != EOI) {
+    tokens_push(&chunk->tokens, token, text, len, chunk->lines);
+    chunk->illegal += token == CLASS_ILLEGAL;
+  }
+  return NULL;
+}
+
+static void *copy_chunk(void *arg) {
+  Lex_Chunk *chunk = arg;
+  Tokens    *from  = &chunk->tokens;
+  size_t     to    = chunk->first;
+
+  for (size_t t = 0; t < from->count; ++t) {
+    if (from->kinds[t] != CLASS_ILLEGAL) {
+      tokens.kinds[to]   = from->kinds[t];
+      tokens.offsets[to] = from->offsets[t];
+      tokens.lengths[to] = from->lengths[t];
+      tokens.lines[to]   = from->lines[t] + chunk->base;
+      ++to;
     }
   }
+  tokens_free(from);
+  return NULL;
+}
+
+// Prints the messages lex() would have for the chunk's illegal characters
+static void report_illegal(Lex_Chunk *chunk) {
+  Tokens *t = &chunk->tokens;
+  if (chunk->illegal == 0) {
+    return;
+  }
+  for (size_t i = 0; i < t->count; ++i) {
+    if (t->kinds[i] == CLASS_ILLEGAL) {
+      fprintf(stderr, "%d: Ignoring illegal input <%c>\n",
+              t->lines[i] + chunk->base, input_buffer[t->offsets[i]]);
+    }
+  }
+}
+
+// Runs `work` on every chunk, a thread each, the first on this one
+static void run_chunks(Lex_Chunk *chunks, size_t count,
+                       void *(*work)(void *)) {
+  for (size_t i = 1; i < count; ++i) {
+    if (pthread_create(&chunks[i].thread, NULL, work, &chunks[i]) != 0) {
+      fprintf(stderr, "Could not start a lexer thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  work(&chunks[0]);
+  for (size_t i = 1; i < count; ++i) {
+    pthread_join(chunks[i].thread, NULL);
+  }
+}
+
+/*
+ * Lexes the rest of the input with `threads` threads into the token buffer
+ * and makes match() and advance() walk it. Call before the first match().
+ */
+void lex_tokens(int threads) {
+  if (!input_buffer) {
+    load_input();
+  }
+  if (input_end - input_buffer > (long)UINT32_MAX) {
+    fprintf(stderr, "Input too large for the token buffer\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char  *begin  = yytext + yylen;
+  size_t count  = threads > 1 ? threads : 1;
+  size_t size   = input_end - begin;
+  Lex_Chunk *chunks = calloc(count, sizeof(Lex_Chunk));
+  if (!chunks) {
+    fprintf(stderr, "Could not allocate the chunks\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    chunks[i].begin = i == 0 ? begin : chunks[i - 1].end;
+    chunks[i].end   = input_end;
+    if (i + 1 < count) {
+      char *split = begin + size / count * (i + 1);
+      split = split > chunks[i].begin ? split : chunks[i].begin;
+      char *semi = memchr(split, ';', input_end - split);
+      chunks[i].end = semi ? semi + 1 : input_end;
+    }
+  }
+
+  run_chunks(chunks, count, lex_chunk);
+
+  int base = yylineno - 1;    // Lines before the chunk
+  if (count == 1 && chunks[0].illegal == 0 && base == 0) {
+    // Already in place
+    tokens = chunks[0].tokens;
+    base  += chunks[0].lines - 1;
+  } else {
+    size_t total = 1;
+    for (size_t i = 0; i < count; ++i) {
+      chunks[i].first = total - 1;
+      chunks[i].base  = base;
+      total += chunks[i].tokens.count - chunks[i].illegal;
+      base  += chunks[i].lines - 1;
+      report_illegal(&chunks[i]);
+    }
+
+    tokens_alloc(&tokens, total);
+    run_chunks(chunks, count, copy_chunk);
+    tokens.count = total - 1;
+  }
+  tokens_push(&tokens, EOI, input_end, 0, base + 1);
+  free(chunks);
+
+  token_mode = 1;
+  token_at   = 0;
+}
+
+// The line of the lookahead, in either mode
+int lex_lineno(void) {
+  return token_mode ? (int)tokens.lines[token_at] : yylineno;
+}
+
+// The lexeme of the lookahead, in either mode
+char *lex_lexeme(int *len) {
+  if (token_mode) {
+    *len = tokens.lengths[token_at];
+    return input_buffer + tokens.offsets[token_at];
+  }
+
+  *len = yylen;
+  return yytext;
 }
 
 static int lookahead = -1;
 
 int match(int token) {
+  if (token_mode) {
+    return token == tokens.kinds[token_at];
+  }
+
   if (lookahead == -1) {
     lookahead = lex();
   }
@@ -74,5 +402,12 @@ int match(int token) {
   return token == lookahead;
 }
 
+void advance(void) {
+  if (token_mode) {
+    // EOI stays the lookahead
+    token_at += tokens.kinds[token_at] != EOI;
+    return;
+  }
+
   lookahead = lex();
 }
@@ -9,3 +9,11 @@
 extern char* yytext; 
 extern int yylen;
 extern int yylineno;
+
+
+int  lex(void);
+int  match(int token);
+void advance(void);
+void lex_tokens(int threads);
+int  lex_lineno(void);
+char *lex_lexeme(int *len);
@@ -1,5 +1,83 @@
-#include "plain.c"
+#include "iterative.c"
+#include "optimize.c"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
 
-int main(void) {
+/*
+ * Compiles the statements on stdin and prints their three-address code, or
+ * with -b their bytecode, or with -r runs them and prints each one's value.
+ * -O optimizes the code first. Variables are 0 unless given as name=value
+ * after -r.
+ *
+ * -t lexes all of the input into the token buffer before parsing, with
+ * `threads` threads (1 if not given). Illegal characters are then reported
+ * ahead of any parse error, instead of where the parser reaches them, which
+ * changes the order of the messages on stderr.
+ *
+ * USAGE: ./main [-t [threads]] [-O] [-b | -r [name=value]...] < input
+ */
+
+int main(int argc, char **argv) {
+  int arg     = 1;
+  int threads = 0;  // Lex a token at a time
+  if (argc > arg && strcmp(argv[arg], "-t") == 0) {
+    threads = 1;
+    if (argc > ++arg && isdigit((unsigned char)argv[arg][0])) {
+      threads = atoi(argv[arg++]);
+    }
+  }
+
+  int optimize = argc > arg && strcmp(argv[arg], "-O") == 0;
+  arg += optimize;
+  int bytecode = argc > arg && strcmp(argv[arg], "-b") == 0;
+  int run      = argc > arg && strcmp(argv[arg], "-r") == 0;
+  if (argc > arg && !bytecode && !run) {
+    fprintf(stderr,
+            "USAGE: %s [-t [threads]] [-O] [-b | -r [name=value]...] < input\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (threads > 0) {
+    lex_tokens(threads);
+  }
   statements();
+  Ir_Code code = optimize ? optimize_ir(&ir) : ir;
+  if (!bytecode && !run) {
+    print_ir(stdout, &code);
+    return 0;
+  }
+
+  Bytecode bc = ir_to_bytecode(&code);
+  if (bytecode) {
+    print_bytecode(stdout, &bc);
+    return 0;
+  }
+
+  int64_t *variables = calloc(code_variables() + 1, sizeof(int64_t));
+  int64_t *results   = malloc((bc.statements + 1) * sizeof(int64_t));
+  if (!variables || !results) {
+    fprintf(stderr, "Could not allocate the variables\n");
+    return EXIT_FAILURE;
+  }
+
+  for (int i = arg + 1; i < argc; ++i) {
+    char *equals = strchr(argv[i], '=');
+    if (!equals) {
+      fprintf(stderr, "Expected name=value, got %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+
+    long id = code_variable_id(argv[i], equals - argv[i]);
+    if (id >= 0) {
+      variables[id] = strtoll(equals + 1, NULL, 10);
+    }
+  }
+
+  run_bytecode(&bc, variables, results);
+  for (size_t i = 0; i < bc.statements; ++i) {
+    printf("%lld\n", (long long)results[i]);
+  }
+  return 0;
 }
@@ -0,0 +1,292 @@
+#include "code.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Optimizer: rebuilds each statement's three-address code as a DAG, then
+ * emits it again from the DAG. While building it
+ * - operations on two numbers are folded into one
+ * - numbers go right of a + or *, and a number on the right of the same
+ *   operation on the left is folded in: (x + 2) + 3 is x + 5
+ * - x + 0 and x * 1 are x, x * 0 is 0
+ * - the operands of + and * are put in order, so a + b and b + a are the same
+ * - every node is looked up in a hash table before it's made, so equal
+ *   subexpressions are one node
+ * Arithmetic wraps around, so none of this changes a result. Operations
+ * that end up used more than once are computed once and kept in a saved
+ * register.
+ */
+
+#define NO_SAVED UINT32_MAX
+
+typedef struct {
+  uint8_t  op;
+  uint32_t left;        // Nodes, for IR_ADD and IR_MUL
+  uint32_t right;
+  int64_t  value;       // IR_NUMBER's number, IR_VARIABLE's variable
+  uint32_t uses;
+  uint32_t saved;       // Its saved register once computed, if used again
+  uint32_t slot;        // Its slot in the hash table
+} Node;
+
+// The DAG of a statement, emptied for the next
+static Node     *nodes         = NULL;
+static size_t    num_nodes     = 0;
+static size_t    nodes_capacity = 0;
+static uint32_t *node_slots    = NULL;   // Node ids + 1, 0 for none
+static size_t    num_node_slots = 0;     // A power of 2, at least twice nodes
+
+static void *grow_array(void *array, size_t *capacity, size_t size) {
+  *capacity = *capacity ? *capacity * 2 : 256;
+  array = realloc(array, *capacity * size);
+  if (!array) {
+    fprintf(stderr, "Could not allocate the optimizer\n");
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+static size_t hash_node(int op, uint32_t left, uint32_t right, int64_t value) {
+  uint64_t hash = (uint64_t)value * 0x9E3779B97F4A7C15ull;
+  hash ^= ((uint64_t)left << 32 | right) + op;
+  hash *= 0xFF51AFD7ED558CCDull;
+  return hash ^ hash >> 32;
+}
+
+static uint32_t *find_node_slot(int op, uint32_t left, uint32_t right,
+                                int64_t value) {
+  size_t mask = num_node_slots - 1;
+  for (size_t i = hash_node(op, left, right, value) & mask;;
+       i = (i + 1) & mask) {
+    uint32_t id = node_slots[i];
+    if (id == 0) {
+      return &node_slots[i];
+    }
+
+    Node *n = &nodes[id - 1];
+    if (n->op == op && n->left == left && n->right == right &&
+        n->value == value) {
+      return &node_slots[i];
+    }
+  }
+}
+
+static void rehash_nodes(void) {
+  num_node_slots = num_node_slots ? num_node_slots * 2 : 1024;
+  free(node_slots);
+  node_slots = calloc(num_node_slots, sizeof(uint32_t));
+  if (!node_slots) {
+    fprintf(stderr, "Could not allocate the optimizer\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t id = 0; id < num_nodes; ++id) {
+    Node     *n    = &nodes[id];
+    uint32_t *slot = find_node_slot(n->op, n->left, n->right, n->value);
+    *slot   = id + 1;
+    n->slot = slot - node_slots;
+  }
+}
+
+// The node for op(left, right) or the leaf `value`, made if there's none
+static uint32_t node(int op, uint32_t left, uint32_t right, int64_t value) {
+  if (2 * (num_nodes + 1) > num_node_slots) {
+    rehash_nodes();
+  }
+
+  uint32_t *slot = find_node_slot(op, left, right, value);
+  if (*slot == 0) {
+    if (num_nodes == nodes_capacity) {
+      nodes = grow_array(nodes, &nodes_capacity, sizeof(Node));
+    }
+
+    Node *n = &nodes[num_nodes];
+    memset(n, 0, sizeof(Node));
+    n->op    = op;
+    n->left  = left;
+    n->right = right;
+    n->value = value;
+    n->saved = NO_SAVED;
+    n->slot  = slot - node_slots;
+    *slot    = ++num_nodes;
+  }
+  return *slot - 1;
+}
+
+static int is_number(uint32_t id) {
+  return nodes[id].op == IR_NUMBER;
+}
+
+static int64_t apply(int op, int64_t a, int64_t b) {
+  return op == IR_ADD ? (int64_t)((uint64_t)a + (uint64_t)b)
+                      : (int64_t)((uint64_t)a * (uint64_t)b);
+}
+
+// The node for left op right, simplified
+static uint32_t combine(int op, uint32_t left, uint32_t right) {
+  if (is_number(left) && is_number(right)) {
+    return node(IR_NUMBER, 0, 0,
+                apply(op, nodes[left].value, nodes[right].value));
+  }
+
+  if (is_number(left) || (!is_number(right) && left > right)) {
+    uint32_t swap = left;
+    left  = right;
+    right = swap;
+  }
+
+  if (is_number(right)) {
+    int64_t number = nodes[right].value;
+    if (number == (op == IR_ADD ? 0 : 1)) {
+      return left;
+    }
+    if (op == IR_MUL && number == 0) {
+      return right;
+    }
+
+    Node *inner = &nodes[left];
+    if (inner->op == op && is_number(inner->right)) {
+      uint32_t operand = inner->left;
+      int64_t  folded  = apply(op, nodes[inner->right].value, number);
+      return combine(op, operand, node(IR_NUMBER, 0, 0, folded));
+    }
+  }
+
+  return node(op, left, right, 0);
+}
+
+static void clear_nodes(void) {
+  for (size_t id = 0; id < num_nodes; ++id) {
+    node_slots[nodes[id].slot] = 0;
+  }
+  num_nodes = 0;
+}
+
+// Work lists of the statement's emission, grown as needed
+static uint32_t *pending          = NULL;
+static size_t    pending_capacity = 0;
+
+static void push_pending(size_t *count, uint32_t entry) {
+  if (*count == pending_capacity) {
+    pending = grow_array(pending, &pending_capacity, sizeof(uint32_t));
+  }
+  pending[(*count)++] = entry;
+}
+
+static Ir *emit_to(Ir_Code *out, size_t *capacity, int op, uint32_t dest,
+                   uint32_t left, uint32_t right, int64_t value) {
+  if (out->count == *capacity) {
+    out->code = grow_array(out->code, capacity, sizeof(Ir));
+  }
+
+  Ir *in = &out->code[out->count++];
+  in->op    = op;
+  in->dest  = dest;
+  in->left  = left;
+  in->right = right;
+  in->value = value;
+  if (dest + 1 > out->registers) {
+    out->registers = dest + 1;
+  }
+  return in;
+}
+
+/*
+ * Emits the code of the DAG under `root`, on registers from the number of
+ * saved ones up, in the order the parser would: left operand, right operand,
+ * operation. Walks it with a work list rather than recursing, the low bit of
+ * an entry telling an operation to emit from one to expand.
+ */
+static void emit_statement(Ir_Code *out, size_t *capacity, uint32_t root) {
+  size_t   count = 0;
+  uint32_t saved = 0;
+
+  // Counts the uses of each node, saving a register for operations used twice
+  nodes[root].uses = 1;
+  push_pending(&count, root);
+  while (count > 0) {
+    Node *n = &nodes[pending[--count]];
+    if (n->op != IR_ADD && n->op != IR_MUL) {
+      continue;
+    }
+
+    uint32_t operands[2] = {n->left, n->right};
+    for (int i = 0; i < 2; ++i) {
+      Node *operand = &nodes[operands[i]];
+      if (++operand->uses == 1) {
+        push_pending(&count, operands[i]);
+      } else if (operand->uses == 2 &&
+                 (operand->op == IR_ADD || operand->op == IR_MUL)) {
+        ++saved;
+      }
+    }
+  }
+
+  uint32_t base  = saved;    // The bottom of the stack
+  uint32_t depth = 0;
+  saved = 0;
+
+  push_pending(&count, root << 1);
+  while (count > 0) {
+    uint32_t entry = pending[--count];
+    Node    *n     = &nodes[entry >> 1];
+
+    if (n->op == IR_NUMBER || n->op == IR_VARIABLE) {
+      emit_to(out, capacity, n->op, base + depth++, 0, 0, n->value);
+    } else if (n->saved != NO_SAVED) {
+      emit_to(out, capacity, IR_RESTORE, base + depth++, n->saved, 0, 0);
+    } else if (!(entry & 1)) {
+      push_pending(&count, entry | 1);
+      push_pending(&count, n->right << 1);
+      push_pending(&count, n->left << 1);
+    } else {
+      --depth;
+      uint32_t dest = base + depth - 1;
+      emit_to(out, capacity, n->op, dest, dest, base + depth, 0);
+      if (n->uses > 1) {
+        n->saved = saved++;
+        emit_to(out, capacity, IR_SAVE, n->saved, dest, 0, 0);
+      }
+    }
+  }
+
+  emit_to(out, capacity, IR_RESULT, 0, base, 0, 0);
+  ++out->statements;
+}
+
+Ir_Code optimize_ir(const Ir_Code *code) {
+  Ir_Code   out      = {0};
+  size_t    capacity = 0;
+  uint32_t *values   = malloc(sizeof(uint32_t) * (code->registers + 1));
+  if (!values) {
+    fprintf(stderr, "Could not allocate the optimizer\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // values[t] is the node whose value register t holds
+  for (size_t i = 0; i < code->count; ++i) {
+    const Ir *in = &code->code[i];
+    switch (in->op) {
+      case IR_NUMBER:
+      case IR_VARIABLE:
+        values[in->dest] = node(in->op, 0, 0, in->value);
+        break;
+      case IR_ADD:
+      case IR_MUL:
+        values[in->dest] = combine(in->op, values[in->left], values[in->right]);
+        break;
+      case IR_SAVE:
+      case IR_RESTORE:
+        values[in->dest] = values[in->left];
+        break;
+      case IR_RESULT:
+        emit_statement(&out, &capacity, values[in->left]);
+        clear_nodes();
+        break;
+    }
+  }
+
+  free(values);
+  return out;
+}
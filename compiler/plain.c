@@ -22,7 +22,7 @@ void statements(void) {
   if (match(SEMI)) {
     advance();
   } else {
-    fprintf(stderr, "%d: Inserting missing semicolon\n", yylineno);
+    fprintf(stderr, "%d: Inserting missing semicolon\n", lex_lineno());
   }
 
   if (!match(EOI)) {
@@ -83,9 +83,9 @@ void factor(void) {
     if (match(RP)) {
       advance();
     } else {
-      fprintf(stderr, "%d: Mismatched parantheses\n", yylineno);
+      fprintf(stderr, "%d: Mismatched parantheses\n", lex_lineno());
     }
   } else {
-    fprintf(stderr, "%d: Number or identifier expected\n", yylineno);
+    fprintf(stderr, "%d: Number or identifier expected\n", lex_lineno());
   }
 }
@@ -0,0 +1,211 @@
+#include "iterative.c"
+#include "optimize.c"
+#include "bench_gen.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Stress tests of iterative.c's statements(): millions of statements, and
+ * single statements nesting parentheses hundreds of thousands deep, each
+ * way the grammar nests
+ * - parens: ((((x))))
+ * - left:   ((((x) + 1) * 1) + 1)
+ * - right:  x + (1 * (x + (1 * (x))))
+ * at doubling depths, so the time per token shows the parse is linear. Each
+ * case is parsed in a child process whose native stack is limited to
+ * STACK_KB, far too little for a parser recursing once per level, and its
+ * results are run, optimized and run again, and checked against what they
+ * must be. Reports the time and the child's peak memory, and exits with
+ * failure if any case fails.
+ *
+ * BUILD: cc -O2 -pthread -o stress_parse stress_parse.c
+ * USAGE: ./stress_parse [threads, 0 to lex a token at a time] [max depth]
+ */
+
+#define STRESS_PATH "/tmp/compiler_stress.txt"
+#define STATEMENTS  4000000
+#define MIN_DEPTH   125000
+#define DEPTH_LIMIT 1000000
+#define STACK_KB    256
+#define X           5         // The value of x
+
+typedef enum { PARENS, LEFT, RIGHT, STATEMENT_LIST } Shape;
+
+static const char *shapes[] = {"parens", "left", "right", "statements"};
+
+static FILE *create(const char *path) {
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "Could not create %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  return fp;
+}
+
+static void repeat(FILE *fp, const char *text, size_t times) {
+  for (size_t i = 0; i < times; ++i) {
+    fputs(text, fp);
+  }
+}
+
+/*
+ * Writes the case into `path` and returns the value each of its statements
+ * must have. The right shape adds x to every other level.
+ */
+int64_t generate_case(const char *path, Shape shape, size_t n) {
+  FILE   *fp       = create(path);
+  int64_t expected = X;
+
+  switch (shape) {
+    case PARENS:
+      repeat(fp, "(", n);
+      fputs("x", fp);
+      repeat(fp, ")", n);
+      fputs(";\n", fp);
+      break;
+    case LEFT:
+      repeat(fp, "(", n);
+      fputs("x", fp);
+      for (size_t i = 0; i < n; ++i) {
+        fputs(i % 2 ? ") * 1" : ") + 1", fp);
+      }
+      fputs(";\n", fp);
+      expected += (n + 1) / 2;
+      break;
+    case RIGHT:
+      for (size_t i = 0; i < n; ++i) {
+        fputs(i % 2 ? "1 * (" : "x + (", fp);
+      }
+      fputs("x", fp);
+      repeat(fp, ")", n);
+      fputs(";\n", fp);
+      expected += (int64_t)X * ((n + 1) / 2);
+      break;
+    case STATEMENT_LIST:
+      repeat(fp, "x * 2 + (1 + x);\n", n);
+      expected = 3 * X + 1;
+      break;
+  }
+  fclose(fp);
+  return expected;
+}
+
+// Checks that all `statements` results of `code` are `expected`
+int check(const char *what, const Ir_Code *code, const int64_t *variables,
+          size_t statements, int64_t expected) {
+  if (code->statements != statements) {
+    printf("  %s: %zu statements, expected %zu\n", what, code->statements,
+           statements);
+    return 0;
+  }
+
+  Bytecode bc      = ir_to_bytecode(code);
+  int64_t *results = malloc(sizeof(int64_t) * (statements + 1));
+  if (!results) {
+    fprintf(stderr, "Could not allocate the results\n");
+    exit(EXIT_FAILURE);
+  }
+
+  run_bytecode(&bc, variables, results);
+  size_t wrong = 0;
+  for (size_t i = 0; i < statements; ++i) {
+    wrong += results[i] != expected;
+  }
+  if (wrong > 0) {
+    printf("  %s: %zu results differ from %lld\n", what, wrong,
+           (long long)expected);
+  }
+  free(results);
+  bytecode_free(&bc);
+  return wrong == 0;
+}
+
+// Parses `path` in a child with a small stack, printing a line for the case
+int run(const char *path, Shape shape, size_t n, int64_t expected,
+        size_t bytes, int threads) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "Could not fork\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pid > 0) {
+    int status;
+    waitpid(pid, &status, 0);
+    if (WIFSIGNALED(status)) {
+      printf("%-10s %9zu  killed by signal %d\n", shapes[shape], n,
+             WTERMSIG(status));
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+  }
+
+  struct rlimit stack = {STACK_KB << 10, STACK_KB << 10};
+  if (setrlimit(RLIMIT_STACK, &stack) != 0) {
+    fprintf(stderr, "Could not limit the stack\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!freopen(path, "rb", stdin)) {
+    fprintf(stderr, "Could not open %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  double start = now();
+  if (threads > 0) {
+    lex_tokens(threads);
+  }
+  statements();
+  double elapsed = now() - start;
+
+  int64_t *variables = calloc(code_variables() + 1, sizeof(int64_t));
+  if (!variables) {
+    fprintf(stderr, "Could not allocate the variables\n");
+    exit(EXIT_FAILURE);
+  }
+  long x = code_variable_id("x", 1);
+  if (x >= 0) {
+    variables[x] = X;
+  }
+
+  size_t  statements = shape == STATEMENT_LIST ? n : 1;
+  Ir_Code optimized  = optimize_ir(&ir);
+  int     ok         = check("parsed", &ir, variables, statements, expected) &&
+                       check("optimized", &optimized, variables, statements,
+                             expected);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("%-10s %9zu %10.3f %12.1f %10ld  %s\n", shapes[shape], n, elapsed,
+         elapsed * 1e9 / bytes, usage.ru_maxrss >> 10, ok ? "ok" : "FAILED");
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  int    threads   = argc > 1 ? atoi(argv[1]) : 0;
+  size_t max_depth = argc > 2 ? (size_t)atol(argv[2]) : DEPTH_LIMIT;
+  int    failed    = 0;
+
+  printf("%-10s %9s %10s %12s %10s\n", "case", "n", "parse s", "ns/byte",
+         "peak MB");
+  for (Shape shape = PARENS; shape <= STATEMENT_LIST; ++shape) {
+    size_t first = shape == STATEMENT_LIST ? STATEMENTS : MIN_DEPTH;
+    size_t last  = shape == STATEMENT_LIST ? STATEMENTS : max_depth;
+    for (size_t n = first; n <= last; n *= 2) {
+      int64_t expected = generate_case(STRESS_PATH, shape, n);
+
+      FILE *fp = fopen(STRESS_PATH, "rb");
+      fseek(fp, 0, SEEK_END);
+      size_t bytes = ftell(fp);
+      fclose(fp);
+
+      failed += !run(STRESS_PATH, shape, n, expected, bytes, threads);
+    }
+  }
+
+  remove(STRESS_PATH);
+  printf("%s\n", failed ? "FAILED" : "all passed");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+#include "bench_sheet.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "column.h"
+#include "expr.h"
+#include "scan.h"
+#include "table.h"
+
+/*
+ * Column aggregates on a generated sheet of numeric and text columns, one in
+ * ten cells of column D being text. SUM, MIN, MAX and AVG of a column, run
+ * - cells:  down the rows of the Table, checking each Cell's type
+ * - scalar, sse2, avx2: column_reduce_at() on the columns of the same table
+ * Also reports the conversions between the two layouts, and a row of
+ * SUM/MIN/MAX/AVG formulas over whole columns evaluated by program_run().
+ *
+ * USAGE: ./build/bench_columns [rows in thousands]
+ */
+
+#define DEFAULT_ROWS 2000
+#define RUNS 5
+
+char *generate_columns(size_t rows, size_t *size) {
+  static const char *words[] = {"alpha", "beta", "gamma", "delta", "north"};
+  size_t capacity = rows * 64 + 4096;
+  char *sheet = malloc(capacity);
+  if (!sheet) {
+    fprintf(stderr, "ERROR: Could not allocate the sheet\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Row 1 holds the formulas, the numbers start in row 2
+  size_t at = sprintf(sheet, "id|price|name|qty|note|F|G|H|I\n");
+  at += sprintf(sheet + at,
+                "0|0|formulas|0|-|=SUM(B2:B%zu)|=MIN(B2:B%zu)|=MAX(D2:D%zu)"
+                "|=AVG(D2:D%zu)\n",
+                rows + 1, rows + 1, rows + 1, rows + 1);
+  unsigned seed = 1;
+  for (size_t row = 2; row < rows + 2; ++row) {
+    seed = seed * 1103515245 + 12345;
+    if (row % 10 == 0) {
+      at += sprintf(sheet + at, "%zu|%u.%02u|%s|n/a|%s\n", row, seed % 10000,
+                    seed % 100, words[seed % 5], words[(seed >> 8) % 5]);
+    } else {
+      at += sprintf(sheet + at, "%zu|%u.%02u|%s|%u|%s\n", row, seed % 10000,
+                    seed % 100, words[seed % 5], (seed >> 8) % 500,
+                    words[(seed >> 8) % 5]);
+    }
+  }
+
+  *size = at;
+  return sheet;
+}
+
+// The aggregate of rows first..last-1 of column `col`, row by row
+double reduce_cells(const Table *table, size_t col, Aggregate aggregate,
+                    size_t first, size_t last) {
+  double result = aggregate == AGGREGATE_MIN   ? INFINITY
+                  : aggregate == AGGREGATE_MAX ? -INFINITY
+                                               : 0;
+  size_t count = 0;
+  for (size_t row = first; row < last; ++row) {
+    const Cell *cell = &table->cells[row * table->cols + col];
+    double number;
+    if (cell->type == CELL_TYPE_NUMBER) {
+      number = cell->value.number;
+    } else if (cell->type == CELL_TYPE_EXPR) {
+      number = cell->value.formula.value;
+    } else {
+      continue;
+    }
+
+    count += 1;
+    switch (aggregate) {
+    case AGGREGATE_MIN:
+      result = number < result ? number : result;
+      break;
+    case AGGREGATE_MAX:
+      result = number > result ? number : result;
+      break;
+    default:
+      result += number;
+      break;
+    }
+  }
+  return aggregate == AGGREGATE_AVG ? (count ? result / count : 0) : result;
+}
+
+int main(int argc, char **argv) {
+  size_t rows = (size_t)(argc > 1 ? atol(argv[1]) : DEFAULT_ROWS) * 1000;
+
+  size_t size = 0;
+  char *sheet = generate_columns(rows, &size);
+  Table table = {0};
+  parse_table(&table, sv_gen(sheet, size));
+  printf("%zu rows, %.1f MB of sheet\n", rows, size / (1024.0 * 1024.0));
+
+  double start = now();
+  Column_Table columns = columns_from_table(&table);
+  printf("to columns %8.2f ms\n", (now() - start) * 1e3);
+  start = now();
+  Table back = columns_to_table(&columns);
+  printf("to cells   %8.2f ms\n", (now() - start) * 1e3);
+  table_free(&back);
+
+  static const char *aggregates[] = {"SUM", "MIN", "MAX", "AVG"};
+  static const size_t cols[] = {1, 1, 3, 3};  // B, B, D, D
+  double row_major[4] = {0};  // best time of the cells layout, per aggregate
+
+  printf("%-4s %-7s %10s %12s %18s\n", "agg", "layout", "ms", "Mrows/s",
+         "result");
+  for (Aggregate aggregate = AGGREGATE_SUM; aggregate <= AGGREGATE_AVG;
+       ++aggregate) {
+    const Column *column = &columns.columns[cols[aggregate]];
+    for (int layout = -1; layout <= (int)SCAN_AVX2; ++layout) {
+      if (layout > (int)scan_best_level()) {
+        continue;
+      }
+
+      double best = 0;
+      double result = 0;
+      for (int run = 0; run < RUNS; ++run) {
+        start = now();
+        result = layout < 0 ? reduce_cells(&table, cols[aggregate], aggregate,
+                                           2, table.rows)
+                            : column_reduce_at((Scan_Level)layout, column,
+                                               aggregate, 2, table.rows);
+        double elapsed = now() - start;
+        best = run == 0 || elapsed < best ? elapsed : best;
+      }
+      if (layout < 0) {
+        row_major[aggregate] = best;
+      }
+      printf("%-4s %-7s %10.3f %12.1f %18.6f", aggregates[aggregate],
+             layout < 0 ? "cells" : scan_level_name((Scan_Level)layout),
+             best * 1e3, rows / best / 1e6, result);
+      if (layout >= 0) {
+        printf("  %5.1fx", row_major[aggregate] / best);
+      }
+      printf("\n");
+    }
+  }
+
+  Program program = table_compile(&table);
+  double best = 0;
+  for (int run = 0; run < RUNS; ++run) {
+    start = now();
+    program_run(&program, &table);
+    double elapsed = now() - start;
+    best = run == 0 || elapsed < best ? elapsed : best;
+  }
+  printf("formulas %8.3f ms for the 4 aggregates, cells layout %8.3f ms\n",
+         best * 1e3,
+         (row_major[0] + row_major[1] + row_major[2] + row_major[3]) * 1e3);
+
+  program_free(&program);
+  columns_free(&columns);
+  table_free(&table);
+  free(sheet);
+  return 0;
+}
@@ -0,0 +1,162 @@
+#include "bench_sheet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "expr.h"
+#include "table.h"
+
+/*
+ * Formula evaluation on a generated sheet of a million formulas: a row of
+ * numbers, then rows of formulas each reading three cells of the row above.
+ * Reports the time to parse the sheet and compile it, and the time to
+ * recompute it
+ * - bytecode: program_run() over the compiled program
+ * - tree:     walking each formula's Expr tree, in row order
+ *
+ * USAGE: ./build/bench_eval [formulas in thousands]
+ */
+
+#define COLS 100
+#define DEFAULT_FORMULAS 1000
+#define RUNS 5
+
+void col_name(char *name, size_t col) {
+  char letters[8];
+  size_t count = 0;
+  for (col += 1; col > 0; col = (col - 1) / 26) {
+    letters[count++] = 'A' + (col - 1) % 26;
+  }
+  while (count > 0) {
+    *name++ = letters[--count];
+  }
+  *name = '\0';
+}
+
+char *generate_formulas(size_t rows, size_t *size) {
+  size_t capacity = rows * COLS * 40 + 4096;
+  char *sheet = malloc(capacity);
+  if (!sheet) {
+    fprintf(stderr, "ERROR: Could not allocate the sheet\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t at = 0;
+  for (size_t col = 0; col < COLS; ++col) {
+    char name[8];
+    col_name(name, col);
+    at += sprintf(sheet + at, "%s%s", col ? "|" : "", name);
+  }
+  sheet[at++] = '\n';
+  for (size_t col = 0; col < COLS; ++col) {
+    at += sprintf(sheet + at, "%s%zu", col ? "|" : "", col + 1);
+  }
+  sheet[at++] = '\n';
+
+  for (size_t row = 2; row < rows + 2; ++row) {
+    for (size_t col = 0; col < COLS; ++col) {
+      char a[8], b[8], c[8];
+      col_name(a, col);
+      col_name(b, (col + 1) % COLS);
+      col_name(c, (col + COLS - 1) % COLS);
+      // Weights adding up to at most 1, so values stay finite down the rows
+      const char *fmt = col % 2 ? "%s=%s%zu*0.5+(%s%zu-%s%zu)*0.25"
+                                : "%s=(%s%zu+%s%zu+%s%zu)/3";
+      at += sprintf(sheet + at, fmt, col ? "|" : "", a, row - 1, b, row - 1,
+                    c, row - 1);
+    }
+    sheet[at++] = '\n';
+  }
+
+  *size = at;
+  return sheet;
+}
+
+double eval_tree(const Table *table, const Expr *expr) {
+  switch (expr->type) {
+  case EXPR_TYPE_NUMBER:
+    return expr->value.number;
+  case EXPR_TYPE_CELL: {
+    const Cell *cell =
+        &table->cells[expr->value.cell.row * table->cols + expr->value.cell.col];
+    return cell->type == CELL_TYPE_EXPR ? cell->value.formula.value
+                                        : cell->value.number;
+  }
+  case EXPR_TYPE_NEG:
+    return -eval_tree(table, expr->value.operand);
+  case EXPR_TYPE_PLUS:
+    return eval_tree(table, expr->value.plus.lhs) +
+           eval_tree(table, expr->value.plus.rhs);
+  case EXPR_TYPE_MINUS:
+    return eval_tree(table, expr->value.plus.lhs) -
+           eval_tree(table, expr->value.plus.rhs);
+  case EXPR_TYPE_MULT:
+    return eval_tree(table, expr->value.plus.lhs) *
+           eval_tree(table, expr->value.plus.rhs);
+  default:
+    return eval_tree(table, expr->value.plus.lhs) /
+           eval_tree(table, expr->value.plus.rhs);
+  }
+}
+
+// The formulas only read the row above, so row order is a valid order
+void run_tree(Table *table) {
+  for (size_t i = 0; i < table->rows * table->cols; ++i) {
+    Cell *cell = &table->cells[i];
+    if (cell->type == CELL_TYPE_EXPR) {
+      cell->value.formula.value = eval_tree(table, cell->value.formula.ast);
+    }
+  }
+}
+
+double checksum(const Table *table) {
+  double sum = 0;
+  for (size_t i = 0; i < table->rows * table->cols; ++i) {
+    if (table->cells[i].type == CELL_TYPE_EXPR) {
+      sum += table->cells[i].value.formula.value;
+    }
+  }
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  size_t formulas = (size_t)(argc > 1 ? atol(argv[1]) : DEFAULT_FORMULAS) * 1000;
+  size_t rows = (formulas + COLS - 1) / COLS;
+
+  size_t size = 0;
+  char *sheet = generate_formulas(rows, &size);
+
+  double start = now();
+  Table table = {0};
+  parse_table(&table, sv_gen(sheet, size));
+  double parsed = now();
+  Program program = table_compile(&table);
+  double compiled = now();
+
+  printf("%zu formulas, %.1f MB of sheet\n", program.formulas,
+         size / (1024.0 * 1024.0));
+  printf("parse   %8.3f s\n", parsed - start);
+  printf("compile %8.3f s, %zu instructions\n", compiled - parsed,
+         program.count);
+
+  printf("%-9s %10s %14s %18s\n", "eval", "seconds", "ns/formula", "checksum");
+  for (int tree = 0; tree < 2; ++tree) {
+    double best = 0;
+    for (int run = 0; run < RUNS; ++run) {
+      start = now();
+      if (tree) {
+        run_tree(&table);
+      } else {
+        program_run(&program, &table);
+      }
+      double elapsed = now() - start;
+      best = run == 0 || elapsed < best ? elapsed : best;
+    }
+    printf("%-9s %10.4f %14.2f %18.6g\n", tree ? "tree" : "bytecode", best,
+           best * 1e9 / program.formulas, checksum(&table));
+  }
+
+  program_free(&program);
+  table_free(&table);
+  free(sheet);
+  return 0;
+}
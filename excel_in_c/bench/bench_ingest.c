@@ -0,0 +1,195 @@
+#include "bench_sheet.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_map.h"
+#include "split_view.h"
+#include "table.h"
+
+/*
+ * Ingest throughput: how fast a sheet goes from a file on disk to a parsed
+ * Table, through
+ * - read:  read_file() into a malloc'd copy, find_table_size(), then
+ *          parse_table() into the pre-sized table (the loader as it was)
+ * - mmap:  map_file() and the single-pass parse_table() growing the table
+ *
+ * USAGE: ./build/bench_ingest [file] [size in MB]
+ * The file (by default /tmp/excel_bench.csv, 1024 MB) is generated first if
+ * it doesn't exist with that size. It holds numbers and text only, formulas
+ * aren't parsed yet. Both loaders run after the generator wrote the file, so
+ * it is in the page cache for both.
+ */
+
+#define RUNS 2
+
+// ---------------------------------------------------------------------------
+// The loader as it was: a copy of the file and two passes over it
+// ---------------------------------------------------------------------------
+
+char *read_file(const char *file_path, size_t *size) {
+  FILE *fp = fopen(file_path, "rb");
+  char *buf = NULL;
+
+  if (!fp) {
+    goto error;
+  }
+
+  if (fseek(fp, 0L, SEEK_END) < 0) {
+    goto error;
+  }
+
+  long fsize = ftell(fp);
+  if (fsize < 0) {
+    goto error;
+  }
+
+  buf = (char *)malloc(sizeof(char) * fsize);
+
+  if (!buf) {
+    goto error;
+  }
+
+  if (fseek(fp, 0, SEEK_SET) < 0) {
+    goto error;
+  }
+
+  size_t bytes_read = fread(buf, 1, fsize, fp);
+  assert(bytes_read == (size_t)fsize);
+
+  if (ferror(fp)) {
+    goto error;
+  }
+
+  if (size) {
+    *size = bytes_read;
+  }
+
+  fclose(fp);
+
+  return buf;
+
+error:
+  if (fp) {
+    fclose(fp);
+  }
+
+  if (buf) {
+    free(buf);
+    buf = NULL;
+  }
+
+  return NULL;
+}
+
+void find_table_size(StringView content, size_t *max_rows, size_t *max_cols) {
+  size_t rows = 0;
+  size_t cols = 0;
+  for (; content.count > 0; ++rows) {
+    StringView line = sv_split_by_delim(&content, '\n');
+    size_t col = 0;
+    for (; line.count > 0; ++col) {
+      sv_trim(sv_split_by_delim(&line, '|'));
+    }
+
+    cols = col > cols ? col : cols;
+  }
+
+  if (max_rows) {
+    *max_rows = rows;
+  }
+  if (max_cols) {
+    *max_cols = cols;
+  }
+}
+
+void parse_table_presized(Table *table, StringView content) {
+  for (size_t row = 0; content.count > 0; ++row) {
+    StringView line = sv_split_by_delim(&content, '\n');
+    for (size_t col = 0; line.count > 0; ++col) {
+
+      StringView val = sv_trim(sv_split_by_delim(&line, '|'));
+      Cell* curr_cell = table_cell_at(table, row, col);
+      Cell_Value value;
+
+      static char tmp_buffer[1024 * 2];
+      snprintf(tmp_buffer, sizeof(tmp_buffer), SV_Fmt, SV_Arg(val));
+
+      char *endptr;
+      value.number = strtod(tmp_buffer, &endptr);
+
+      if (endptr != tmp_buffer && *endptr == '\0') {
+        curr_cell->type = CELL_TYPE_NUMBER;
+      } else {
+        curr_cell->type = CELL_TYPE_TEXT;
+        value.text = val;
+      }
+      curr_cell->value = value;
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+double ingest_read(const char *path, size_t *cells) {
+  double start = now();
+  size_t size = 0;
+  char *data = read_file(path, &size);
+  if (!data) {
+    fprintf(stderr, "ERROR: Could not read %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  size_t rows = 0;
+  size_t cols = 0;
+  StringView content = sv_gen(data, size);
+  find_table_size(content, &rows, &cols);
+  Table table = table_alloc(rows, cols);
+  parse_table_presized(&table, content);
+  double elapsed = now() - start;
+
+  *cells = table.rows * table.cols;
+  table_free(&table);
+  free(data);
+  return elapsed;
+}
+
+double ingest_mmap(const char *path, size_t *cells) {
+  double start = now();
+  Mapped_File file = {0};
+  if (!map_file(path, &file)) {
+    fprintf(stderr, "ERROR: Could not map %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  Table table = {0};
+  parse_table(&table, file.content);
+  double elapsed = now() - start;
+
+  *cells = table.rows * table.cols;
+  table_free(&table);
+  unmap_file(&file);
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : DEFAULT_PATH;
+  size_t size = (size_t)(argc > 2 ? atol(argv[2]) : DEFAULT_SIZE_MB) << 20;
+
+  double mb = prepare_sheet(path, size);
+
+  printf("%-8s %12s %10s %10s\n", "loader", "cells", "seconds", "MB/s");
+  const char *names[] = {"read", "mmap"};
+  double (*loaders[])(const char *, size_t *) = {ingest_read, ingest_mmap};
+  for (size_t i = 0; i < 2; ++i) {
+    double best = 0;
+    size_t cells = 0;
+    for (int run = 0; run < RUNS; ++run) {
+      double elapsed = loaders[i](path, &cells);
+      best = run == 0 || elapsed < best ? elapsed : best;
+    }
+    printf("%-8s %12zu %10.2f %10.1f\n", names[i], cells, best, mb / best);
+  }
+
+  return 0;
+}
@@ -0,0 +1,113 @@
+#include "bench_sheet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "file_map.h"
+#include "table.h"
+
+/*
+ * Parse time and memory of a table on a generated sheet where text repeats a
+ * lot (regions, statuses, products and notes from short lists) with a
+ * formula per row, with text cells
+ * - views:    pointing into the file, which has to stay in memory
+ * - interned: copied once per distinct text into the table's arena
+ * Memory is what the process took on parsing, with the pages of the file it
+ * read, and for the interned table also without them.
+ *
+ * USAGE: ./build/bench_intern [file] [size in MB]
+ */
+
+#define INTERN_PATH "/tmp/excel_text.csv"
+#define INTERN_SIZE_MB 256
+
+void generate_text(const char *path, size_t size) {
+  static const char *regions[] = {"north", "south", "east", "west", "central"};
+  static const char *statuses[] = {"pending", "shipped", "delivered",
+                                   "returned"};
+  static const char *products[] = {"widget", "gadget", "gizmo", "doohickey",
+                                   "thingamajig", "whatsit", "contraption"};
+  static const char *notes[] = {"priority customer", "call before delivery",
+                                "leave at the door", "fragile, handle with care",
+                                "gift wrap"};
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "ERROR: Could not create %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(fp, "id|region|status|product|price|qty|total|note\n");
+  size_t written = 0;
+  unsigned seed = 1;
+  for (size_t row = 1; written < size; ++row) {
+    seed = seed * 1103515245 + 12345;
+    int n = fprintf(fp, "%zu|%s|%s|%s|%u.%02u|%u|=E%zu*F%zu|%s\n", row,
+                    regions[seed % 5], statuses[(seed >> 4) % 4],
+                    products[(seed >> 8) % 7], (seed >> 12) % 1000, seed % 100,
+                    (seed >> 16) % 50, row, row, notes[(seed >> 20) % 5]);
+    written += n;
+  }
+  fclose(fp);
+}
+
+double resident_mb(void) {
+  FILE *fp = fopen("/proc/self/statm", "r");
+  long pages = 0;
+  long resident = 0;
+  if (!fp || fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+    fprintf(stderr, "ERROR: Could not read /proc/self/statm\n");
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+  return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : INTERN_PATH;
+  size_t size = (size_t)(argc > 2 ? atol(argv[2]) : INTERN_SIZE_MB) << 20;
+
+  struct stat st;
+  if (stat(path, &st) < 0 || (size_t)st.st_size < size ||
+      (size_t)st.st_size > size + 4096) {
+    printf("Generating %zu MB into %s...\n", size >> 20, path);
+    generate_text(path, size);
+    stat(path, &st);
+  }
+  double mb = st.st_size / (1024.0 * 1024.0);
+
+  printf("%-9s %10s %14s %14s\n", "text", "parse s", "with file MB",
+         "table MB");
+  const char *modes[] = {"views", "interned"};
+  for (int interned = 0; interned < 2; ++interned) {
+    Mapped_File file = {0};
+    if (!map_file(path, &file)) {
+      fprintf(stderr, "ERROR: Could not map %s\n", path);
+      exit(EXIT_FAILURE);
+    }
+
+    double before = resident_mb();
+    double start = now();
+    Table table = {0};
+    table.text_in_content = !interned;
+    parse_table(&table, file.content);
+    double parsed = now() - start;
+    double with_file = resident_mb() - before;
+
+    // Interned, the table doesn't need the file anymore
+    printf("%-9s %10.2f %14.1f ", modes[interned], parsed, with_file);
+    if (interned) {
+      drop_file_pages(&file, file.content.data,
+                      file.content.data + file.content.count);
+      printf("%14.1f\n", resident_mb() - before);
+    } else {
+      printf("%14s\n", "-");
+    }
+
+    start = now();
+    table_free(&table);
+    printf("%-9s %10.3f s to free\n", "", now() - start);
+    unmap_file(&file);
+  }
+  printf("%.1f MB of sheet\n", mb);
+  return 0;
+}
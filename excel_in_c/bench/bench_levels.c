@@ -0,0 +1,148 @@
+#include "bench_sheet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "expr.h"
+#include "table.h"
+#include "thread_pool.h"
+
+/*
+ * Parallel evaluation by levels: program_run_parallel() with pools of 1 to N
+ * threads against program_run(), on two sheets of about a million formulas
+ * - wide:  1000 columns, every formula reads three cells of the number row,
+ *          so the whole sheet is one level
+ * - deep:  10 columns, every formula reads three cells of the row above, so
+ *          there are as many levels as rows, of 10 formulas each
+ * Every result is compared bit for bit with the serial one.
+ *
+ * USAGE: ./build/bench_levels [max threads]
+ */
+
+#define FORMULAS 1000000
+#define RUNS 3
+
+void col_name(char *name, size_t col) {
+  char letters[8];
+  size_t count = 0;
+  for (col += 1; col > 0; col = (col - 1) / 26) {
+    letters[count++] = 'A' + (col - 1) % 26;
+  }
+  while (count > 0) {
+    *name++ = letters[--count];
+  }
+  *name = '\0';
+}
+
+// `deep` reads the row above, otherwise row 1
+char *generate_levels(size_t cols, bool deep, size_t *size) {
+  size_t rows = FORMULAS / cols;
+  char *sheet = malloc(rows * cols * 32 + cols * 16 + 64);
+  if (!sheet) {
+    fprintf(stderr, "ERROR: Could not allocate the sheet\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t at = 0;
+  for (size_t col = 0; col < cols; ++col) {
+    char name[8];
+    col_name(name, col);
+    at += sprintf(sheet + at, "%s%s", col ? "|" : "", name);
+  }
+  sheet[at++] = '\n';
+  for (size_t col = 0; col < cols; ++col) {
+    at += sprintf(sheet + at, "%s%zu", col ? "|" : "", col % 13 + 1);
+  }
+  sheet[at++] = '\n';
+
+  for (size_t row = 2; row < rows + 2; ++row) {
+    size_t read = deep ? row - 1 : 1;
+    for (size_t col = 0; col < cols; ++col) {
+      char a[8], b[8], c[8];
+      col_name(a, col);
+      col_name(b, (col + 1) % cols);
+      col_name(c, (col + cols - 1) % cols);
+      at += sprintf(sheet + at, "%s=(%s%zu+%s%zu*%zu+%s%zu)/%zu",
+                    col ? "|" : "", a, read, b, read, row % 3 + 1, c, read,
+                    row % 3 + 3);
+    }
+    sheet[at++] = '\n';
+  }
+
+  *size = at;
+  return sheet;
+}
+
+double *formula_values(const Table *table) {
+  size_t cells = table->rows * table->cols;
+  double *values = malloc(sizeof(double) * cells);
+  for (size_t i = 0; i < cells; ++i) {
+    values[i] = table->cells[i].type == CELL_TYPE_EXPR
+                    ? table->cells[i].value.formula.value
+                    : 0;
+  }
+  return values;
+}
+
+void clear_formulas(Table *table) {
+  for (size_t i = 0; i < table->rows * table->cols; ++i) {
+    if (table->cells[i].type == CELL_TYPE_EXPR) {
+      table->cells[i].value.formula.value = 0;
+    }
+  }
+}
+
+void bench_sheet(const char *name, size_t cols, bool deep, size_t max_threads) {
+  size_t size = 0;
+  char *sheet = generate_levels(cols, deep, &size);
+  Table table = {0};
+  parse_table(&table, sv_gen(sheet, size));
+  Program program = table_compile(&table);
+
+  double serial = 0;
+  for (int run = 0; run < RUNS; ++run) {
+    double start = now();
+    program_run(&program, &table);
+    double elapsed = now() - start;
+    serial = run == 0 || elapsed < serial ? elapsed : serial;
+  }
+  double *expected = formula_values(&table);
+
+  printf("%s: %zu formulas in %zu levels\n", name, program.formulas,
+         program.levels);
+  printf("  %-8s %10.2f ms\n", "serial", serial * 1e3);
+
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    Thread_Pool *pool = thread_pool_create(threads);
+    double best = 0;
+    for (int run = 0; run < RUNS; ++run) {
+      clear_formulas(&table);
+      double start = now();
+      program_run_parallel(&program, &table, pool);
+      double elapsed = now() - start;
+      best = run == 0 || elapsed < best ? elapsed : best;
+    }
+    thread_pool_destroy(pool);
+
+    double *values = formula_values(&table);
+    bool identical =
+        memcmp(values, expected, sizeof(double) * table.rows * table.cols) == 0;
+    printf("  %-8zu %10.2f ms %8.2fx %s\n", threads, best * 1e3, serial / best,
+           identical ? "identical" : "DIFFERENT");
+    free(values);
+  }
+
+  free(expected);
+  program_free(&program);
+  table_free(&table);
+  free(sheet);
+}
+
+int main(int argc, char **argv) {
+  size_t cpus = thread_pool_cpus();
+  size_t max_threads = argc > 1 ? (size_t)atol(argv[1]) : cpus < 4 ? 4 : cpus;
+
+  printf("%zu CPUs\n", cpus);
+  bench_sheet("wide", 1000, false, max_threads);
+  bench_sheet("deep", 10, true, max_threads);
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include "bench_sheet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "number.h"
+#include "split_view.h"
+
+/*
+ * Cell classification: telling numbers from text and reading the numbers, on
+ * generated cells that are 90% numbers (integers, prices, scores, some with
+ * exponents) or 90% words. Runs
+ * - strtod: copying each cell into a buffer with snprintf() and strtod()
+ *           on it (the parser as it was)
+ * - sv:     sv_parse_number() on the cell in place
+ * and checks both find the same numbers, bit for bit.
+ *
+ * USAGE: ./build/bench_numbers [cells in thousands]
+ */
+
+#define DEFAULT_CELLS 4000
+#define RUNS 5
+
+StringView *generate_cells(size_t count, int percent_numbers, char **sheet) {
+  static const char *words[] = {"alpha", "beta", "gamma", "delta", "north",
+                                "south", "total", "pending", "shipped"};
+  char *data = malloc(count * 32);
+  StringView *cells = malloc(sizeof(StringView) * count);
+  if (!data || !cells) {
+    fprintf(stderr, "ERROR: Could not allocate the cells\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t at = 0;
+  unsigned seed = 1;
+  for (size_t i = 0; i < count; ++i) {
+    seed = seed * 1103515245 + 12345;
+    int n;
+    if ((int)(seed % 100) >= percent_numbers) {
+      n = sprintf(data + at, "%s", words[(seed >> 8) % 9]);
+    } else {
+      switch ((seed >> 8) % 4) {
+      case 0:
+        n = sprintf(data + at, "%u", seed >> 12);
+        break;
+      case 1:
+        n = sprintf(data + at, "%u.%02u", (seed >> 12) % 10000, seed % 100);
+        break;
+      case 2:
+        n = sprintf(data + at, "%.4f", (double)(seed % 100000) / 7.0);
+        break;
+      default:
+        n = sprintf(data + at, "-%u.%ue%d", (seed >> 12) % 10, seed % 1000,
+                    (int)(seed >> 20) % 40 - 20);
+        break;
+      }
+    }
+    cells[i] = sv_gen(data + at, n);
+    at += n;
+  }
+
+  *sheet = data;
+  return cells;
+}
+
+bool parse_strtod(StringView sv, double *number) {
+  static char tmp_buffer[1024 * 2];
+  snprintf(tmp_buffer, sizeof(tmp_buffer), SV_Fmt, SV_Arg(sv));
+
+  char *endptr;
+  *number = strtod(tmp_buffer, &endptr);
+  return endptr != tmp_buffer && *endptr == '\0';
+}
+
+int main(int argc, char **argv) {
+  size_t count = (size_t)(argc > 1 ? atol(argv[1]) : DEFAULT_CELLS) * 1000;
+  static const char *inputs[] = {"numeric", "text"};
+  static const int percents[] = {90, 10};
+
+  double *expected = malloc(sizeof(double) * count);
+  double *numbers = malloc(sizeof(double) * count);
+  if (!expected || !numbers) {
+    fprintf(stderr, "ERROR: Could not allocate the results\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%-8s %-7s %10s %12s %10s %10s\n", "input", "parser", "ms",
+         "Mcells/s", "numbers", "mismatch");
+  for (size_t input = 0; input < 2; ++input) {
+    char *sheet = NULL;
+    StringView *cells = generate_cells(count, percents[input], &sheet);
+
+    for (int parser = 0; parser < 2; ++parser) {
+      double *out = parser ? numbers : expected;
+      double best = 0;
+      size_t found = 0;
+      for (int run = 0; run < RUNS; ++run) {
+        found = 0;
+        double start = now();
+        for (size_t i = 0; i < count; ++i) {
+          bool number = parser ? sv_parse_number(cells[i], &out[i])
+                               : parse_strtod(cells[i], &out[i]);
+          if (!number) {
+            out[i] = -1;  // no number in the cell, for the comparison
+          }
+          found += number;
+        }
+        double elapsed = now() - start;
+        best = run == 0 || elapsed < best ? elapsed : best;
+      }
+
+      size_t mismatch = 0;
+      for (size_t i = 0; parser && i < count; ++i) {
+        mismatch += memcmp(&expected[i], &numbers[i], sizeof(double)) != 0;
+      }
+      printf("%-8s %-7s %10.2f %12.1f %10zu %10zu\n", inputs[input],
+             parser ? "sv" : "strtod", best * 1e3, count / best / 1e6, found,
+             mismatch);
+    }
+
+    free(cells);
+    free(sheet);
+  }
+
+  free(numbers);
+  free(expected);
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include "bench_sheet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_map.h"
+#include "table.h"
+#include "thread_pool.h"
+
+/*
+ * Parse scaling: parse_table_with() on the generated sheet with pools of
+ * 1 to N threads, each checked cell by cell against the serial parse.
+ *
+ * USAGE: ./build/bench_parallel [file] [size in MB] [max threads]
+ * Same file and defaults as bench_ingest, up to as many threads as CPUs
+ * (at least 4).
+ */
+
+bool same_table(const Table *a, const Table *b) {
+  if (a->rows != b->rows || a->cols != b->cols) {
+    return false;
+  }
+  for (size_t i = 0; i < a->rows * a->cols; ++i) {
+    const Cell *x = &a->cells[i];
+    const Cell *y = &b->cells[i];
+    if (x->type != y->type) {
+      return false;
+    }
+    if (x->type == CELL_TYPE_NUMBER &&
+        memcmp(&x->value.number, &y->value.number, sizeof(double)) != 0) {
+      return false;
+    }
+    if (x->type == CELL_TYPE_TEXT && (x->text_id != y->text_id ||
+                                      !sv_eq(x->value.text, y->value.text))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : DEFAULT_PATH;
+  size_t size = (size_t)(argc > 2 ? atol(argv[2]) : DEFAULT_SIZE_MB) << 20;
+  size_t cpus = thread_pool_cpus();
+  size_t max_threads = argc > 3 ? (size_t)atol(argv[3]) : cpus < 4 ? 4 : cpus;
+
+  double mb = prepare_sheet(path, size);
+  Mapped_File file = {0};
+  if (!map_file(path, &file)) {
+    fprintf(stderr, "ERROR: Could not map %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%zu CPUs\n", cpus);
+  printf("%-8s %10s %10s %8s %10s\n", "threads", "seconds", "MB/s", "speedup",
+         "identical");
+
+  Table serial = {0};
+  double start = now();
+  parse_table_with(&serial, file.content, NULL);
+  double base = now() - start;
+  printf("%-8s %10.2f %10.1f %8.2f %10s\n", "serial", base, mb / base, 1.0, "-");
+
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    Table table = {0};
+    Thread_Pool *pool = thread_pool_create(threads);
+    start = now();
+    parse_table_with(&table, file.content, pool);
+    double elapsed = now() - start;
+    thread_pool_destroy(pool);
+
+    printf("%-8zu %10.2f %10.1f %8.2f %10s\n", threads, elapsed, mb / elapsed,
+           base / elapsed, same_table(&serial, &table) ? "yes" : "NO");
+    table_free(&table);
+  }
+
+  table_free(&serial);
+  unmap_file(&file);
+  return 0;
+}
@@ -0,0 +1,146 @@
+#include "bench_sheet.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "file_map.h"
+#include "scan.h"
+#include "split_view.h"
+
+/*
+ * Delimiter scanning throughput on the generated sheet:
+ * - scan:  scan_delims_at() over the whole file, SCAN_CHUNK bytes at a time,
+ *          for every instruction set the CPU has
+ * - split: every cell of every row cut out with
+ *   - bytewise: sv_split_by_delim() as it was, one compare per byte
+ *   - memchr:   sv_split_by_delim() as it is
+ *   - index:    the structural index, walked the way parse_table() does
+ *
+ * USAGE: ./build/bench_scan [file] [size in MB]
+ * Same file and defaults as bench_ingest.
+ */
+
+#define RUNS 3
+
+static uint32_t positions[SCAN_CHUNK];
+
+// Keeps the compiler from dropping work whose result isn't otherwise used
+static volatile size_t sink;
+
+StringView split_bytewise(StringView *sv, char delim) {
+  size_t delim_pos = 0;
+  while (delim_pos < sv->count && sv->data[delim_pos] != delim) {
+    delim_pos += 1;
+  }
+
+  StringView result = sv_gen(sv->data, delim_pos);
+  size_t skip = delim_pos < sv->count ? delim_pos + 1 : delim_pos;
+  sv->data += skip;
+  sv->count -= skip;
+  return result;
+}
+
+size_t scan_file(StringView content, Scan_Level level) {
+  size_t total = 0;
+  for (size_t offset = 0; offset < content.count; offset += SCAN_CHUNK) {
+    size_t count = content.count - offset;
+    count = count < SCAN_CHUNK ? count : SCAN_CHUNK;
+    total += scan_delims_at(level, content.data + offset, count, positions);
+  }
+  return total;
+}
+
+// Each of the split variants returns the number of cells and adds up their
+// lengths into `sink`
+
+size_t split_with(StringView content, StringView (*split)(StringView *, char)) {
+  size_t cells = 0;
+  size_t bytes = 0;
+  while (content.count > 0) {
+    StringView line = split(&content, '\n');
+    while (line.count > 0) {
+      bytes += split(&line, '|').count;
+      cells += 1;
+    }
+  }
+  sink = bytes;
+  return cells;
+}
+
+size_t split_bytewise_all(StringView content) {
+  return split_with(content, split_bytewise);
+}
+
+size_t split_memchr_all(StringView content) {
+  return split_with(content, sv_split_by_delim);
+}
+
+size_t split_index_all(StringView content) {
+  size_t cells = 0;
+  size_t bytes = 0;
+  const char *field = content.data;
+  for (size_t offset = 0; offset < content.count; offset += SCAN_CHUNK) {
+    const char *chunk = content.data + offset;
+    size_t count = content.count - offset;
+    count = count < SCAN_CHUNK ? count : SCAN_CHUNK;
+    size_t found = scan_delims(chunk, count, positions);
+    for (size_t i = 0; i < found; ++i) {
+      const char *delim = chunk + positions[i];
+      if (*delim == '|' || delim > field) {
+        bytes += delim - field;
+        cells += 1;
+      }
+      field = delim + 1;
+    }
+  }
+  if (field < content.data + content.count) {
+    bytes += content.data + content.count - field;
+    cells += 1;
+  }
+  sink = bytes;
+  return cells;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : DEFAULT_PATH;
+  size_t size = (size_t)(argc > 2 ? atol(argv[2]) : DEFAULT_SIZE_MB) << 20;
+
+  double mb = prepare_sheet(path, size);
+  Mapped_File file = {0};
+  if (!map_file(path, &file)) {
+    fprintf(stderr, "ERROR: Could not map %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%-16s %12s %10s %10s\n", "pass", "found", "seconds", "MB/s");
+  for (Scan_Level level = SCAN_SCALAR; level <= scan_best_level(); ++level) {
+    double best = 0;
+    size_t found = 0;
+    for (int run = 0; run < RUNS; ++run) {
+      double start = now();
+      found = scan_file(file.content, level);
+      double elapsed = now() - start;
+      best = run == 0 || elapsed < best ? elapsed : best;
+    }
+    printf("scan %-11s %12zu %10.3f %10.1f\n", scan_level_name(level), found,
+           best, mb / best);
+  }
+
+  const char *names[] = {"bytewise", "memchr", "index"};
+  size_t (*splits[])(StringView) = {split_bytewise_all, split_memchr_all,
+                                    split_index_all};
+  for (size_t i = 0; i < 3; ++i) {
+    double best = 0;
+    size_t cells = 0;
+    for (int run = 0; run < RUNS; ++run) {
+      double start = now();
+      cells = splits[i](file.content);
+      double elapsed = now() - start;
+      best = run == 0 || elapsed < best ? elapsed : best;
+    }
+    printf("split %-10s %12zu %10.3f %10.1f\n", names[i], cells, best,
+           mb / best);
+  }
+
+  unmap_file(&file);
+  return 0;
+}
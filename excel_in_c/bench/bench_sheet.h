@@ -0,0 +1,59 @@
+#ifndef BENCH_SHEET_H
+#define BENCH_SHEET_H
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// What the benchmarks share: a clock and the generated sheet they run on
+
+#define DEFAULT_PATH "/tmp/excel_bench.csv"
+#define DEFAULT_SIZE_MB 1024
+
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void generate(const char *path, size_t size) {
+  static const char *words[] = {"alpha", "beta", "gamma", "delta", "north",
+                                "south", "total", "pending", "shipped"};
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "ERROR: Could not create %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(fp, "id | name | price | qty | region | status | score | note\n");
+  size_t written = 0;
+  unsigned seed = 1;
+  for (size_t row = 1; written < size; ++row) {
+    seed = seed * 1103515245 + 12345;
+    int n = fprintf(fp, "%zu | %s | %u.%02u | %u | %s | %s | %.4f | %s %s\n",
+                    row, words[seed % 9], seed % 10000, seed % 100,
+                    (seed >> 8) % 500, words[(seed >> 4) % 9],
+                    words[(seed >> 12) % 9], (double)(seed % 100000) / 7.0,
+                    words[(seed >> 16) % 9], words[(seed >> 20) % 9]);
+    written += n;
+  }
+  fclose(fp);
+}
+
+// Generates the sheet at `path` unless it's already there with about `size`
+// bytes, and returns its size in MB
+static inline double prepare_sheet(const char *path, size_t size) {
+  struct stat st;
+  if (stat(path, &st) < 0 || (size_t)st.st_size < size ||
+      (size_t)st.st_size > size + 4096) {
+    printf("Generating %zu MB into %s...\n", size >> 20, path);
+    generate(path, size);
+    stat(path, &st);
+  }
+  return st.st_size / (1024.0 * 1024.0);
+}
+
+#endif
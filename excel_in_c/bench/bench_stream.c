@@ -0,0 +1,156 @@
+#include "bench_sheet.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "expr.h"
+#include "file_map.h"
+#include "output.h"
+#include "stream.h"
+#include "table.h"
+
+/*
+ * End to end: a sheet file in, its evaluated CSV out to /dev/null, on a
+ * generated sheet of numbers, text and formulas reading the rows above
+ * theirs (a running average, a SUM and a MAX over the last rows). Runs
+ * - printf:   the whole table parsed, compiled and evaluated, then printed a
+ *             printf() per cell (the output as it was)
+ * - buffered: the same, written through output_table()
+ * - stream:   stream_sheet(), a block of rows at a time
+ * and reports each one's throughput and how far it took the peak RSS, the
+ * stream first as the peak only goes up.
+ *
+ * USAGE: ./build/bench_stream [file] [size in MB]
+ */
+
+#define STREAM_PATH "/tmp/excel_stream.csv"
+#define STREAM_SIZE_MB 128
+
+void generate_stream(const char *path, size_t size) {
+  static const char *words[] = {"alpha", "beta", "gamma", "delta", "north"};
+  FILE *fp = fopen(path, "wb");
+  if (!fp) {
+    fprintf(stderr, "ERROR: Could not create %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(fp, "id|name|price|qty|avg|trend|sum|max\n");
+  fprintf(fp, "1|alpha|1|1|1|1|1|1\n");
+  size_t written = 0;
+  unsigned seed = 1;
+  for (size_t row = 2; written < size; ++row) {
+    seed = seed * 1103515245 + 12345;
+    size_t back = row > 8 ? row - 8 : 1;
+    int n = fprintf(fp,
+                    "%zu|%s|%u.%02u|%u|=(C%zu+D%zu)/2|=E%zu*0.5+C%zu*0.25"
+                    "|=SUM(D%zu:D%zu)|=MAX(C%zu:C%zu)\n",
+                    row, words[seed % 5], seed % 10000, seed % 100,
+                    (seed >> 8) % 500, row - 1, row - 1, row - 1, row - 1,
+                    back, row - 1, back, row - 1);
+    written += n;
+  }
+  fclose(fp);
+}
+
+long peak_rss_kb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+void print_table(FILE *fp, Table *table) {
+  for (size_t row = 0; row < table->rows; ++row) {
+    for (size_t col = 0; col < table->cols; ++col) {
+      Cell *cell = table_cell_at(table, row, col);
+      if (col > 0) {
+        fprintf(fp, "|");
+      }
+      switch (cell->type) {
+      case CELL_TYPE_TEXT:
+        fprintf(fp, SV_Fmt, SV_Arg(cell->value.text));
+        break;
+      case CELL_TYPE_NUMBER:
+        fprintf(fp, "%.15g", cell->value.number);
+        break;
+      case CELL_TYPE_EXPR:
+        fprintf(fp, "%.15g", cell->value.formula.value);
+        break;
+      case CELL_TYPE_ERROR:
+        fprintf(fp, "%s", cell_error_str(cell->value.formula.error));
+        break;
+      }
+    }
+    fprintf(fp, "\n");
+  }
+}
+
+// Returns the seconds it took
+double run(const char *path, const char *mode, int fd, FILE *fp) {
+  double start = now();
+  Mapped_File file = {0};
+  if (!map_file(path, &file)) {
+    fprintf(stderr, "ERROR: Could not map %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  if (strcmp(mode, "stream") == 0) {
+    Output output = output_open(fd);
+    stream_sheet(&file, STREAM_WINDOW, &output);
+    output_close(&output);
+    unmap_file(&file);
+    return now() - start;
+  }
+
+  Table table = {0};
+  parse_table(&table, file.content);
+  Program program = table_compile(&table);
+  program_run(&program, &table);
+  if (strcmp(mode, "printf") == 0) {
+    print_table(fp, &table);
+    fflush(fp);
+  } else {
+    Output output = output_open(fd);
+    output_table(&output, &table);
+    output_close(&output);
+  }
+  double elapsed = now() - start;
+
+  program_free(&program);
+  table_free(&table);
+  unmap_file(&file);
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : STREAM_PATH;
+  size_t size = (size_t)(argc > 2 ? atol(argv[2]) : STREAM_SIZE_MB) << 20;
+
+  struct stat st;
+  if (stat(path, &st) < 0 || (size_t)st.st_size < size ||
+      (size_t)st.st_size > size + 4096) {
+    printf("Generating %zu MB into %s...\n", size >> 20, path);
+    generate_stream(path, size);
+    stat(path, &st);
+  }
+  double mb = st.st_size / (1024.0 * 1024.0);
+
+  int fd = open("/dev/null", O_WRONLY);
+  FILE *fp = fdopen(fd, "w");
+  if (fd < 0 || !fp) {
+    fprintf(stderr, "ERROR: Could not open /dev/null\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%-9s %10s %10s %14s\n", "output", "seconds", "MB/s", "peak RSS MB");
+  const char *modes[] = {"stream", "buffered", "printf"};
+  for (size_t i = 0; i < 3; ++i) {
+    double elapsed = run(path, modes[i], fd, fp);
+    printf("%-9s %10.2f %10.1f %14.1f\n", modes[i], elapsed, mb / elapsed,
+           peak_rss_kb() / 1024.0);
+  }
+
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include "bench_sheet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "expr.h"
+#include "table.h"
+
+/*
+ * Single-cell update latency: sheets of growing size where each row holds a
+ * number and a chain of formulas reading it. Changing the number with
+ * program_set_number() re-evaluates that row's formulas only, so its latency
+ * should stay flat while a full recompute grows with the sheet. Updates go
+ * to random rows, and then to rows in order, which leaves out the cache
+ * misses of landing anywhere in a table bigger than the caches. After the
+ * updates the sheet is recomputed in full and must not change.
+ *
+ * USAGE: ./build/bench_update
+ */
+
+#define UPDATES 100000
+
+static const char *row_formulas =
+    "|=A%1$zu*2|=B%1$zu+A%1$zu|=C%1$zu-B%1$zu/2|=D%1$zu*(C%1$zu+1)"
+    "|=E%1$zu/(1+A%1$zu*A%1$zu)|=F%1$zu+E%1$zu|=G%1$zu-D%1$zu"
+    "|=H%1$zu*0.5|=I%1$zu+B%1$zu\n";
+
+char *generate_rows(size_t rows, size_t *size) {
+  size_t capacity = rows * 160 + 64;
+  char *sheet = malloc(capacity);
+  if (!sheet) {
+    fprintf(stderr, "ERROR: Could not allocate the sheet\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t at = sprintf(sheet, "A|B|C|D|E|F|G|H|I|J\n");
+  for (size_t row = 1; row <= rows; ++row) {
+    at += sprintf(sheet + at, "%zu", row % 97);
+    at += sprintf(sheet + at, row_formulas, row);
+  }
+  *size = at;
+  return sheet;
+}
+
+int main(void) {
+  printf("%10s %10s %12s %12s %12s %10s %10s\n", "formulas", "compile s",
+         "full run ms", "random ns", "in order ns", "speedup", "identical");
+
+  for (size_t rows = 1000; rows <= 100000; rows *= 10) {
+    size_t size = 0;
+    char *sheet = generate_rows(rows, &size);
+    Table table = {0};
+    parse_table(&table, sv_gen(sheet, size));
+
+    double start = now();
+    Program program = table_compile(&table);
+    double compile = now() - start;
+
+    start = now();
+    program_run(&program, &table);
+    double full = now() - start;
+
+    unsigned seed = 7;
+    start = now();
+    for (size_t i = 0; i < UPDATES; ++i) {
+      seed = seed * 1103515245 + 12345;
+      size_t row = 1 + (seed >> 8) % rows;
+      program_set_number(&program, &table, row, 0, (double)(seed % 1000));
+    }
+    double update = (now() - start) / UPDATES;
+
+    start = now();
+    for (size_t i = 0; i < UPDATES; ++i) {
+      program_set_number(&program, &table, 1 + i % rows, 0, (double)(i % 1000));
+    }
+    double in_order = (now() - start) / UPDATES;
+
+    // Whatever the updates left must be what a full recompute gives
+    size_t cells = table.rows * table.cols;
+    double *values = malloc(sizeof(double) * cells);
+    for (size_t i = 0; i < cells; ++i) {
+      values[i] = table.cells[i].value.formula.value;
+    }
+    program_run(&program, &table);
+    bool identical = true;
+    for (size_t i = 0; i < cells; ++i) {
+      if (table.cells[i].type == CELL_TYPE_EXPR &&
+          memcmp(&values[i], &table.cells[i].value.formula.value,
+                 sizeof(double)) != 0) {
+        identical = false;
+      }
+    }
+
+    printf("%10zu %10.3f %12.3f %12.1f %12.1f %10.0f %10s\n",
+           program.formulas, compile, full * 1e3, update * 1e9, in_order * 1e9,
+           full / update, identical ? "yes" : "NO");
+
+    free(values);
+    program_free(&program);
+    table_free(&table);
+    free(sheet);
+  }
+  return 0;
+}
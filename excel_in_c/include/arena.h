@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Memory for many small allocations that all go at once: blocks of
+// ARENA_BLOCK bytes handed out front to back, and freed together by
+// arena_free(). A zeroed Arena is empty and ready to use.
+
+#define ARENA_BLOCK (1 << 20)
+
+typedef struct Arena_Block Arena_Block;
+
+typedef struct {
+  Arena_Block *blocks;  // the one being handed out first
+  size_t size;          // bytes in all the blocks
+} Arena;
+
+// `size` bytes aligned for any type, exits if there's no memory left
+void *arena_alloc(Arena *arena, size_t size);
+// A copy of `count` bytes of `data`
+char *arena_copy(Arena *arena, const char *data, size_t count);
+
+// Gives the blocks of `from` to `into`, leaving `from` empty
+void arena_merge(Arena *into, Arena *from);
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef COLUMN_H
+#define COLUMN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scan.h"
+#include "table.h"
+
+// A table stored by column rather than by row. Each column has a bitmap of
+// the rows holding a number and the numbers themselves in a dense array, 0 in
+// rows without one, so a numeric column can be read without touching any
+// other column or any text.
+
+typedef struct {
+  uint64_t *numeric;  // bit `row % 64` of word `row / 64`: row holds a number
+  double *numbers;
+  StringView *texts;  // NULL while the column has no text
+} Column;
+
+typedef struct {
+  Column *columns;
+  size_t rows;
+  size_t cols;
+} Column_Table;
+
+typedef enum {
+  AGGREGATE_SUM = 0,
+  AGGREGATE_MIN,
+  AGGREGATE_MAX,
+  AGGREGATE_AVG,
+} Aggregate;
+
+// Numbers and evaluated formulas become numbers, text stays text and error
+// cells become their error text
+Column_Table columns_from_table(const Table *table);
+void column_load(Column *column, const Table *table, size_t col);
+
+// Back to cells: numbers and text only, formulas come back as their values
+Table columns_to_table(const Column_Table *columns);
+
+void columns_free(Column_Table *columns);
+
+static inline bool column_is_number(const Column *column, size_t row) {
+  return column->numeric[row / 64] >> (row % 64) & 1;
+}
+
+// The numbers in rows first..last-1 of a column: how many there are, their
+// sum, their smallest and their largest. Sums add up the rows in the same
+// order on every instruction set, so they come out the same everywhere. MIN
+// and MAX of rows holding a NaN are the first NaN, on every instruction set.
+// MIN and MAX of no numbers are +inf and -inf, AVG of no numbers is 0.
+size_t column_count(const Column *column, size_t first, size_t last);
+double column_reduce(const Column *column, Aggregate aggregate, size_t first,
+                     size_t last);
+double column_reduce_at(Scan_Level level, const Column *column,
+                        Aggregate aggregate, size_t first, size_t last);
+
+// The aggregate of rows first..last-1 of `count` columns together, as the
+// range functions of formulas take it: the columns one after the other, and
+// MIN and MAX of no numbers are 0, like AVG
+double columns_aggregate(const Column *columns, size_t count,
+                         Aggregate aggregate, size_t first, size_t last);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "column.h"
+#include "table.h"
+#include "thread_pool.h"
+
+// The formulas of a table compiled into one flat array of stack machine
+// instructions. Each formula's code leaves its value on the stack and ends
+// with OP_STORE into its cell, and formulas come after the ones they read, so
+// evaluating the whole sheet is a single run through the array. Alongside it
+// is the dependency graph, to re-evaluate only what a change affects, and the
+// columns that range functions like SUM(A1:A9) read, stored by column.
+
+typedef enum {
+  OP_NUMBER = 0,  // push `number`
+  OP_NUMBER_CELL, // push the number in `cell`
+  OP_FORMULA_CELL,// push the value of the formula in `cell`
+  OP_AGGREGATE,   // push the function of range `cell` of Program.ranges
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_NEG,
+  OP_STORE,       // pop into the formula in `cell`
+  OP_STORE_COLUMN,// OP_STORE, and into the column a range reads it from
+} Op_Code;
+
+typedef struct {
+  Op_Code op;
+  union {
+    double number;
+    size_t cell;  // index into Table.cells
+  } arg;
+} Instr;
+
+#define EVAL_STACK 256  // deepest nesting a formula can have
+
+// The cells of a range function, cut to the table: rows first_row..last_row-1
+// of columns first_col..last_col-1. Numbers and formulas in it count, text
+// doesn't.
+typedef struct {
+  Aggregate aggregate;
+  size_t first_row;
+  size_t last_row;
+  size_t first_col;
+  size_t last_col;
+} Range;
+
+typedef struct {
+  Instr *code;
+  size_t count;
+  size_t capacity;
+
+  // Formulas are numbered in evaluation order. Formula f is in cell cells[f]
+  // and its code is code[starts[f]..starts[f + 1]]. Error cells aren't
+  // compiled.
+  size_t formulas;
+  size_t *cells;
+  size_t *starts;
+
+  // The formulas that read a cell, by open addressing on the cell: slot i
+  // holds cell read_cells[i] - 1 (0 for an empty slot), which is read by the
+  // formulas readers[reader_starts[i]..reader_starts[i + 1]]
+  size_t *read_cells;
+  size_t read_capacity;  // a power of two
+  size_t *reader_starts;
+  size_t *readers;
+
+  // Formulas by level: level 0 reads no formula, and every other formula
+  // reads one of the level before it and none of its own level or later.
+  // Level l holds the formulas by_level[level_starts[l]..level_starts[l + 1]].
+  size_t levels;
+  size_t *level_starts;
+  size_t *by_level;
+
+  // The ranges of OP_AGGREGATE, and the columns they read kept by column as
+  // the formulas in them are evaluated. Columns no range reads have no arrays.
+  Range *ranges;
+  size_t num_ranges;
+  size_t ranges_capacity;
+  Column_Table columns;
+
+  // Scratch space for program_set_number()
+  uint8_t *dirty;
+  size_t *pending;
+} Program;
+
+// Parses "B3" into its row and column, false if it isn't a cell reference
+bool parse_cell_ref(StringView sv, Expr_Cell *cell);
+
+// Compiles every formula of `table`. Formulas that are part of a circular
+// reference, refer outside the table or to text, or read any of those become
+// CELL_TYPE_ERROR cells. A range reaching past the table is cut to it, one
+// starting outside of it is an error.
+Program table_compile(Table *table);
+
+// Evaluates every formula
+void program_run(const Program *program, Table *table);
+
+#define LEVEL_CHUNK 1024  // formulas of a level per task
+
+// Evaluates every formula, level after level, with the formulas of a level
+// spread over the threads of `pool`. Each formula computes what it would in
+// program_run(), so the results are the same whatever the thread count. A
+// sheet with no level wider than LEVEL_CHUNK just goes to program_run().
+void program_run_parallel(const Program *program, Table *table,
+                          Thread_Pool *pool);
+
+// Changes the number in a cell and re-evaluates only the formulas that depend
+// on it, directly or not. False if the cell doesn't hold a number: changing
+// what kind of cell it is changes the graph, so compile the table again.
+bool program_set_number(Program *program, Table *table, size_t row, size_t col,
+                        double number);
+void program_free(Program *program);
+
+#endif
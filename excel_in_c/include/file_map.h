@@ -0,0 +1,24 @@
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "split_view.h"
+
+// A file mapped read-only into memory. Views into `content` stay valid until
+// the file is unmapped.
+typedef struct {
+  StringView content;
+  void *mapping;
+  size_t mapping_size;
+} Mapped_File;
+
+bool map_file(const char *file_path, Mapped_File *file);
+void unmap_file(Mapped_File *file);
+
+// Lets go of the whole pages of content[begin..end) held in memory, so a
+// file read front to back doesn't stay resident. They stay mapped, and are
+// read again from the file if they're used again.
+void drop_file_pages(Mapped_File *file, const char *begin, const char *end);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "split_view.h"
+
+// Every distinct text once: interning a text gives its id, the same for
+// every copy of it, and the view of the one copy kept. Two interned texts
+// are equal exactly when their ids are. Id 0 is the empty text, so zeroed
+// cells have the right id. A zeroed Intern_Pool is empty and ready to use.
+
+typedef struct {
+  StringView *texts;  // by id
+  uint64_t *hashes;   // by id
+  size_t count;
+  size_t capacity;
+
+  // Ids by open addressing on the hash: slot i holds id slots[i] - 1, 0 for
+  // an empty slot
+  uint32_t *slots;
+  size_t num_slots;  // a power of two
+} Intern_Pool;
+
+// The id of `text`, copying it into `arena` the first time it's seen
+uint32_t intern(Intern_Pool *pool, Arena *arena, StringView text);
+void intern_pool_free(Intern_Pool *pool);
+
+#endif
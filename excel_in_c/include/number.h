@@ -0,0 +1,13 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stdbool.h>
+#include "split_view.h"
+
+// Reads the whole of `sv` as a number, exactly as strtod() would, without
+// copying it: true and the number if all of it is one, false for text.
+// Decimals of up to 19 digits and exponents within 10^22 are read directly,
+// the rest (longer or larger numbers, hex, inf and nan) go to strtod().
+bool sv_parse_number(StringView sv, double *number);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include "table.h"
+
+// Evaluated sheets written out as CSV through one large buffer, so a whole
+// block of rows goes out in a single write() rather than a call per cell.
+// Numbers and formula values are written as "%.15g" would, error cells as
+// their error.
+
+#define OUTPUT_BUFFER (1 << 20)
+
+typedef struct {
+  int fd;
+  char *buffer;
+  size_t count;
+} Output;
+
+Output output_open(int fd);
+
+// Writes row `row` of `table`, every column of it
+void output_row(Output *output, const Table *table, size_t row);
+void output_table(Output *output, const Table *table);
+
+void output_flush(Output *output);
+// Flushes what's left and frees the buffer, the file stays open
+void output_close(Output *output);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Structural index of a sheet: the offsets of every field delimiter ('|')
+// and row delimiter ('\n'), found many bytes at a time with SIMD compares
+// where the CPU has them.
+
+typedef enum {
+  SCAN_SCALAR = 0,
+  SCAN_SSE2,
+  SCAN_AVX2,
+} Scan_Level;
+
+#define SCAN_CHUNK (64 * 1024)  // bytes indexed per call by parse_table()
+
+Scan_Level scan_best_level(void);
+const char *scan_level_name(Scan_Level level);
+
+// Writes the offset of each delimiter in data[0..count) to `positions`, in
+// order, and returns how many there are. `positions` needs room for `count`
+// entries and `count` must fit in 32 bits.
+size_t scan_delims(const char *data, size_t count, uint32_t *positions);
+size_t scan_delims_at(Scan_Level level, const char *data, size_t count,
+                      uint32_t *positions);
+
+#endif
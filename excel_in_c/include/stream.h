@@ -0,0 +1,21 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include "file_map.h"
+#include "output.h"
+
+// Evaluating a sheet while it's read, for sheets whose formulas only read
+// rows above their own. Rows are parsed, evaluated and written out a block at
+// a time, and only the last `window` rows are kept, so memory doesn't grow
+// with the sheet. The output is what the whole-table path writes.
+
+#define STREAM_BLOCK 4096     // rows parsed, evaluated and written at a time
+#define STREAM_WINDOW 65536   // rows back a formula can read by default
+
+// Exits with an error at the first formula reading its own row or one below,
+// or one more than `window` rows above. The pages of `file` that were read
+// are unmapped as the rows leave the window.
+void stream_sheet(Mapped_File *file, size_t window, Output *output);
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "intern.h"
+#include "split_view.h"
+#include "thread_pool.h"
+
+typedef enum {
+  EXPR_TYPE_NUMBER = 0,
+  EXPR_TYPE_CELL,
+  EXPR_TYPE_PLUS,
+  EXPR_TYPE_MINUS,
+  EXPR_TYPE_MULT,
+  EXPR_TYPE_DIV,
+  EXPR_TYPE_NEG,
+  EXPR_TYPE_FUNC,
+} Expr_Type;
+
+typedef struct Expr Expr;
+
+// The operands of any binary operator, not only '+'
+typedef struct {
+  Expr* lhs;
+  Expr* rhs;
+} Expr_Plus;
+
+// A reference like B3: column B is 1, and row 3 is the table's row 3 because
+// row 0 holds the column names
+typedef struct {
+  size_t row;
+  size_t col;
+} Expr_Cell;
+
+typedef enum {
+  EXPR_FUNC_SUM = 0,
+  EXPR_FUNC_MIN,
+  EXPR_FUNC_MAX,
+  EXPR_FUNC_AVG,
+} Expr_Func;
+
+// A function of the numbers in a range like SUM(A1:B9), corners included
+typedef struct {
+  Expr_Func func;
+  Expr_Cell from;  // the top left corner
+  Expr_Cell to;    // the bottom right corner
+} Expr_Call;
+
+typedef union {
+  double number;
+  Expr_Cell cell;
+  Expr_Plus plus;
+  Expr *operand;  // EXPR_TYPE_NEG
+  Expr_Call call;
+} Expr_Value;
+
+struct Expr {
+  Expr_Type type;
+  Expr_Value value;
+};
+
+typedef enum {
+  CELL_TYPE_TEXT = 0,
+  CELL_TYPE_NUMBER,
+  CELL_TYPE_EXPR,
+  CELL_TYPE_ERROR,  // a formula that can't be evaluated
+} Cell_Type;
+
+typedef enum {
+  CELL_ERROR_NONE = 0,
+  CELL_ERROR_CYCLE,  // part of a circular reference, or reads one
+  CELL_ERROR_REF,    // refers outside the table
+  CELL_ERROR_VALUE,  // refers to text, or isn't a formula that parses
+} Cell_Error;
+
+typedef struct {
+  Expr *ast;  // in the table's arena
+  union {
+    double value;      // CELL_TYPE_EXPR, set by program_run()
+    Cell_Error error;  // CELL_TYPE_ERROR, set by table_compile()
+  };
+} Cell_Formula;
+
+typedef union {
+  StringView text;  // interned in the table, or see Table.text_in_content
+  double number;
+  Cell_Formula formula;
+} Cell_Value;
+
+typedef struct {
+  Cell_Type type;
+  uint32_t text_id;  // CELL_TYPE_TEXT: the id of its text in Table.strings
+  Cell_Value value;
+} Cell;
+
+typedef struct {
+  Cell *cells;
+  size_t rows;
+  size_t cols;
+  size_t capacity;  // rows `cells` has room for
+
+  // What the cells allocate, freed with the table: Expr nodes and the text
+  // of text cells, each distinct text once
+  Arena arena;
+  Intern_Pool strings;
+
+  // Set before parsing to leave text cells pointing into the content instead,
+  // which must then outlive the table. Their ids are all 0.
+  bool text_in_content;
+} Table;
+
+Cell *table_cell_at(Table *table, size_t row, size_t col);
+const char *cell_as_str(Cell* cell);
+const char *cell_error_str(Cell_Error error);
+Table table_alloc(size_t rows, size_t cols);
+void table_free(Table *table);
+
+// Parses a formula, with or without its leading '=', into nodes allocated in
+// `arena`. If it isn't one, says why on stderr and returns NULL, which
+// table_compile() turns into a CELL_ERROR_VALUE cell.
+Expr* parse_expr(StringView sv, Arena *arena);
+
+// Appends the rows of `content` to `table` in a single pass, growing it as
+// needed. Start from a zeroed Table to parse a whole sheet. Large sheets are
+// parsed in chunks on every CPU.
+void parse_table(Table *table, StringView content);
+
+// Same result as parse_table(), with the chunks of the sheet parsed on the
+// threads of `pool`, or in a single pass on the calling thread without one
+void parse_table_with(Table *table, StringView content, Thread_Pool *pool);
+
+// The columns parse_table() would give `content`, from a scan of its
+// delimiters that stores nothing
+size_t parse_table_cols(StringView content);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+// A fixed set of worker threads that run batches of independent tasks.
+// thread_pool_run() hands out the indices 0..count-1 to the workers and the
+// calling thread, and returns once every task is done.
+typedef struct Thread_Pool Thread_Pool;
+
+typedef void (*Thread_Task)(void *arg, size_t index);
+
+// `threads` counts the calling thread, so 1 runs everything on the caller
+Thread_Pool *thread_pool_create(size_t threads);
+void thread_pool_destroy(Thread_Pool *pool);
+size_t thread_pool_size(const Thread_Pool *pool);
+void thread_pool_run(Thread_Pool *pool, Thread_Task task, void *arg,
+                     size_t count);
+
+// Online CPUs, at least 1
+size_t thread_pool_cpus(void);
+
+#endif
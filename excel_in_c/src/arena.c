@@ -0,0 +1,99 @@
+#include "arena.h"
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Arena_Block {
+  Arena_Block *next;
+  size_t size;
+  size_t used;
+  max_align_t data[];
+};
+
+#define ALIGN alignof(max_align_t)
+
+static Arena_Block *block_new(size_t size, Arena_Block *next) {
+  Arena_Block *block = malloc(sizeof(Arena_Block) + size);
+  if (!block) {
+    fprintf(stderr, "ERROR: Failed to allocate an arena block of %zu bytes.\n",
+            size);
+    exit(EXIT_FAILURE);
+  }
+  block->next = next;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+// `size` bytes at a multiple of `align` from the start of a block, which is
+// aligned for anything
+static void *arena_take(Arena *arena, size_t size, size_t align) {
+  Arena_Block *block = arena->blocks;
+  size_t at = block ? (block->used + align - 1) / align * align : 0;
+
+  if (!block || at > block->size || block->size - at < size) {
+    if (size > ARENA_BLOCK / 4) {
+      // Big enough for a block of its own, behind the one being handed out
+      Arena_Block *own = block_new(size, block ? block->next : NULL);
+      if (block) {
+        block->next = own;
+      } else {
+        arena->blocks = own;
+      }
+      own->used = size;
+      arena->size += size;
+      return own->data;
+    }
+    block = block_new(ARENA_BLOCK, block);
+    arena->blocks = block;
+    arena->size += ARENA_BLOCK;
+    at = 0;
+  }
+
+  block->used = at + size;
+  return (char *)block->data + at;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  return arena_take(arena, size, ALIGN);
+}
+
+char *arena_copy(Arena *arena, const char *data, size_t count) {
+  char *copy = arena_take(arena, count, 1);
+  if (count > 0) {
+    memcpy(copy, data, count);
+  }
+  return copy;
+}
+
+void arena_merge(Arena *into, Arena *from) {
+  if (!from->blocks) {
+    return;
+  }
+  if (!into->blocks) {
+    *into = *from;
+  } else {
+    // Behind the block `into` is handing out, which keeps going
+    Arena_Block *last = from->blocks;
+    while (last->next) {
+      last = last->next;
+    }
+    last->next = into->blocks->next;
+    into->blocks->next = from->blocks;
+    into->size += from->size;
+  }
+  from->blocks = NULL;
+  from->size = 0;
+}
+
+void arena_free(Arena *arena) {
+  Arena_Block *block = arena->blocks;
+  while (block) {
+    Arena_Block *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->blocks = NULL;
+  arena->size = 0;
+}
@@ -0,0 +1,452 @@
+#include "column.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COLUMN_X86 1
+#include <immintrin.h>
+#else
+#define COLUMN_X86 0
+#endif
+
+#define SUM_LANES 8       // partial sums kept apart, on every instruction set
+#define COLUMN_BLOCK 256  // rows converted at a time
+
+// ---------------------------------------------------------------------------
+// Conversions
+// ---------------------------------------------------------------------------
+
+static void *column_calloc(size_t count, size_t size) {
+  void *array = calloc(count ? count : 1, size);
+  if (!array) {
+    fprintf(stderr, "ERROR: Failed to allocate a column of %zu rows.\n", count);
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+static void column_set_text(Column *column, size_t rows, size_t row,
+                            StringView text) {
+  if (!column->texts) {
+    column->texts = column_calloc(rows, sizeof(StringView));
+  }
+  column->texts[row] = text;
+}
+
+static void column_alloc(Column *column, size_t rows) {
+  column->numeric = column_calloc((rows + 63) / 64, sizeof(uint64_t));
+  column->numbers = column_calloc(rows, sizeof(double));
+  column->texts = NULL;
+}
+
+// Rows first..last-1 of column `col`
+static void column_load_rows(Column *column, const Table *table, size_t col,
+                             size_t first, size_t last) {
+  for (size_t row = first; row < last; ++row) {
+    const Cell *cell = &table->cells[row * table->cols + col];
+    const char *error;
+
+    switch (cell->type) {
+    case CELL_TYPE_NUMBER:
+      column->numbers[row] = cell->value.number;
+      column->numeric[row / 64] |= (uint64_t)1 << (row % 64);
+      break;
+    case CELL_TYPE_EXPR:
+      column->numbers[row] = cell->value.formula.value;
+      column->numeric[row / 64] |= (uint64_t)1 << (row % 64);
+      break;
+    case CELL_TYPE_ERROR:
+      error = cell_error_str(cell->value.formula.error);
+      column_set_text(column, table->rows, row, sv_gen(error, strlen(error)));
+      break;
+    default:
+      if (cell->value.text.count > 0) {
+        column_set_text(column, table->rows, row, cell->value.text);
+      }
+      break;
+    }
+  }
+}
+
+void column_load(Column *column, const Table *table, size_t col) {
+  column_alloc(column, table->rows);
+  column_load_rows(column, table, col, 0, table->rows);
+}
+
+// Both conversions go a block of COLUMN_BLOCK rows at a time, every column
+// of the block before the next one, so the cells are read once from memory
+// rather than once per column
+Column_Table columns_from_table(const Table *table) {
+  Column_Table columns = {0};
+  columns.rows = table->rows;
+  columns.cols = table->cols;
+  columns.columns = column_calloc(table->cols, sizeof(Column));
+
+  for (size_t col = 0; col < table->cols; ++col) {
+    column_alloc(&columns.columns[col], table->rows);
+  }
+  for (size_t first = 0; first < table->rows; first += COLUMN_BLOCK) {
+    size_t last = first + COLUMN_BLOCK;
+    last = last < table->rows ? last : table->rows;
+    for (size_t col = 0; col < table->cols; ++col) {
+      column_load_rows(&columns.columns[col], table, col, first, last);
+    }
+  }
+  return columns;
+}
+
+Table columns_to_table(const Column_Table *columns) {
+  Table table = table_alloc(columns->rows, columns->cols);
+
+  for (size_t first = 0; first < columns->rows; first += COLUMN_BLOCK) {
+    size_t last = first + COLUMN_BLOCK;
+    last = last < columns->rows ? last : columns->rows;
+    for (size_t col = 0; col < columns->cols; ++col) {
+      const Column *column = &columns->columns[col];
+      for (size_t row = first; row < last; ++row) {
+        Cell *cell = &table.cells[row * table.cols + col];
+        if (column_is_number(column, row)) {
+          cell->type = CELL_TYPE_NUMBER;
+          cell->value.number = column->numbers[row];
+        } else {
+          cell->type = CELL_TYPE_TEXT;
+          cell->value.text = column->texts ? column->texts[row] : sv_gen("", 0);
+        }
+      }
+    }
+  }
+  return table;
+}
+
+void columns_free(Column_Table *columns) {
+  for (size_t col = 0; col < columns->cols; ++col) {
+    free(columns->columns[col].numeric);
+    free(columns->columns[col].numbers);
+    free(columns->columns[col].texts);
+  }
+  free(columns->columns);
+  memset(columns, 0, sizeof(*columns));
+}
+
+// ---------------------------------------------------------------------------
+// Aggregates. Rows without a number hold 0, so a sum can run over the dense
+// array without looking at the bitmap. MIN and MAX go through it a word at a
+// time: a word of 64 numbers takes the vector loop, a mixed one the rows
+// whose bit is set.
+// ---------------------------------------------------------------------------
+
+static double combine_lanes(const double *lanes) {
+  return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+         ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+// The rows past the last full group of SUM_LANES go to their own lanes, as
+// they would in a full group
+static double sum_tail(const double *numbers, size_t i, size_t count,
+                       double *lanes) {
+  for (; i < count; ++i) {
+    lanes[i % SUM_LANES] += numbers[i];
+  }
+  return combine_lanes(lanes);
+}
+
+static double sum_scalar(const double *numbers, size_t count) {
+  double lanes[SUM_LANES] = {0};
+  size_t i = 0;
+  for (; i + SUM_LANES <= count; i += SUM_LANES) {
+    for (size_t lane = 0; lane < SUM_LANES; ++lane) {
+      lanes[lane] += numbers[i + lane];
+    }
+  }
+  return sum_tail(numbers, i, count, lanes);
+}
+
+// A NaN wins over any number, and the first NaN over later ones
+static inline double min_of(double min, double number) {
+  return number < min || (isnan(number) && !isnan(min)) ? number : min;
+}
+
+static inline double max_of(double max, double number) {
+  return number > max || (isnan(number) && !isnan(max)) ? number : max;
+}
+
+static double min_scalar(const double *numbers, size_t count, double min) {
+  for (size_t i = 0; i < count; ++i) {
+    min = min_of(min, numbers[i]);
+  }
+  return min;
+}
+
+static double max_scalar(const double *numbers, size_t count, double max) {
+  for (size_t i = 0; i < count; ++i) {
+    max = max_of(max, numbers[i]);
+  }
+  return max;
+}
+
+#if COLUMN_X86
+
+__attribute__((target("sse2")))
+static double sum_sse2(const double *numbers, size_t count) {
+  __m128d acc[SUM_LANES / 2];
+  for (size_t j = 0; j < SUM_LANES / 2; ++j) {
+    acc[j] = _mm_setzero_pd();
+  }
+
+  size_t i = 0;
+  for (; i + SUM_LANES <= count; i += SUM_LANES) {
+    for (size_t j = 0; j < SUM_LANES / 2; ++j) {
+      acc[j] = _mm_add_pd(acc[j], _mm_loadu_pd(numbers + i + 2 * j));
+    }
+  }
+
+  double lanes[SUM_LANES];
+  for (size_t j = 0; j < SUM_LANES / 2; ++j) {
+    _mm_storeu_pd(lanes + 2 * j, acc[j]);
+  }
+  return sum_tail(numbers, i, count, lanes);
+}
+
+__attribute__((target("sse2")))
+static double min_sse2(const double *numbers, size_t count, double min) {
+  __m128d acc = _mm_set1_pd(min);
+  __m128d nan = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128d x = _mm_loadu_pd(numbers + i);
+    acc = _mm_min_pd(acc, x);
+    nan = _mm_or_pd(nan, _mm_cmpunord_pd(x, x));
+  }
+  // minpd drops NaNs in one operand, so they go through the scalar loop
+  if (_mm_movemask_pd(nan) || isnan(min)) {
+    return min_scalar(numbers, count, min);
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+  return min_scalar(numbers + i, count - i, min);
+}
+
+__attribute__((target("sse2")))
+static double max_sse2(const double *numbers, size_t count, double max) {
+  __m128d acc = _mm_set1_pd(max);
+  __m128d nan = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128d x = _mm_loadu_pd(numbers + i);
+    acc = _mm_max_pd(acc, x);
+    nan = _mm_or_pd(nan, _mm_cmpunord_pd(x, x));
+  }
+  if (_mm_movemask_pd(nan) || isnan(max)) {
+    return max_scalar(numbers, count, max);
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+  return max_scalar(numbers + i, count - i, max);
+}
+
+__attribute__((target("avx2")))
+static double sum_avx2(const double *numbers, size_t count) {
+  __m256d low = _mm256_setzero_pd();
+  __m256d high = _mm256_setzero_pd();
+
+  size_t i = 0;
+  for (; i + SUM_LANES <= count; i += SUM_LANES) {
+    low = _mm256_add_pd(low, _mm256_loadu_pd(numbers + i));
+    high = _mm256_add_pd(high, _mm256_loadu_pd(numbers + i + 4));
+  }
+
+  double lanes[SUM_LANES];
+  _mm256_storeu_pd(lanes, low);
+  _mm256_storeu_pd(lanes + 4, high);
+  return sum_tail(numbers, i, count, lanes);
+}
+
+__attribute__((target("avx2")))
+static double min_avx2(const double *numbers, size_t count, double min) {
+  __m256d acc = _mm256_set1_pd(min);
+  __m256d nan = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d x = _mm256_loadu_pd(numbers + i);
+    acc = _mm256_min_pd(acc, x);
+    nan = _mm256_or_pd(nan, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+  }
+  if (_mm256_movemask_pd(nan) || isnan(min)) {
+    return min_scalar(numbers, count, min);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  return min_scalar(lanes, 4, min_scalar(numbers + i, count - i, min));
+}
+
+__attribute__((target("avx2")))
+static double max_avx2(const double *numbers, size_t count, double max) {
+  __m256d acc = _mm256_set1_pd(max);
+  __m256d nan = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d x = _mm256_loadu_pd(numbers + i);
+    acc = _mm256_max_pd(acc, x);
+    nan = _mm256_or_pd(nan, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+  }
+  if (_mm256_movemask_pd(nan) || isnan(max)) {
+    return max_scalar(numbers, count, max);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  return max_scalar(lanes, 4, max_scalar(numbers + i, count - i, max));
+}
+
+#endif
+
+static double sum_dense(Scan_Level level, const double *numbers, size_t count) {
+  switch (level) {
+#if COLUMN_X86
+  case SCAN_AVX2:
+    return sum_avx2(numbers, count);
+  case SCAN_SSE2:
+    return sum_sse2(numbers, count);
+#endif
+  default:
+    return sum_scalar(numbers, count);
+  }
+}
+
+// The smallest (or with `max`, largest) of `numbers` and `start`
+static double extreme_dense(Scan_Level level, bool max, const double *numbers,
+                            size_t count, double start) {
+  switch (level) {
+#if COLUMN_X86
+  case SCAN_AVX2:
+    return max ? max_avx2(numbers, count, start)
+               : min_avx2(numbers, count, start);
+  case SCAN_SSE2:
+    return max ? max_sse2(numbers, count, start)
+               : min_sse2(numbers, count, start);
+#endif
+  default:
+    return max ? max_scalar(numbers, count, start)
+               : min_scalar(numbers, count, start);
+  }
+}
+
+// Bits of word `word` for the rows in first..last-1
+static uint64_t range_mask(size_t word, size_t first, size_t last) {
+  uint64_t mask = ~(uint64_t)0;
+  if (word == first / 64) {
+    mask &= ~(uint64_t)0 << (first % 64);
+  }
+  if (word == (last - 1) / 64 && last % 64 != 0) {
+    mask &= ~(uint64_t)0 >> (64 - last % 64);
+  }
+  return mask;
+}
+
+size_t column_count(const Column *column, size_t first, size_t last) {
+  size_t count = 0;
+  for (size_t word = first / 64; first < last && word <= (last - 1) / 64;
+       ++word) {
+    count += __builtin_popcountll(column->numeric[word] &
+                                  range_mask(word, first, last));
+  }
+  return count;
+}
+
+static double extreme(Scan_Level level, bool max, const Column *column,
+                      size_t first, size_t last) {
+  double result = max ? -INFINITY : INFINITY;
+  if (first >= last) {
+    return result;
+  }
+
+  size_t word = first / 64;
+  while (word <= (last - 1) / 64) {
+    uint64_t mask = range_mask(word, first, last);
+    uint64_t bits = column->numeric[word] & mask;
+
+    if (bits == ~(uint64_t)0) {
+      // A run of full words goes to the vector loop at once
+      size_t end = word + 1;
+      while (end <= (last - 1) / 64 &&
+             (column->numeric[end] & range_mask(end, first, last)) ==
+                 ~(uint64_t)0) {
+        end += 1;
+      }
+      result = extreme_dense(level, max, column->numbers + word * 64,
+                             (end - word) * 64, result);
+      word = end;
+      continue;
+    }
+
+    for (; bits; bits &= bits - 1) {
+      double number = column->numbers[word * 64 + __builtin_ctzll(bits)];
+      result = max ? max_of(result, number) : min_of(result, number);
+    }
+    word += 1;
+  }
+  return result;
+}
+
+double column_reduce_at(Scan_Level level, const Column *column,
+                        Aggregate aggregate, size_t first, size_t last) {
+  if (level > scan_best_level()) {
+    level = scan_best_level();
+  }
+  if (first >= last) {
+    return aggregate == AGGREGATE_MIN   ? INFINITY
+           : aggregate == AGGREGATE_MAX ? -INFINITY
+                                        : 0;
+  }
+
+  switch (aggregate) {
+  case AGGREGATE_MIN:
+    return extreme(level, false, column, first, last);
+  case AGGREGATE_MAX:
+    return extreme(level, true, column, first, last);
+  case AGGREGATE_AVG: {
+    size_t count = column_count(column, first, last);
+    double sum = sum_dense(level, column->numbers + first, last - first);
+    return count ? sum / count : 0;
+  }
+  default:
+    return sum_dense(level, column->numbers + first, last - first);
+  }
+}
+
+double column_reduce(const Column *column, Aggregate aggregate, size_t first,
+                     size_t last) {
+  return column_reduce_at(scan_best_level(), column, aggregate, first, last);
+}
+
+double columns_aggregate(const Column *columns, size_t count,
+                         Aggregate aggregate, size_t first, size_t last) {
+  double result = aggregate == AGGREGATE_MIN   ? INFINITY
+                  : aggregate == AGGREGATE_MAX ? -INFINITY
+                                               : 0;
+  size_t numbers = 0;
+
+  for (size_t col = 0; col < count; ++col) {
+    size_t found = column_count(&columns[col], first, last);
+    if (found == 0) {
+      continue;
+    }
+    numbers += found;
+
+    if (aggregate == AGGREGATE_MIN || aggregate == AGGREGATE_MAX) {
+      double value = column_reduce(&columns[col], aggregate, first, last);
+      result = aggregate == AGGREGATE_MIN ? min_of(result, value)
+                                          : max_of(result, value);
+    } else {
+      result += column_reduce(&columns[col], AGGREGATE_SUM, first, last);
+    }
+  }
+
+  if (numbers == 0) {
+    return 0;
+  }
+  return aggregate == AGGREGATE_AVG ? result / numbers : result;
+}
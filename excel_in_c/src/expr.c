@@ -0,0 +1,1023 @@
+#define _POSIX_C_SOURCE 200809L // strncasecmp
+
+#include "expr.h"
+#include "number.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// ---------------------------------------------------------------------------
+// Parsing, by recursive descent:
+//   sum     = product (('+' | '-') product)*
+//   product = unary (('*' | '/') unary)*
+//   unary   = ('-' | '+') unary | primary
+//   primary = number | cell | call | '(' sum ')'
+//   call    = ('SUM' | 'MIN' | 'MAX' | 'AVG' | 'AVERAGE')
+//             '(' cell [':' cell] ')'
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  StringView source;  // the whole formula, for error messages
+  StringView rest;    // what's left to parse
+  Arena *arena;       // where the nodes go
+  bool failed;
+} Parser;
+
+// Reports the first error and drops the rest of the formula, so the parse
+// winds down without reading any more of it. The parse workers call this too,
+// so it can't exit.
+static void parse_error(Parser *parser, const char *message) {
+  if (!parser->failed) {
+    fprintf(stderr,
+            "ERROR: %s at \"" SV_Fmt "\" in formula \"" SV_Fmt "\"\n",
+            message, SV_Arg(parser->rest), SV_Arg(parser->source));
+  }
+  parser->failed = true;
+  parser->rest = sv_gen(parser->rest.data + parser->rest.count, 0);
+}
+
+static char peek(Parser *parser) {
+  parser->rest = sv_trim_left(parser->rest);
+  return parser->rest.count > 0 ? parser->rest.data[0] : '\0';
+}
+
+static void skip(Parser *parser, size_t count) {
+  if (parser->failed) {
+    return;  // There's nothing left to skip
+  }
+  parser->rest.data += count;
+  parser->rest.count -= count;
+}
+
+static Expr *expr_new(Parser *parser, Expr_Type type) {
+  Expr *expr = arena_alloc(parser->arena, sizeof(Expr));
+  expr->type = type;
+  return expr;
+}
+
+bool parse_cell_ref(StringView sv, Expr_Cell *cell) {
+  size_t i = 0;
+  size_t col = 0;
+  for (; i < sv.count && isalpha((unsigned char)sv.data[i]); ++i) {
+    col = col * 26 + (toupper((unsigned char)sv.data[i]) - 'A' + 1);
+    if (col > UINT32_MAX) {
+      return false;
+    }
+  }
+  if (i == 0 || i == sv.count) {
+    return false;
+  }
+
+  size_t row = 0;
+  for (; i < sv.count && isdigit((unsigned char)sv.data[i]); ++i) {
+    row = row * 10 + (sv.data[i] - '0');
+    if (row > UINT32_MAX) {
+      return false;
+    }
+  }
+  if (i < sv.count) {
+    return false;
+  }
+
+  cell->row = row;
+  cell->col = col - 1;
+  return true;
+}
+
+// Length of the run of characters at the start of `sv` that `accept` takes
+static size_t span(StringView sv, int (*accept)(int)) {
+  size_t count = 0;
+  while (count < sv.count && accept((unsigned char)sv.data[count])) {
+    count += 1;
+  }
+  return count;
+}
+
+static Expr *parse_sum(Parser *parser);
+
+static const struct {
+  const char *name;
+  Expr_Func func;
+} funcs[] = {
+    {"SUM", EXPR_FUNC_SUM}, {"MIN", EXPR_FUNC_MIN}, {"MAX", EXPR_FUNC_MAX},
+    {"AVG", EXPR_FUNC_AVG}, {"AVERAGE", EXPR_FUNC_AVG},
+};
+
+// A cell reference at the start of what's left to parse
+static Expr_Cell parse_ref(Parser *parser) {
+  peek(parser);
+  size_t letters = span(parser->rest, isalpha);
+  StringView rest = sv_gen(parser->rest.data + letters,
+                           parser->rest.count - letters);
+  StringView name = sv_gen(parser->rest.data, letters + span(rest, isdigit));
+
+  Expr_Cell cell = {0};
+  if (!parse_cell_ref(name, &cell)) {
+    parse_error(parser, "Invalid cell reference");
+  }
+  skip(parser, name.count);
+  return cell;
+}
+
+static Expr *parse_call(Parser *parser, StringView name) {
+  Expr *expr = expr_new(parser, EXPR_TYPE_FUNC);
+  size_t i = 0;
+  for (; i < sizeof(funcs) / sizeof(funcs[0]); ++i) {
+    size_t length = strlen(funcs[i].name);
+    if (name.count == length &&
+        strncasecmp(name.data, funcs[i].name, length) == 0) {
+      break;
+    }
+  }
+  if (i == sizeof(funcs) / sizeof(funcs[0])) {
+    parse_error(parser, "Unknown function");
+    return expr;
+  }
+  skip(parser, name.count);
+  peek(parser);
+  skip(parser, 1);  // '('
+
+  Expr_Call *call = &expr->value.call;
+  call->func = funcs[i].func;
+  call->from = parse_ref(parser);
+  call->to = call->from;
+  if (peek(parser) == ':') {
+    skip(parser, 1);
+    call->to = parse_ref(parser);
+  }
+  if (peek(parser) != ')') {
+    parse_error(parser, "Expected ')'");
+  }
+  skip(parser, 1);
+
+  // Either pair of opposite corners will do
+  Expr_Cell from = call->from;
+  Expr_Cell to = call->to;
+  call->from.row = from.row < to.row ? from.row : to.row;
+  call->from.col = from.col < to.col ? from.col : to.col;
+  call->to.row = from.row < to.row ? to.row : from.row;
+  call->to.col = from.col < to.col ? to.col : from.col;
+  return expr;
+}
+
+static Expr *parse_primary(Parser *parser) {
+  char c = peek(parser);
+
+  if (c == '(') {
+    skip(parser, 1);
+    Expr *expr = parse_sum(parser);
+    if (peek(parser) != ')') {
+      parse_error(parser, "Expected ')'");
+    }
+    skip(parser, 1);
+    return expr;
+  }
+
+  if (isalpha((unsigned char)c)) {
+    StringView name = sv_gen(parser->rest.data, span(parser->rest, isalpha));
+    StringView after = sv_trim_left(
+        sv_gen(name.data + name.count, parser->rest.count - name.count));
+    if (sv_starts_with(after, SV("("))) {
+      return parse_call(parser, name);
+    }
+
+    Expr *expr = expr_new(parser, EXPR_TYPE_CELL);
+    expr->value.cell = parse_ref(parser);
+    return expr;
+  }
+
+  if (isdigit((unsigned char)c) || c == '.') {
+    // The digits and point, then an exponent if one follows
+    const char *data = parser->rest.data;
+    size_t count = 0;
+    size_t end = parser->rest.count;
+    while (count < end && (isdigit((unsigned char)data[count]) ||
+                           data[count] == '.')) {
+      count += 1;
+    }
+    if (count < end && (data[count] | 0x20) == 'e') {
+      size_t digit = count + 1;
+      digit += digit < end && (data[digit] == '+' || data[digit] == '-');
+      if (digit < end && isdigit((unsigned char)data[digit])) {
+        for (count = digit; count < end && isdigit((unsigned char)data[count]);
+             ++count) {
+        }
+      }
+    }
+
+    Expr *expr = expr_new(parser, EXPR_TYPE_NUMBER);
+    if (!sv_parse_number(sv_gen(data, count), &expr->value.number)) {
+      parse_error(parser, "Invalid number");
+    }
+    skip(parser, count);
+    return expr;
+  }
+
+  parse_error(parser, c ? "Unexpected character" : "Unexpected end");
+  return expr_new(parser, EXPR_TYPE_NUMBER);  // Stands in, it's dropped
+}
+
+static Expr *parse_unary(Parser *parser) {
+  char c = peek(parser);
+  if (c != '-' && c != '+') {
+    return parse_primary(parser);
+  }
+
+  skip(parser, 1);
+  Expr *operand = parse_unary(parser);
+  if (c == '+') {
+    return operand;
+  }
+  if (operand->type == EXPR_TYPE_NUMBER) {
+    operand->value.number = -operand->value.number;
+    return operand;
+  }
+
+  Expr *expr = expr_new(parser, EXPR_TYPE_NEG);
+  expr->value.operand = operand;
+  return expr;
+}
+
+static Expr *binary(Parser *parser, Expr_Type type, Expr *lhs, Expr *rhs) {
+  Expr *expr = expr_new(parser, type);
+  expr->value.plus.lhs = lhs;
+  expr->value.plus.rhs = rhs;
+  return expr;
+}
+
+static Expr *parse_product(Parser *parser) {
+  Expr *lhs = parse_unary(parser);
+  for (char c = peek(parser); c == '*' || c == '/'; c = peek(parser)) {
+    skip(parser, 1);
+    Expr *rhs = parse_unary(parser);
+    lhs = binary(parser, c == '*' ? EXPR_TYPE_MULT : EXPR_TYPE_DIV, lhs,
+                 rhs);
+  }
+  return lhs;
+}
+
+static Expr *parse_sum(Parser *parser) {
+  Expr *lhs = parse_product(parser);
+  for (char c = peek(parser); c == '+' || c == '-'; c = peek(parser)) {
+    skip(parser, 1);
+    Expr *rhs = parse_product(parser);
+    lhs = binary(parser, c == '+' ? EXPR_TYPE_PLUS : EXPR_TYPE_MINUS, lhs,
+                 rhs);
+  }
+  return lhs;
+}
+
+Expr *parse_expr(StringView sv, Arena *arena) {
+  sv = sv_trim(sv);
+  if (sv_starts_with(sv, SV("="))) {
+    sv = sv_gen(sv.data + 1, sv.count - 1);
+  }
+
+  Parser parser = {sv, sv, arena, false};
+  Expr *expr = parse_sum(&parser);
+  if (peek(&parser) != '\0') {
+    parse_error(&parser, "Unexpected character");
+  }
+  return parser.failed ? NULL : expr;
+}
+
+// ---------------------------------------------------------------------------
+// Compiling: every formula is first compiled on its own, in the order of the
+// table. Its reads of other formulas, one by one or in a range, are the edges
+// of the dependency graph, which Kahn's algorithm puts in topological order:
+// a formula comes once all the formulas it reads came before it. Those that
+// never come are part of a cycle or read one. The final program is the code
+// of the others laid out in that order.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  size_t cell;   // index into Table.cells
+  size_t start;  // its code in the unordered program
+  size_t count;
+  Cell_Error error;
+  size_t level;  // 0 when it reads no formula, else 1 + the deepest it reads
+} Formula;
+
+static void *alloc_array(size_t count, size_t size) {
+  void *array = calloc(count + 1, size);
+  if (!array) {
+    fprintf(stderr, "ERROR: Failed to allocate %zu items for the program.\n",
+            count);
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+static void code_push(Program *program, Instr instr) {
+  if (program->count == program->capacity) {
+    size_t capacity = program->capacity ? program->capacity * 2 : 256;
+    Instr *code = realloc(program->code, sizeof(Instr) * capacity);
+    if (!code) {
+      fprintf(stderr,
+              "ERROR: Failed to grow the program to %zu instructions.\n",
+              capacity);
+      exit(EXIT_FAILURE);
+    }
+    program->code = code;
+    program->capacity = capacity;
+  }
+  program->code[program->count++] = instr;
+}
+
+static size_t range_push(Program *program, Range range) {
+  if (program->num_ranges == program->ranges_capacity) {
+    size_t capacity =
+        program->ranges_capacity ? program->ranges_capacity * 2 : 16;
+    Range *ranges = realloc(program->ranges, sizeof(Range) * capacity);
+    if (!ranges) {
+      fprintf(stderr, "ERROR: Failed to grow the program to %zu ranges.\n",
+              capacity);
+      exit(EXIT_FAILURE);
+    }
+    program->ranges = ranges;
+    program->ranges_capacity = capacity;
+  }
+  program->ranges[program->num_ranges] = range;
+  return program->num_ranges++;
+}
+
+// "B3" for the cell at index `cell`
+static const char *cell_name(const Table *table, size_t cell) {
+  static char name[32];
+  char letters[16];
+  size_t count = 0;
+  for (size_t col = cell % table->cols + 1; col > 0; col = (col - 1) / 26) {
+    letters[count++] = 'A' + (col - 1) % 26;
+  }
+
+  size_t i = 0;
+  while (count > 0) {
+    name[i++] = letters[--count];
+  }
+  snprintf(name + i, sizeof(name) - i, "%zu", cell / table->cols);
+  return name;
+}
+
+static Cell_Error emit(Program *program, const Table *table, const Expr *expr) {
+  Instr instr = {0};
+  Cell_Error error = CELL_ERROR_NONE;
+
+  switch (expr->type) {
+  case EXPR_TYPE_NUMBER:
+    instr.op = OP_NUMBER;
+    instr.arg.number = expr->value.number;
+    break;
+
+  case EXPR_TYPE_CELL: {
+    Expr_Cell ref = expr->value.cell;
+    if (ref.row >= table->rows || ref.col >= table->cols) {
+      return CELL_ERROR_REF;
+    }
+
+    size_t cell = ref.row * table->cols + ref.col;
+    const Cell *target = &table->cells[cell];
+    if (target->type == CELL_TYPE_NUMBER) {
+      instr.op = OP_NUMBER_CELL;
+      instr.arg.cell = cell;
+    } else if (target->type != CELL_TYPE_TEXT) {
+      instr.op = OP_FORMULA_CELL;
+      instr.arg.cell = cell;
+    } else if (target->value.text.count == 0) {
+      instr.op = OP_NUMBER;  // an empty cell counts as 0
+      instr.arg.number = 0;
+    } else {
+      return CELL_ERROR_VALUE;
+    }
+    break;
+  }
+
+  case EXPR_TYPE_FUNC: {
+    static const Aggregate aggregates[] = {
+        [EXPR_FUNC_SUM] = AGGREGATE_SUM,
+        [EXPR_FUNC_MIN] = AGGREGATE_MIN,
+        [EXPR_FUNC_MAX] = AGGREGATE_MAX,
+        [EXPR_FUNC_AVG] = AGGREGATE_AVG,
+    };
+    Expr_Call call = expr->value.call;
+    if (call.from.row >= table->rows || call.from.col >= table->cols) {
+      return CELL_ERROR_REF;
+    }
+
+    Range range = {aggregates[call.func], call.from.row, call.to.row + 1,
+                   call.from.col, call.to.col + 1};
+    range.last_row =
+        range.last_row < table->rows ? range.last_row : table->rows;
+    range.last_col =
+        range.last_col < table->cols ? range.last_col : table->cols;
+    instr.op = OP_AGGREGATE;
+    instr.arg.cell = range_push(program, range);
+    break;
+  }
+
+  case EXPR_TYPE_NEG:
+    error = emit(program, table, expr->value.operand);
+    instr.op = OP_NEG;
+    break;
+
+  default:
+    error = emit(program, table, expr->value.plus.lhs);
+    if (!error) {
+      error = emit(program, table, expr->value.plus.rhs);
+    }
+    instr.op = expr->type == EXPR_TYPE_PLUS    ? OP_ADD
+               : expr->type == EXPR_TYPE_MINUS ? OP_SUB
+               : expr->type == EXPR_TYPE_MULT  ? OP_MUL
+                                               : OP_DIV;
+    break;
+  }
+
+  if (!error) {
+    code_push(program, instr);
+  }
+  return error;
+}
+
+// The formulas are collected in the order of their cells, so this is a
+// binary search
+static size_t find_formula(const Formula *formulas, size_t count, size_t cell) {
+  size_t lo = 0;
+  size_t hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (formulas[mid].cell < cell) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// The formulas `formula` reads, into `reads` unless it's NULL, and how many
+// there are. A formula read twice is there twice.
+static size_t formula_reads(const Program *unordered, const Formula *formulas,
+                            size_t count, size_t cols, const Formula *formula,
+                            size_t *reads) {
+  const Instr *code = &unordered->code[formula->start];
+  size_t found = 0;
+
+  for (size_t pc = 0; pc < formula->count; ++pc) {
+    if (code[pc].op == OP_FORMULA_CELL) {
+      if (reads) {
+        reads[found] = find_formula(formulas, count, code[pc].arg.cell);
+      }
+      found += 1;
+    } else if (code[pc].op == OP_AGGREGATE) {
+      // The formulas in a row of the range are next to each other
+      const Range *range = &unordered->ranges[code[pc].arg.cell];
+      for (size_t row = range->first_row; row < range->last_row; ++row) {
+        size_t f =
+            find_formula(formulas, count, row * cols + range->first_col);
+        size_t end =
+            find_formula(formulas, count, row * cols + range->last_col);
+        for (; f < end; ++f) {
+          if (reads) {
+            reads[found] = f;
+          }
+          found += 1;
+        }
+      }
+    }
+  }
+  return found;
+}
+
+// Formula indices in topological order. Returns how many there are; the
+// formulas left out get CELL_ERROR_CYCLE. Formula f reads the formulas
+// reads[read_starts[f]..read_starts[f + 1]].
+static size_t order_formulas(Formula *formulas, size_t count,
+                             const size_t *read_starts, const size_t *reads,
+                             size_t *order) {
+  // For each formula, the formulas reading it:
+  // readers[reader_starts[f]..reader_starts[f + 1]]
+  size_t *reader_starts = alloc_array(count + 1, sizeof(size_t));
+  size_t *readers = alloc_array(read_starts[count], sizeof(size_t));
+  size_t *pending = alloc_array(count, sizeof(size_t));  // edges still in
+
+  for (size_t f = 0; f < count; ++f) {
+    for (size_t i = read_starts[f]; i < read_starts[f + 1]; ++i) {
+      reader_starts[reads[i] + 1] += 1;
+    }
+    pending[f] = read_starts[f + 1] - read_starts[f];
+  }
+  for (size_t f = 0; f < count; ++f) {
+    reader_starts[f + 1] += reader_starts[f];
+  }
+  size_t *fill = alloc_array(count, sizeof(size_t));
+  memcpy(fill, reader_starts, sizeof(size_t) * count);
+  for (size_t f = 0; f < count; ++f) {
+    for (size_t i = read_starts[f]; i < read_starts[f + 1]; ++i) {
+      readers[fill[reads[i]]++] = f;
+    }
+  }
+
+  // Formulas with nothing left to wait for are taken from a stack, so a
+  // formula tends to come right after what it reads rather than a whole
+  // level later, which keeps a row's formulas close together in the code
+  size_t *ready = alloc_array(count, sizeof(size_t));
+  size_t num_ready = 0;
+  for (size_t f = count; f-- > 0;) {
+    if (pending[f] == 0) {
+      ready[num_ready++] = f;
+    }
+  }
+  size_t ordered = 0;
+  while (num_ready > 0) {
+    size_t f = ready[--num_ready];
+    order[ordered++] = f;
+    for (size_t i = reader_starts[f + 1]; i-- > reader_starts[f];) {
+      if (--pending[readers[i]] == 0) {
+        ready[num_ready++] = readers[i];
+      }
+    }
+  }
+
+  for (size_t f = 0; f < count; ++f) {
+    if (pending[f] > 0) {
+      formulas[f].error = CELL_ERROR_CYCLE;
+    }
+  }
+
+  free(ready);
+  free(fill);
+  free(pending);
+  free(readers);
+  free(reader_starts);
+  return ordered;
+}
+
+// Slot of `cell` in the hash of read cells: where it is, or the empty slot
+// where it would go. Runs of 64 cells hash together and stay next to each
+// other, so the cells of a row land in the same few cache lines.
+static size_t read_slot(const size_t *keys, size_t capacity, size_t cell) {
+  size_t block = (size_t)(((cell >> 6) * 0x9E3779B97F4A7C15ull) >> 32);
+  size_t slot = ((block << 6) | (cell & 63)) & (capacity - 1);
+  while (keys[slot] != 0 && keys[slot] != cell + 1) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  return slot;
+}
+
+// The hash from read cells to their readers while it is built
+typedef struct {
+  size_t *keys;
+  size_t *counts;  // readers of the slot, then where they start
+  size_t *last;    // last reader + 1, then the next reader to fill in
+  size_t capacity;
+  size_t used;
+  size_t *readers;  // NULL while counting
+} Read_Index;
+
+static void read_index_grow(Read_Index *index) {
+  size_t capacity = index->capacity * 2;
+  size_t *keys = alloc_array(capacity, sizeof(size_t));
+  size_t *counts = alloc_array(capacity, sizeof(size_t));
+  size_t *last = alloc_array(capacity, sizeof(size_t));
+  for (size_t i = 0; i < index->capacity; ++i) {
+    if (index->keys[i] != 0) {
+      size_t to = read_slot(keys, capacity, index->keys[i] - 1);
+      keys[to] = index->keys[i];
+      counts[to] = index->counts[i];
+      last[to] = index->last[i];
+    }
+  }
+  free(index->keys);
+  free(index->counts);
+  free(index->last);
+  index->keys = keys;
+  index->counts = counts;
+  index->last = last;
+  index->capacity = capacity;
+}
+
+// Formula `f` reads `cell`: counts it while counting, fills it in after
+static void note_read(Read_Index *index, size_t cell, size_t f) {
+  size_t slot = read_slot(index->keys, index->capacity, cell);
+
+  if (index->readers) {
+    size_t next = index->last[slot];
+    if (next > index->counts[slot] && index->readers[next - 1] == f) {
+      return;
+    }
+    index->readers[index->last[slot]++] = f;
+    return;
+  }
+
+  if (index->keys[slot] == 0) {
+    index->keys[slot] = cell + 1;
+    index->used += 1;
+  }
+  if (index->last[slot] != f + 1) {
+    index->last[slot] = f + 1;  // a formula reading a cell twice counts once
+    index->counts[slot] += 1;
+  }
+  if (index->used * 2 > index->capacity) {
+    read_index_grow(index);
+  }
+}
+
+// Every cell formula `f` reads. Of a range, that's its numbers and formulas:
+// text can't change into a number without compiling again.
+static void note_reads(const Program *program, const Table *table, size_t f,
+                       Read_Index *index) {
+  for (size_t pc = program->starts[f]; pc < program->starts[f + 1]; ++pc) {
+    const Instr *instr = &program->code[pc];
+    if (instr->op == OP_NUMBER_CELL || instr->op == OP_FORMULA_CELL) {
+      note_read(index, instr->arg.cell, f);
+    } else if (instr->op == OP_AGGREGATE) {
+      const Range *range = &program->ranges[instr->arg.cell];
+      for (size_t row = range->first_row; row < range->last_row; ++row) {
+        for (size_t col = range->first_col; col < range->last_col; ++col) {
+          size_t cell = row * table->cols + col;
+          if (table->cells[cell].type != CELL_TYPE_TEXT) {
+            note_read(index, cell, f);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Hashes every cell some formula reads to the list of formulas reading it,
+// in two passes over the code: one counting the readers of each cell, one
+// filling them in
+static void index_readers(Program *program, const Table *table) {
+  Read_Index index = {0};
+  index.capacity = 64;
+  index.keys = alloc_array(index.capacity, sizeof(size_t));
+  index.counts = alloc_array(index.capacity, sizeof(size_t));
+  index.last = alloc_array(index.capacity, sizeof(size_t));
+
+  for (size_t f = 0; f < program->formulas; ++f) {
+    note_reads(program, table, f, &index);
+  }
+
+  size_t total = 0;
+  for (size_t slot = 0; slot < index.capacity; ++slot) {
+    size_t count = index.counts[slot];
+    index.counts[slot] = total;
+    total += count;
+  }
+  index.counts[index.capacity] = total;
+
+  index.readers = alloc_array(total, sizeof(size_t));
+  memcpy(index.last, index.counts, sizeof(size_t) * index.capacity);
+  for (size_t f = 0; f < program->formulas; ++f) {
+    note_reads(program, table, f, &index);
+  }
+
+  free(index.last);
+  program->read_cells = index.keys;
+  program->read_capacity = index.capacity;
+  program->reader_starts = index.counts;
+  program->readers = index.readers;
+}
+
+Program table_compile(Table *table) {
+  Program unordered = {0};
+  Formula *formulas = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+
+  for (size_t cell = 0; cell < table->rows * table->cols; ++cell) {
+    Cell *target = &table->cells[cell];
+    if (target->type != CELL_TYPE_EXPR && target->type != CELL_TYPE_ERROR) {
+      continue;
+    }
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      formulas = realloc(formulas, sizeof(Formula) * capacity);
+      if (!formulas) {
+        fprintf(stderr, "ERROR: Failed to allocate %zu formulas.\n", capacity);
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    // Errors are found again from scratch, the sheet may have been fixed
+    target->type = CELL_TYPE_EXPR;
+    Formula *formula = &formulas[count++];
+    formula->cell = cell;
+    formula->level = 0;
+    formula->start = unordered.count;
+    const Expr *ast = target->value.formula.ast;
+    formula->error = ast ? emit(&unordered, table, ast) : CELL_ERROR_VALUE;
+    if (formula->error) {
+      unordered.count = formula->start;
+    }
+    formula->count = unordered.count - formula->start;
+  }
+
+  size_t *read_starts = alloc_array(count + 1, sizeof(size_t));
+  for (size_t f = 0; f < count; ++f) {
+    read_starts[f + 1] = read_starts[f] +
+        formula_reads(&unordered, formulas, count, table->cols, &formulas[f],
+                      NULL);
+  }
+  size_t *reads = alloc_array(read_starts[count], sizeof(size_t));
+  for (size_t f = 0; f < count; ++f) {
+    formula_reads(&unordered, formulas, count, table->cols, &formulas[f],
+                  reads + read_starts[f]);
+  }
+
+  size_t *order = alloc_array(count, sizeof(size_t));
+  size_t ordered = order_formulas(formulas, count, read_starts, reads, order);
+
+  // The columns some range reads
+  uint8_t *mirrored = alloc_array(table->cols, sizeof(uint8_t));
+  for (size_t r = 0; r < unordered.num_ranges; ++r) {
+    const Range *range = &unordered.ranges[r];
+    memset(mirrored + range->first_col, 1, range->last_col - range->first_col);
+  }
+
+  Program program = {0};
+  program.ranges = unordered.ranges;
+  program.num_ranges = unordered.num_ranges;
+  program.ranges_capacity = unordered.ranges_capacity;
+  program.cells = alloc_array(ordered, sizeof(size_t));
+  program.starts = alloc_array(ordered + 1, sizeof(size_t));
+  for (size_t i = 0; i < ordered; ++i) {
+    Formula *formula = &formulas[order[i]];
+    const Instr *code = &unordered.code[formula->start];
+
+    // Reading an error is an error, and what's read was ordered before
+    size_t f = order[i];
+    for (size_t j = read_starts[f]; j < read_starts[f + 1] && !formula->error;
+         ++j) {
+      const Formula *read = &formulas[reads[j]];
+      formula->error = read->error;
+      formula->level =
+          read->level + 1 > formula->level ? read->level + 1 : formula->level;
+    }
+    if (formula->error) {
+      continue;
+    }
+
+    size_t depth = 0;
+    program.cells[program.formulas] = formula->cell;
+    program.starts[program.formulas] = program.count;
+    program.formulas += 1;
+    for (size_t pc = 0; pc < formula->count; ++pc) {
+      if (code[pc].op <= OP_AGGREGATE) {
+        depth += 1;
+      } else if (code[pc].op != OP_NEG) {
+        depth -= 1;
+      }
+      if (depth > EVAL_STACK) {
+        fprintf(stderr, "ERROR: Formula in %s is nested too deeply\n",
+                cell_name(table, formula->cell));
+        exit(EXIT_FAILURE);
+      }
+      code_push(&program, code[pc]);
+    }
+    Op_Code store =
+        mirrored[formula->cell % table->cols] ? OP_STORE_COLUMN : OP_STORE;
+    code_push(&program, (Instr){store, {.cell = formula->cell}});
+  }
+  program.starts[program.formulas] = program.count;
+
+  for (size_t f = 0; f < count; ++f) {
+    if (formulas[f].error) {
+      Cell *cell = &table->cells[formulas[f].cell];
+      cell->type = CELL_TYPE_ERROR;
+      cell->value.formula.error = formulas[f].error;
+    }
+  }
+
+  if (program.num_ranges > 0) {
+    program.columns.rows = table->rows;
+    program.columns.cols = table->cols;
+    program.columns.columns = alloc_array(table->cols, sizeof(Column));
+    for (size_t col = 0; col < table->cols; ++col) {
+      if (mirrored[col]) {
+        column_load(&program.columns.columns[col], table, col);
+      }
+    }
+  }
+
+  // The formulas of each level, by counting sort. `order` keeps only the
+  // compiled formulas, so its i-th is formula i of the program.
+  size_t compiled = 0;
+  for (size_t i = 0; i < ordered; ++i) {
+    if (!formulas[order[i]].error) {
+      order[compiled++] = order[i];
+      size_t level = formulas[order[i]].level;
+      program.levels = level + 1 > program.levels ? level + 1 : program.levels;
+    }
+  }
+  program.level_starts = alloc_array(program.levels + 1, sizeof(size_t));
+  program.by_level = alloc_array(program.formulas, sizeof(size_t));
+  for (size_t i = 0; i < program.formulas; ++i) {
+    program.level_starts[formulas[order[i]].level + 1] += 1;
+  }
+  for (size_t level = 0; level < program.levels; ++level) {
+    program.level_starts[level + 1] += program.level_starts[level];
+  }
+  size_t *fill = alloc_array(program.levels, sizeof(size_t));
+  memcpy(fill, program.level_starts, sizeof(size_t) * program.levels);
+  for (size_t i = 0; i < program.formulas; ++i) {
+    program.by_level[fill[formulas[order[i]].level]++] = i;
+  }
+  free(fill);
+
+  index_readers(&program, table);
+  program.dirty = alloc_array(program.formulas, sizeof(uint8_t));
+  program.pending = alloc_array(program.formulas, sizeof(size_t));
+
+  free(mirrored);
+  free(reads);
+  free(read_starts);
+  free(order);
+  free(formulas);
+  free(unordered.code);
+  return program;
+}
+
+// ---------------------------------------------------------------------------
+// Evaluating
+// ---------------------------------------------------------------------------
+
+static void run_code(const Program *program, const Instr *code,
+                     const Instr *end, Cell *cells) {
+  double stack[EVAL_STACK];
+  size_t top = 0;
+  const Range *range;
+
+  for (const Instr *instr = code; instr < end; ++instr) {
+    switch (instr->op) {
+    case OP_NUMBER:
+      stack[top++] = instr->arg.number;
+      break;
+    case OP_NUMBER_CELL:
+      stack[top++] = cells[instr->arg.cell].value.number;
+      break;
+    case OP_FORMULA_CELL:
+      stack[top++] = cells[instr->arg.cell].value.formula.value;
+      break;
+    case OP_AGGREGATE:
+      range = &program->ranges[instr->arg.cell];
+      stack[top++] = columns_aggregate(
+          program->columns.columns + range->first_col,
+          range->last_col - range->first_col, range->aggregate,
+          range->first_row, range->last_row);
+      break;
+    case OP_ADD:
+      top -= 1;
+      stack[top - 1] += stack[top];
+      break;
+    case OP_SUB:
+      top -= 1;
+      stack[top - 1] -= stack[top];
+      break;
+    case OP_MUL:
+      top -= 1;
+      stack[top - 1] *= stack[top];
+      break;
+    case OP_DIV:
+      top -= 1;
+      stack[top - 1] /= stack[top];
+      break;
+    case OP_NEG:
+      stack[top - 1] = -stack[top - 1];
+      break;
+    case OP_STORE:
+      cells[instr->arg.cell].value.formula.value = stack[--top];
+      break;
+    case OP_STORE_COLUMN: {
+      size_t cell = instr->arg.cell;
+      size_t cols = program->columns.cols;
+      cells[cell].value.formula.value = stack[--top];
+      program->columns.columns[cell % cols].numbers[cell / cols] = stack[top];
+      break;
+    }
+    }
+  }
+}
+
+void program_run(const Program *program, Table *table) {
+  run_code(program, program->code, program->code + program->count,
+           table->cells);
+}
+
+typedef struct {
+  const Program *program;
+  Cell *cells;
+  const size_t *formulas;  // the level being evaluated
+  size_t count;
+} Level_Job;
+
+static void run_level_chunk(void *arg, size_t index) {
+  const Level_Job *job = arg;
+  const Program *program = job->program;
+  size_t end = (index + 1) * LEVEL_CHUNK;
+  end = end < job->count ? end : job->count;
+
+  for (size_t i = index * LEVEL_CHUNK; i < end; ++i) {
+    size_t f = job->formulas[i];
+    run_code(program, program->code + program->starts[f],
+             program->code + program->starts[f + 1], job->cells);
+  }
+}
+
+void program_run_parallel(const Program *program, Table *table,
+                          Thread_Pool *pool) {
+  // With no level worth more than one task, the threads would only add a
+  // dispatch and a barrier per level
+  size_t widest = 0;
+  for (size_t level = 0; level < program->levels; ++level) {
+    size_t width = program->level_starts[level + 1] -
+                   program->level_starts[level];
+    widest = width > widest ? width : widest;
+  }
+  if (!pool || thread_pool_size(pool) == 1 || widest <= LEVEL_CHUNK) {
+    program_run(program, table);
+    return;
+  }
+
+  for (size_t level = 0; level < program->levels; ++level) {
+    size_t start = program->level_starts[level];
+    Level_Job job = {program, table->cells, program->by_level + start,
+                     program->level_starts[level + 1] - start};
+    size_t chunks = (job.count + LEVEL_CHUNK - 1) / LEVEL_CHUNK;
+    thread_pool_run(pool, run_level_chunk, &job, chunks);
+  }
+}
+
+static int compare_sizes(const void *a, const void *b) {
+  size_t x = *(const size_t *)a;
+  size_t y = *(const size_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Queues the formulas reading `cell` that aren't queued yet
+static size_t queue_readers(Program *program, size_t cell, size_t queued) {
+  size_t slot = read_slot(program->read_cells, program->read_capacity, cell);
+  if (program->read_cells[slot] == 0) {
+    return queued;
+  }
+
+  for (size_t i = program->reader_starts[slot];
+       i < program->reader_starts[slot + 1]; ++i) {
+    size_t reader = program->readers[i];
+    if (!program->dirty[reader]) {
+      program->dirty[reader] = 1;
+      program->pending[queued++] = reader;
+    }
+  }
+  return queued;
+}
+
+bool program_set_number(Program *program, Table *table, size_t row, size_t col,
+                        double number) {
+  if (row >= table->rows || col >= table->cols) {
+    return false;
+  }
+  size_t cell = row * table->cols + col;
+  if (table->cells[cell].type != CELL_TYPE_NUMBER) {
+    return false;
+  }
+  table->cells[cell].value.number = number;
+  if (program->columns.columns && program->columns.columns[col].numbers) {
+    program->columns.columns[col].numbers[row] = number;
+  }
+
+  size_t queued = queue_readers(program, cell, 0);
+  for (size_t i = 0; i < queued; ++i) {
+    queued =
+        queue_readers(program, program->cells[program->pending[i]], queued);
+  }
+
+  // Formulas are numbered in topological order
+  qsort(program->pending, queued, sizeof(size_t), compare_sizes);
+  for (size_t i = 0; i < queued; ++i) {
+    size_t f = program->pending[i];
+    run_code(program, program->code + program->starts[f],
+             program->code + program->starts[f + 1], table->cells);
+    program->dirty[f] = 0;
+  }
+  return true;
+}
+
+void program_free(Program *program) {
+  free(program->code);
+  free(program->cells);
+  free(program->starts);
+  free(program->read_cells);
+  free(program->reader_starts);
+  free(program->readers);
+  free(program->level_starts);
+  free(program->by_level);
+  free(program->dirty);
+  free(program->pending);
+  free(program->ranges);
+  columns_free(&program->columns);
+  memset(program, 0, sizeof(*program));
+}
@@ -0,0 +1,66 @@
+#define _POSIX_C_SOURCE 200809L // mmap, posix_madvise, sysconf
+#define _DEFAULT_SOURCE         // madvise, posix_madvise ignores DONTNEED
+
+#include "file_map.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool map_file(const char *file_path, Mapped_File *file) {
+  struct stat st;
+  void *mapping = NULL;
+
+  int fd = open(file_path, O_RDONLY);
+  if (fd < 0) {
+    goto error;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    goto error;
+  }
+
+  // mmap() refuses empty mappings, an empty file is just empty content
+  if (st.st_size > 0) {
+    mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      goto error;
+    }
+    // We read it front to back, once
+    posix_madvise(mapping, st.st_size, POSIX_MADV_SEQUENTIAL);
+  }
+
+  close(fd);
+
+  file->mapping = mapping;
+  file->mapping_size = st.st_size;
+  file->content = sv_gen(mapping, st.st_size);
+  return true;
+
+error:
+  if (fd >= 0) {
+    close(fd);
+  }
+
+  return false;
+}
+
+void unmap_file(Mapped_File *file) {
+  if (file->mapping) {
+    munmap(file->mapping, file->mapping_size);
+  }
+
+  file->mapping = NULL;
+  file->mapping_size = 0;
+  file->content = sv_gen(NULL, 0);
+}
+
+void drop_file_pages(Mapped_File *file, const char *begin, const char *end) {
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t first = ((uintptr_t)begin + page - 1) / page * page;
+  uintptr_t last = (uintptr_t)end / page * page;
+  if (file->mapping && first < last) {
+    madvise((void *)first, last - first, MADV_DONTNEED);
+  }
+}
@@ -0,0 +1,107 @@
+#include "intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Eight bytes at a time, each word mixed in with a multiply
+static uint64_t hash_text(StringView text) {
+  uint64_t hash = text.count * 0x9E3779B97F4A7C15ull;
+  size_t i = 0;
+  for (; i + 8 <= text.count; i += 8) {
+    uint64_t word;
+    memcpy(&word, text.data + i, 8);
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 32;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, text.data + i, text.count - i);
+  hash = (hash ^ tail) * 0xFF51AFD7ED558CCDull;
+  return hash ^ hash >> 29;
+}
+
+static void *pool_realloc(void *array, size_t count, size_t size) {
+  array = realloc(array, count * size);
+  if (!array) {
+    fprintf(stderr, "ERROR: Failed to grow the text pool to %zu items.\n",
+            count);
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+// The slot of `text`, or the empty one it would go in
+static size_t find_slot(const Intern_Pool *pool, StringView text,
+                        uint64_t hash) {
+  size_t slot = hash & (pool->num_slots - 1);
+  while (pool->slots[slot] != 0) {
+    uint32_t id = pool->slots[slot] - 1;
+    if (pool->hashes[id] == hash && sv_eq(pool->texts[id], text)) {
+      break;
+    }
+    slot = (slot + 1) & (pool->num_slots - 1);
+  }
+  return slot;
+}
+
+static void grow_slots(Intern_Pool *pool) {
+  free(pool->slots);
+  pool->num_slots = pool->num_slots ? pool->num_slots * 2 : 1024;
+  pool->slots = calloc(pool->num_slots, sizeof(uint32_t));
+  if (!pool->slots) {
+    fprintf(stderr, "ERROR: Failed to grow the text pool to %zu slots.\n",
+            pool->num_slots);
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t id = 1; id < pool->count; ++id) {
+    size_t slot = pool->hashes[id] & (pool->num_slots - 1);
+    while (pool->slots[slot] != 0) {
+      slot = (slot + 1) & (pool->num_slots - 1);
+    }
+    pool->slots[slot] = id + 1;
+  }
+}
+
+uint32_t intern(Intern_Pool *pool, Arena *arena, StringView text) {
+  // Id 0 is the empty text, there before anything is looked up
+  if (pool->count == 0) {
+    pool->capacity = 256;
+    pool->texts = pool_realloc(NULL, pool->capacity, sizeof(StringView));
+    pool->hashes = pool_realloc(NULL, pool->capacity, sizeof(uint64_t));
+    pool->texts[0] = sv_gen("", 0);
+    pool->hashes[0] = hash_text(pool->texts[0]);
+    pool->count = 1;
+    grow_slots(pool);
+  }
+  if (text.count == 0) {
+    return 0;
+  }
+
+  uint64_t hash = hash_text(text);
+  size_t slot = find_slot(pool, text, hash);
+  if (pool->slots[slot] != 0) {
+    return pool->slots[slot] - 1;
+  }
+
+  if (pool->count == pool->capacity) {
+    pool->capacity *= 2;
+    pool->texts = pool_realloc(pool->texts, pool->capacity, sizeof(StringView));
+    pool->hashes = pool_realloc(pool->hashes, pool->capacity, sizeof(uint64_t));
+  }
+  uint32_t id = pool->count++;
+  pool->texts[id] = sv_gen(arena_copy(arena, text.data, text.count), text.count);
+  pool->hashes[id] = hash;
+  pool->slots[slot] = id + 1;
+
+  if (pool->count * 2 > pool->num_slots) {
+    grow_slots(pool);
+  }
+  return id;
+}
+
+void intern_pool_free(Intern_Pool *pool) {
+  free(pool->texts);
+  free(pool->hashes);
+  free(pool->slots);
+  memset(pool, 0, sizeof(*pool));
+}
@@ -0,0 +1,141 @@
+#include "number.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FAST_DIGITS 19                // digits that always fit in a uint64_t
+#define FAST_MANTISSA ((uint64_t)1 << 53)  // integers a double holds exactly
+#define FAST_POWER 22                 // 10^22 is the largest exact double
+#define SLOW_BUFFER 64                // bytes strtod() gets on the stack
+
+static const double powers_of_ten[FAST_POWER + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// A NUL-terminated copy for strtod(), on the heap when it's too long for the
+// stack rather than cut short
+static bool parse_slow(StringView sv, double *number) {
+  char buffer[SLOW_BUFFER];
+  char *copy = buffer;
+  if (sv.count >= SLOW_BUFFER) {
+    copy = malloc(sv.count + 1);
+    if (!copy) {
+      fprintf(stderr, "ERROR: Failed to allocate a cell of %zu bytes.\n",
+              sv.count);
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(copy, sv.data, sv.count);
+  copy[sv.count] = '\0';
+
+  char *end;
+  *number = strtod(copy, &end);
+  bool whole = end != copy && *end == '\0';
+  if (copy != buffer) {
+    free(copy);
+  }
+  return whole;
+}
+
+// [+-] digits [. digits] [(e|E) [+-] digits], with a digit somewhere before
+// the exponent, is all strtod() reads in decimal. When such a number has a
+// mantissa under 2^53 and a power of ten up to 22, both are exact doubles and
+// one multiplication or division rounds the result correctly (Clinger's fast
+// path).
+bool sv_parse_number(StringView sv, double *number) {
+  const char *p = sv.data;
+  const char *end = sv.data + sv.count;
+
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-')) {
+    negative = *p++ == '-';
+  }
+  if (p == end) {
+    return false;
+  }
+  if (!is_digit(*p) && *p != '.') {
+    // Text, unless it's inf or nan or starts with the spaces strtod() skips
+    char c = *p | 0x20;
+    return (c == 'i' || c == 'n' || isspace((unsigned char)*p)) &&
+           parse_slow(sv, number);
+  }
+  if (*p == '0' && p + 1 < end && (p[1] | 0x20) == 'x') {
+    return parse_slow(sv, number);
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;  // significant ones, leading zeros aren't
+  int exponent = 0;
+  bool any = false;
+  for (; p < end && is_digit(*p); ++p) {
+    any = true;
+    if (digits > 0 || *p != '0') {
+      digits += 1;
+      mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+    }
+    if (digits > FAST_DIGITS) {
+      return parse_slow(sv, number);
+    }
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && is_digit(*p); ++p) {
+      any = true;
+      if (digits > 0 || *p != '0') {
+        digits += 1;
+        mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+      }
+      if (digits > FAST_DIGITS) {
+        return parse_slow(sv, number);
+      }
+      exponent -= 1;
+    }
+  }
+  if (!any) {
+    return false;
+  }
+
+  if (p < end && (*p | 0x20) == 'e') {
+    const char *q = p + 1;
+    bool negative_exponent = false;
+    if (q < end && (*q == '+' || *q == '-')) {
+      negative_exponent = *q++ == '-';
+    }
+    if (q == end || !is_digit(*q)) {
+      return false;  // strtod() stops before the 'e', so the rest is text
+    }
+    int written = 0;
+    for (; q < end && is_digit(*q); ++q) {
+      if (written > 100000) {
+        return parse_slow(sv, number);
+      }
+      written = written * 10 + (*q - '0');
+    }
+    exponent += negative_exponent ? -written : written;
+    p = q;
+  }
+  if (p != end) {
+    return false;
+  }
+
+  if (mantissa == 0) {
+    *number = negative ? -0.0 : 0.0;
+    return true;
+  }
+  if (mantissa > FAST_MANTISSA || exponent < -FAST_POWER ||
+      exponent > FAST_POWER) {
+    return parse_slow(sv, number);
+  }
+
+  double value = (double)mantissa;
+  value = exponent < 0 ? value / powers_of_ten[-exponent]
+                       : value * powers_of_ten[exponent];
+  *number = negative ? -value : value;
+  return true;
+}
@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L // write
+
+#include "output.h"
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUMBER_MAX 32  // longest "%.15g"
+
+Output output_open(int fd) {
+  Output output = {0};
+  output.fd = fd;
+  output.buffer = malloc(OUTPUT_BUFFER);
+  if (!output.buffer) {
+    fprintf(stderr, "ERROR: Failed to allocate the output buffer.\n");
+    exit(EXIT_FAILURE);
+  }
+  return output;
+}
+
+static void write_all(int fd, const char *data, size_t count) {
+  while (count > 0) {
+    ssize_t written = write(fd, data, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "ERROR: Could not write the output: %s\n",
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    data += written;
+    count -= written;
+  }
+}
+
+void output_flush(Output *output) {
+  write_all(output->fd, output->buffer, output->count);
+  output->count = 0;
+}
+
+static void output_bytes(Output *output, const char *data, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  if (output->count + count > OUTPUT_BUFFER) {
+    output_flush(output);
+  }
+  if (count > OUTPUT_BUFFER) {
+    write_all(output->fd, data, count);  // too long to be worth buffering
+    return;
+  }
+  memcpy(output->buffer + output->count, data, count);
+  output->count += count;
+}
+
+// Integers, what most cells hold, are written digit by digit; "%.15g" writes
+// those below 10^15 the same way
+static size_t format_number(char *out, double number) {
+  if (number > -1e15 && number < 1e15 && number == (double)(int64_t)number &&
+      !(number == 0 && signbit(number))) {
+    char digits[NUMBER_MAX];
+    size_t count = 0;
+    uint64_t value = number < 0 ? (uint64_t)-(int64_t)number : (uint64_t)number;
+    do {
+      digits[count++] = '0' + value % 10;
+      value /= 10;
+    } while (value > 0);
+
+    size_t length = 0;
+    if (number < 0) {
+      out[length++] = '-';
+    }
+    while (count > 0) {
+      out[length++] = digits[--count];
+    }
+    return length;
+  }
+  return snprintf(out, NUMBER_MAX, "%.15g", number);
+}
+
+static void output_number(Output *output, double number) {
+  if (output->count + NUMBER_MAX > OUTPUT_BUFFER) {
+    output_flush(output);
+  }
+  output->count += format_number(output->buffer + output->count, number);
+}
+
+void output_row(Output *output, const Table *table, size_t row) {
+  for (size_t col = 0; col < table->cols; ++col) {
+    const Cell *cell = &table->cells[row * table->cols + col];
+    if (col > 0) {
+      output_bytes(output, "|", 1);
+    }
+
+    const char *error;
+    switch (cell->type) {
+    case CELL_TYPE_TEXT:
+      output_bytes(output, cell->value.text.data, cell->value.text.count);
+      break;
+    case CELL_TYPE_NUMBER:
+      output_number(output, cell->value.number);
+      break;
+    case CELL_TYPE_EXPR:
+      output_number(output, cell->value.formula.value);
+      break;
+    case CELL_TYPE_ERROR:
+      error = cell_error_str(cell->value.formula.error);
+      output_bytes(output, error, strlen(error));
+      break;
+    }
+  }
+  output_bytes(output, "\n", 1);
+}
+
+void output_table(Output *output, const Table *table) {
+  for (size_t row = 0; row < table->rows; ++row) {
+    output_row(output, table, row);
+  }
+}
+
+void output_close(Output *output) {
+  output_flush(output);
+  free(output->buffer);
+  output->buffer = NULL;
+}
@@ -0,0 +1,113 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+static size_t scan_scalar(const char *data, size_t begin, size_t count,
+                          uint32_t *positions, size_t found) {
+  for (size_t i = begin; i < count; ++i) {
+    if (data[i] == '|' || data[i] == '\n') {
+      positions[found++] = i;
+    }
+  }
+  return found;
+}
+
+#if SCAN_X86
+
+// `mask` has one bit per byte from `base` on, set where a delimiter is.
+// Peeling off the lowest bit per iteration keeps the loop as long as the
+// number of delimiters rather than the number of bytes.
+#define SCAN_EMIT(mask, base)                          \
+  while (mask) {                                       \
+    positions[found++] = (base) + __builtin_ctz(mask); \
+    mask &= mask - 1;                                  \
+  }
+
+__attribute__((target("sse2")))
+static size_t scan_sse2(const char *data, size_t count, uint32_t *positions) {
+  const __m128i pipe = _mm_set1_epi8('|');
+  const __m128i newline = _mm_set1_epi8('\n');
+  size_t found = 0;
+  size_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(bytes, pipe),
+                                _mm_cmpeq_epi8(bytes, newline));
+    unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+    SCAN_EMIT(mask, i);
+  }
+
+  return scan_scalar(data, i, count, positions, found);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *data, size_t count, uint32_t *positions) {
+  const __m256i pipe = _mm256_set1_epi8('|');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  size_t found = 0;
+  size_t i = 0;
+
+  for (; i + 32 <= count; i += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, pipe),
+                                   _mm256_cmpeq_epi8(bytes, newline));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+    SCAN_EMIT(mask, i);
+  }
+
+  return scan_scalar(data, i, count, positions, found);
+}
+
+#endif
+
+Scan_Level scan_best_level(void) {
+#if SCAN_X86
+  if (__builtin_cpu_supports("avx2")) {
+    return SCAN_AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return SCAN_SSE2;
+  }
+#endif
+  return SCAN_SCALAR;
+}
+
+const char *scan_level_name(Scan_Level level) {
+  switch (level) {
+  case SCAN_AVX2:
+    return "avx2";
+  case SCAN_SSE2:
+    return "sse2";
+  default:
+    return "scalar";
+  }
+}
+
+size_t scan_delims_at(Scan_Level level, const char *data, size_t count,
+                      uint32_t *positions) {
+  // Never run an instruction set the CPU doesn't have, whatever was asked for
+  if (level > scan_best_level()) {
+    level = scan_best_level();
+  }
+
+  switch (level) {
+#if SCAN_X86
+  case SCAN_AVX2:
+    return scan_avx2(data, count, positions);
+  case SCAN_SSE2:
+    return scan_sse2(data, count, positions);
+#endif
+  default:
+    return scan_scalar(data, 0, count, positions, 0);
+  }
+}
+
+size_t scan_delims(const char *data, size_t count, uint32_t *positions) {
+  return scan_delims_at(scan_best_level(), data, count, positions);
+}
@@ -12,11 +12,9 @@ StringView sv_gen(const char* data, size_t count) {
 }
 
 StringView sv_split_by_delim(StringView* sv, char delim) {
-  size_t delim_pos = 0;
-  
-  while (delim_pos < sv->count && sv->data[delim_pos] != delim) {
-    delim_pos += 1;
-  }
+  // memchr() compares a vector of bytes at a time
+  const char *found = sv->count > 0 ? memchr(sv->data, delim, sv->count) : NULL;
+  size_t delim_pos = found ? (size_t)(found - sv->data) : sv->count;
 
   StringView result = sv_gen(sv->data, delim_pos);
 
@@ -0,0 +1,339 @@
+#include "stream.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "column.h"
+#include "table.h"
+
+#define STREAM_SCAN (16 << 20)  // bytes scanned at a time for the columns
+
+typedef struct {
+  size_t rows;
+  const char *data;  // where its rows start in the file
+  Arena arena;       // the formulas of its rows
+} Block;
+
+typedef struct {
+  Table table;   // the rows of the window, every column of the sheet
+  size_t base;   // row of the sheet in table row 0
+  size_t row;    // row of the sheet being evaluated
+
+  Block *blocks;  // the blocks in the window, oldest first
+  size_t num_blocks;
+  size_t blocks_capacity;
+
+  // A range read into columns, as Program.columns has it
+  Column *scratch;
+  size_t scratch_rows;
+} Stream;
+
+static void *stream_alloc(size_t count, size_t size) {
+  void *array = calloc(count ? count : 1, size);
+  if (!array) {
+    fprintf(stderr, "ERROR: Failed to allocate %zu items for the stream.\n",
+            count);
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+// The cell at `row` of the sheet, or an error if it can't be read from the
+// row being evaluated
+static const Cell *stream_cell(const Stream *stream, size_t row, size_t col) {
+  if (row >= stream->row) {
+    fprintf(stderr,
+            "ERROR: Formula in row %zu reads row %zu, streaming needs formulas "
+            "to read rows above their own only\n",
+            stream->row, row);
+    exit(EXIT_FAILURE);
+  }
+  if (row < stream->base) {
+    fprintf(stderr,
+            "ERROR: Formula in row %zu reads row %zu, further back than the "
+            "streaming window\n",
+            stream->row, row);
+    exit(EXIT_FAILURE);
+  }
+  return &stream->table.cells[(row - stream->base) * stream->table.cols + col];
+}
+
+// The error table_compile() finds in `expr` before evaluating anything:
+// references outside of the sheet and to text
+static Cell_Error check(const Stream *stream, const Expr *expr) {
+  switch (expr->type) {
+  case EXPR_TYPE_NUMBER:
+    return CELL_ERROR_NONE;
+
+  case EXPR_TYPE_CELL: {
+    Expr_Cell ref = expr->value.cell;
+    if (ref.col >= stream->table.cols) {
+      return CELL_ERROR_REF;
+    }
+    const Cell *cell = stream_cell(stream, ref.row, ref.col);
+    if (cell->type == CELL_TYPE_TEXT && cell->value.text.count > 0) {
+      return CELL_ERROR_VALUE;
+    }
+    return CELL_ERROR_NONE;
+  }
+
+  case EXPR_TYPE_FUNC: {
+    Expr_Call call = expr->value.call;
+    if (call.from.col >= stream->table.cols) {
+      return CELL_ERROR_REF;
+    }
+    stream_cell(stream, call.to.row, call.from.col);
+    stream_cell(stream, call.from.row, call.from.col);
+    return CELL_ERROR_NONE;
+  }
+
+  case EXPR_TYPE_NEG:
+    return check(stream, expr->value.operand);
+
+  default: {
+    Cell_Error error = check(stream, expr->value.plus.lhs);
+    return error ? error : check(stream, expr->value.plus.rhs);
+  }
+  }
+}
+
+static Cell_Error evaluate(Stream *stream, const Expr *expr, double *value);
+
+static Cell_Error evaluate_call(Stream *stream, const Expr_Call *call,
+                                double *value) {
+  static const Aggregate aggregates[] = {
+      [EXPR_FUNC_SUM] = AGGREGATE_SUM,
+      [EXPR_FUNC_MIN] = AGGREGATE_MIN,
+      [EXPR_FUNC_MAX] = AGGREGATE_MAX,
+      [EXPR_FUNC_AVG] = AGGREGATE_AVG,
+  };
+  size_t last_col = call->to.col + 1 < stream->table.cols
+                        ? call->to.col + 1
+                        : stream->table.cols;
+  size_t cols = last_col - call->from.col;
+  size_t rows = call->to.row + 1 - call->from.row;
+
+  if (rows > stream->scratch_rows) {
+    for (size_t col = 0; col < stream->table.cols; ++col) {
+      free(stream->scratch[col].numeric);
+      free(stream->scratch[col].numbers);
+      stream->scratch[col].numeric = stream_alloc((rows + 63) / 64,
+                                                  sizeof(uint64_t));
+      stream->scratch[col].numbers = stream_alloc(rows, sizeof(double));
+    }
+    stream->scratch_rows = rows;
+  }
+
+  // Row by row, so the error read is the first one, as in the compiled code
+  for (size_t col = 0; col < cols; ++col) {
+    memset(stream->scratch[col].numeric, 0,
+           sizeof(uint64_t) * ((rows + 63) / 64));
+  }
+  for (size_t row = 0; row < rows; ++row) {
+    for (size_t col = 0; col < cols; ++col) {
+      Column *column = &stream->scratch[col];
+      const Cell *cell =
+          stream_cell(stream, call->from.row + row, call->from.col + col);
+      column->numbers[row] = 0;
+      if (cell->type == CELL_TYPE_ERROR) {
+        return cell->value.formula.error;
+      }
+      if (cell->type == CELL_TYPE_NUMBER || cell->type == CELL_TYPE_EXPR) {
+        column->numbers[row] = cell->type == CELL_TYPE_NUMBER
+                                   ? cell->value.number
+                                   : cell->value.formula.value;
+        column->numeric[row / 64] |= (uint64_t)1 << (row % 64);
+      }
+    }
+  }
+
+  *value = columns_aggregate(stream->scratch, cols, aggregates[call->func], 0,
+                             rows);
+  return CELL_ERROR_NONE;
+}
+
+// The value of `expr`, in the order the compiled code computes it, or the
+// first error it reads
+static Cell_Error evaluate(Stream *stream, const Expr *expr, double *value) {
+  Cell_Error error;
+  double lhs;
+  double rhs;
+
+  switch (expr->type) {
+  case EXPR_TYPE_NUMBER:
+    *value = expr->value.number;
+    return CELL_ERROR_NONE;
+
+  case EXPR_TYPE_CELL: {
+    const Cell *cell =
+        stream_cell(stream, expr->value.cell.row, expr->value.cell.col);
+    if (cell->type == CELL_TYPE_ERROR) {
+      return cell->value.formula.error;
+    }
+    *value = cell->type == CELL_TYPE_NUMBER ? cell->value.number
+             : cell->type == CELL_TYPE_EXPR ? cell->value.formula.value
+                                            : 0;  // an empty cell
+    return CELL_ERROR_NONE;
+  }
+
+  case EXPR_TYPE_FUNC:
+    return evaluate_call(stream, &expr->value.call, value);
+
+  case EXPR_TYPE_NEG:
+    error = evaluate(stream, expr->value.operand, value);
+    if (!error) {
+      *value = -*value;
+    }
+    return error;
+
+  default:
+    error = evaluate(stream, expr->value.plus.lhs, &lhs);
+    if (!error) {
+      error = evaluate(stream, expr->value.plus.rhs, &rhs);
+    }
+    if (error) {
+      return error;
+    }
+    *value = expr->type == EXPR_TYPE_PLUS    ? lhs + rhs
+             : expr->type == EXPR_TYPE_MINUS ? lhs - rhs
+             : expr->type == EXPR_TYPE_MULT  ? lhs * rhs
+                                             : lhs / rhs;
+    return CELL_ERROR_NONE;
+  }
+}
+
+static void evaluate_rows(Stream *stream, size_t first, size_t last) {
+  Table *table = &stream->table;
+  for (size_t row = first; row < last; ++row) {
+    stream->row = stream->base + row;
+    for (size_t col = 0; col < table->cols; ++col) {
+      Cell *cell = &table->cells[row * table->cols + col];
+      if (cell->type != CELL_TYPE_EXPR) {
+        continue;
+      }
+
+      const Expr *ast = cell->value.formula.ast;
+      double value = 0;
+      Cell_Error error = ast ? check(stream, ast) : CELL_ERROR_VALUE;
+      if (!error) {
+        error = evaluate(stream, ast, &value);
+      }
+      if (error) {
+        cell->type = CELL_TYPE_ERROR;
+        cell->value.formula.error = error;
+      } else {
+        cell->value.formula.value = value;
+      }
+    }
+  }
+}
+
+static void push_block(Stream *stream, Block block) {
+  if (stream->num_blocks == stream->blocks_capacity) {
+    size_t capacity = stream->blocks_capacity ? stream->blocks_capacity * 2 : 16;
+    Block *blocks = realloc(stream->blocks, sizeof(Block) * capacity);
+    if (!blocks) {
+      fprintf(stderr, "ERROR: Failed to allocate %zu blocks.\n", capacity);
+      exit(EXIT_FAILURE);
+    }
+    stream->blocks = blocks;
+    stream->blocks_capacity = capacity;
+  }
+  stream->blocks[stream->num_blocks++] = block;
+}
+
+// Drops the oldest blocks while `window` rows stay, once the table holds twice
+// that, so each row is moved down once on average
+static void drop_blocks(Stream *stream, size_t window, Mapped_File *file) {
+  Table *table = &stream->table;
+  if (table->rows < 2 * window) {
+    return;
+  }
+
+  size_t dropped = 0;
+  size_t blocks = 0;
+  while (blocks + 1 < stream->num_blocks &&
+         table->rows - dropped - stream->blocks[blocks].rows >= window) {
+    dropped += stream->blocks[blocks++].rows;
+  }
+
+  for (size_t i = 0; i < blocks; ++i) {
+    arena_free(&stream->blocks[i].arena);
+  }
+  memmove(table->cells, table->cells + dropped * table->cols,
+          sizeof(Cell) * (table->rows - dropped) * table->cols);
+  table->rows -= dropped;
+  stream->base += dropped;
+
+  stream->num_blocks -= blocks;
+  memmove(stream->blocks, stream->blocks + blocks,
+          sizeof(Block) * stream->num_blocks);
+  drop_file_pages(file, file->content.data, stream->blocks[0].data);
+}
+
+// The columns of the whole sheet, a chunk of whole lines at a time, letting
+// go of each chunk's pages once it's read
+static size_t sheet_cols(Mapped_File *file) {
+  StringView content = file->content;
+  const char *at = content.data;
+  const char *end = content.data + content.count;
+  size_t cols = 0;
+
+  while (at < end) {
+    const char *stop = end;
+    if ((size_t)(end - at) > STREAM_SCAN) {
+      const char *newline =
+          memchr(at + STREAM_SCAN, '\n', end - at - STREAM_SCAN);
+      stop = newline ? newline + 1 : end;
+    }
+
+    size_t chunk = parse_table_cols(sv_gen(at, stop - at));
+    cols = chunk > cols ? chunk : cols;
+    drop_file_pages(file, at, stop);
+    at = stop;
+  }
+  return cols;
+}
+
+void stream_sheet(Mapped_File *file, size_t window, Output *output) {
+  StringView content = file->content;
+  Stream stream = {0};
+  stream.table.cols = sheet_cols(file);
+  stream.table.text_in_content = true;  // only as long as the window is kept
+  stream.scratch = stream_alloc(stream.table.cols, sizeof(Column));
+
+  const char *at = content.data;
+  const char *end = content.data + content.count;
+  while (at < end) {
+    const char *stop = at;
+    for (size_t line = 0; line < STREAM_BLOCK && stop < end; ++line) {
+      const char *newline = memchr(stop, '\n', end - stop);
+      stop = newline ? newline + 1 : end;
+    }
+
+    size_t first = stream.table.rows;
+    parse_table_with(&stream.table, sv_gen(at, stop - at), NULL);
+    push_block(&stream, (Block){stream.table.rows - first, at,
+                                stream.table.arena});
+    stream.table.arena = (Arena){0};
+
+    evaluate_rows(&stream, first, stream.table.rows);
+    for (size_t row = first; row < stream.table.rows; ++row) {
+      output_row(output, &stream.table, row);
+    }
+
+    drop_blocks(&stream, window, file);
+    at = stop;
+  }
+
+  for (size_t col = 0; col < stream.table.cols; ++col) {
+    free(stream.scratch[col].numeric);
+    free(stream.scratch[col].numbers);
+  }
+  free(stream.scratch);
+  for (size_t i = 0; i < stream.num_blocks; ++i) {
+    arena_free(&stream.blocks[i].arena);
+  }
+  free(stream.blocks);
+  table_free(&stream.table);
+}
@@ -0,0 +1,385 @@
+#include "table.h"
+#include "number.h"
+#include "scan.h"
+#include "thread_pool.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INIT_CAP 5
+#define PARALLEL_MIN_BYTES (4 << 20)  // smaller sheets aren't worth the threads
+#define CHUNKS_PER_THREAD 4           // so a slow chunk doesn't hold up the rest
+
+Cell *table_cell_at(Table *table, size_t row, size_t col) {
+  assert(row < table->rows );
+  assert(col < table->cols);
+  return &table->cells[row * table->cols + col];
+}
+
+const char *cell_as_str(Cell* cell) {
+  switch (cell->type) {
+    case CELL_TYPE_TEXT:
+      return "TEXT";
+    case CELL_TYPE_EXPR:
+      return "EXPR";
+    case CELL_TYPE_NUMBER:
+      return "NUMBER";
+    case CELL_TYPE_ERROR:
+      return "ERROR";
+    default:
+      assert(0 && "UNREACHABLE CONDITION");
+      exit(EXIT_FAILURE);
+  }
+}
+
+// How an error cell is written out
+const char *cell_error_str(Cell_Error error) {
+  switch (error) {
+    case CELL_ERROR_CYCLE:
+      return "#CYCLE!";
+    case CELL_ERROR_REF:
+      return "#REF!";
+    case CELL_ERROR_VALUE:
+      return "#VALUE!";
+    default:
+      return "#ERROR!";
+  }
+}
+
+Table table_alloc(size_t rows, size_t cols) {
+  Table table = {0};
+  table.rows = rows;
+  table.cols = cols;
+  table.capacity = rows;
+
+  table.cells = malloc(sizeof(Cell) * rows * cols);
+  if (!table.cells) {
+    fprintf(stderr, "ERROR: Failed to allocate Table struct.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(table.cells, 0, sizeof(Cell) * rows * cols);
+  return table;
+}
+
+void table_free(Table *table) {
+  arena_free(&table->arena);
+  intern_pool_free(&table->strings);
+  free(table->cells);
+  memset(table, 0, sizeof(*table));
+}
+
+// Makes room for one more row, zeroed, at the end of the table
+static void table_append_row(Table *table) {
+  if (table->rows == table->capacity) {
+    size_t capacity = table->capacity ? table->capacity * 2 : INIT_CAP;
+    // Without columns yet there is nothing to allocate, table_widen() will
+    if (table->cols > 0) {
+      Cell *cells = realloc(table->cells, sizeof(Cell) * capacity * table->cols);
+      if (!cells) {
+        fprintf(stderr, "ERROR: Failed to grow Table to %zu rows.\n", capacity);
+        exit(EXIT_FAILURE);
+      }
+      table->cells = cells;
+    }
+    table->capacity = capacity;
+  }
+
+  memset(&table->cells[table->rows * table->cols], 0,
+         sizeof(Cell) * table->cols);
+  table->rows += 1;
+}
+
+// A row with more columns than any before it: every row gets the new columns,
+// zeroed
+static void table_widen(Table *table, size_t cols) {
+  Cell *cells = malloc(sizeof(Cell) * table->capacity * cols);
+  if (!cells) {
+    fprintf(stderr, "ERROR: Failed to grow Table to %zu columns.\n", cols);
+    exit(EXIT_FAILURE);
+  }
+
+  memset(cells, 0, sizeof(Cell) * table->rows * cols);
+  for (size_t row = 0; row < table->rows; ++row) {
+    memcpy(&cells[row * cols], &table->cells[row * table->cols],
+           sizeof(Cell) * table->cols);
+  }
+
+  free(table->cells);
+  table->cells = cells;
+  table->cols = cols;
+}
+
+// Grows the table to `rows` rows of `cols` columns at once, the new cells
+// zeroed
+static void table_resize(Table *table, size_t rows, size_t cols) {
+  if (cols > table->cols) {
+    table_widen(table, cols);
+  }
+  if (rows > table->capacity && table->cols > 0) {
+    Cell *cells = realloc(table->cells, sizeof(Cell) * rows * table->cols);
+    if (!cells) {
+      fprintf(stderr, "ERROR: Failed to grow Table to %zu rows.\n", rows);
+      exit(EXIT_FAILURE);
+    }
+    table->cells = cells;
+  }
+  if (rows > table->capacity) {
+    table->capacity = rows;
+  }
+
+  memset(&table->cells[table->rows * table->cols], 0,
+         sizeof(Cell) * (rows - table->rows) * table->cols);
+  table->rows = rows;
+}
+
+static void intern_cell(Table *table, Cell *cell) {
+  cell->text_id = intern(&table->strings, &table->arena, cell->value.text);
+  cell->value.text = table->strings.texts[cell->text_id];
+}
+
+// Formulas go to `arena`. Text is interned with `intern`, which only one
+// thread at a time may do.
+static void parse_cell(Table *table, Cell *cell, StringView val, Arena *arena,
+                       bool intern) {
+  Cell_Value value;
+
+  if (sv_starts_with(val, SV("="))) {
+    cell->type = CELL_TYPE_EXPR;
+    value.formula.ast = parse_expr(val, arena);
+    value.formula.value = 0;
+  } else if (sv_parse_number(val, &value.number)) {
+    cell->type = CELL_TYPE_NUMBER;
+  } else {
+    cell->type = CELL_TYPE_TEXT;
+    value.text = val;
+  }
+  cell->value = value;
+
+  if (intern && cell->type == CELL_TYPE_TEXT) {
+    intern_cell(table, cell);
+  }
+}
+
+// Fills cell (row, col) with `raw`, widening the table if it's the first row
+// to get that far
+static void table_put(Table *table, size_t row, size_t col, StringView raw,
+                      Arena *arena, bool intern) {
+  if (col >= table->cols) {
+    table_widen(table, col + 1);
+  }
+  parse_cell(table, table_cell_at(table, row, col), sv_trim(raw), arena,
+             intern);
+}
+
+static uint32_t *alloc_positions(void) {
+  uint32_t *positions = malloc(sizeof(uint32_t) * SCAN_CHUNK);
+  if (!positions) {
+    fprintf(stderr, "ERROR: Failed to allocate the structural index.\n");
+    exit(EXIT_FAILURE);
+  }
+  return positions;
+}
+
+// Walks the structural index of each SCAN_CHUNK bytes instead of looking at
+// every byte. A row has a cell for each '|' and one more for whatever follows
+// the last '|' when that isn't empty, so "a|\n" is one cell and "a||\n" two,
+// as splitting the line with sv_split_by_delim() gives.
+//
+// The rows of `content` go to `row` on. With `append` they are appended to
+// the table as they come, otherwise the table already has them and all their
+// columns. Formulas go to `arena`, and text is interned with `intern`.
+static void parse_rows(Table *table, size_t row, StringView content,
+                       bool append, Arena *arena, bool intern) {
+  uint32_t *positions = alloc_positions();
+  const char *field = content.data; // Start of the cell being read
+  size_t col = 0;
+  bool in_row = false; // Whether the row being read was started yet
+
+  for (size_t offset = 0; offset < content.count; offset += SCAN_CHUNK) {
+    const char *chunk = content.data + offset;
+    size_t count = content.count - offset;
+    count = count < SCAN_CHUNK ? count : SCAN_CHUNK;
+    size_t found = scan_delims(chunk, count, positions);
+
+    for (size_t i = 0; i < found; ++i) {
+      const char *delim = chunk + positions[i];
+      StringView raw = sv_gen(field, delim - field);
+      if (!in_row && append) {
+        table_append_row(table);
+      }
+      in_row = true;
+
+      if (*delim == '|') {
+        table_put(table, row, col++, raw, arena, intern);
+      } else {
+        if (raw.count > 0) {
+          table_put(table, row, col, raw, arena, intern);
+        }
+        row += 1;
+        col = 0;
+        in_row = false;
+      }
+      field = delim + 1;
+    }
+  }
+
+  // The last row may not end with '\n'
+  const char *end = content.data + content.count;
+  if (field < end) {
+    if (!in_row && append) {
+      table_append_row(table);
+    }
+    table_put(table, row, col, sv_gen(field, end - field), arena, intern);
+  }
+
+  free(positions);
+}
+
+void parse_table(Table *table, StringView content) {
+  size_t threads = thread_pool_cpus();
+  if (threads == 1 || content.count < PARALLEL_MIN_BYTES) {
+    parse_table_with(table, content, NULL);
+    return;
+  }
+
+  Thread_Pool *pool = thread_pool_create(threads);
+  parse_table_with(table, content, pool);
+  thread_pool_destroy(pool);
+}
+
+// ---------------------------------------------------------------------------
+// Parallel parsing: the sheet is cut into chunks of whole lines. A first pass
+// counts the rows and columns of every chunk, which gives each chunk the row
+// its cells start at, and a second pass parses the chunks into their rows of
+// the table sized for all of them. Each chunk has an arena of its own, given
+// to the table after, and the text is interned once all chunks are parsed.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  StringView content;
+  size_t rows;
+  size_t cols;
+  size_t first_row;
+  Arena arena;
+} Chunk;
+
+typedef struct {
+  Table *table;
+  Chunk *chunks;
+} Parse_Job;
+
+// The rows and the widest row of `content`, by the same rules as parse_rows()
+static void count_rows(void *arg, size_t index) {
+  Chunk *chunk = &((Parse_Job *)arg)->chunks[index];
+  StringView content = chunk->content;
+  uint32_t *positions = alloc_positions();
+  const char *field = content.data;
+  size_t cols = 0;
+
+  for (size_t offset = 0; offset < content.count; offset += SCAN_CHUNK) {
+    const char *data = content.data + offset;
+    size_t count = content.count - offset;
+    count = count < SCAN_CHUNK ? count : SCAN_CHUNK;
+    size_t found = scan_delims(data, count, positions);
+
+    for (size_t i = 0; i < found; ++i) {
+      const char *delim = data + positions[i];
+      if (*delim == '|') {
+        cols += 1;
+      } else {
+        cols += delim > field;
+        chunk->cols = cols > chunk->cols ? cols : chunk->cols;
+        chunk->rows += 1;
+        cols = 0;
+      }
+      field = delim + 1;
+    }
+  }
+
+  const char *end = content.data + content.count;
+  if (field < end || cols > 0) {
+    cols += field < end;
+    chunk->cols = cols > chunk->cols ? cols : chunk->cols;
+    chunk->rows += 1;
+  }
+
+  free(positions);
+}
+
+static void parse_chunk(void *arg, size_t index) {
+  Parse_Job *job = arg;
+  Chunk *chunk = &job->chunks[index];
+  parse_rows(job->table, chunk->first_row, chunk->content, false, &chunk->arena,
+             false);
+}
+
+void parse_table_with(Table *table, StringView content, Thread_Pool *pool) {
+  if (!pool) {
+    parse_rows(table, table->rows, content, true, &table->arena,
+               !table->text_in_content);
+    return;
+  }
+
+  size_t num_chunks = thread_pool_size(pool) * CHUNKS_PER_THREAD;
+  Chunk *chunks = calloc(num_chunks, sizeof(Chunk));
+  if (!chunks) {
+    fprintf(stderr, "ERROR: Failed to allocate %zu chunks.\n", num_chunks);
+    exit(EXIT_FAILURE);
+  }
+
+  // Every chunk but the last ends right after a '\n'
+  const char *start = content.data;
+  const char *end = content.data + content.count;
+  for (size_t i = 0; i < num_chunks; ++i) {
+    const char *stop = content.data + content.count / num_chunks * (i + 1);
+    if (i + 1 == num_chunks || stop >= end) {
+      stop = end;
+    } else if (stop < start) {
+      stop = start;
+    } else {
+      const char *newline = memchr(stop, '\n', end - stop);
+      stop = newline ? newline + 1 : end;
+    }
+    chunks[i].content = sv_gen(start, stop - start);
+    start = stop;
+  }
+
+  Parse_Job job = {table, chunks};
+  thread_pool_run(pool, count_rows, &job, num_chunks);
+
+  size_t rows = table->rows;
+  size_t cols = table->cols;
+  for (size_t i = 0; i < num_chunks; ++i) {
+    chunks[i].first_row = rows;
+    rows += chunks[i].rows;
+    cols = chunks[i].cols > cols ? chunks[i].cols : cols;
+  }
+  size_t first_row = table->rows;
+  table_resize(table, rows, cols);
+
+  thread_pool_run(pool, parse_chunk, &job, num_chunks);
+  for (size_t i = 0; i < num_chunks; ++i) {
+    arena_merge(&table->arena, &chunks[i].arena);
+  }
+  free(chunks);
+
+  if (!table->text_in_content) {
+    for (size_t i = first_row * table->cols; i < table->rows * table->cols;
+         ++i) {
+      if (table->cells[i].type == CELL_TYPE_TEXT) {
+        intern_cell(table, &table->cells[i]);
+      }
+    }
+  }
+}
+
+size_t parse_table_cols(StringView content) {
+  Chunk chunk = {0};
+  chunk.content = content;
+  Parse_Job job = {NULL, &chunk};
+  count_rows(&job, 0);
+  return chunk.cols;
+}
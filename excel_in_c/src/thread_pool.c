@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L // sysconf
+
+#include "thread_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct Thread_Pool {
+  pthread_t *workers;
+  size_t num_workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;  // a new batch, or shutdown
+  pthread_cond_t work_done;   // the last worker left the batch
+  unsigned long batch;        // bumped for every batch
+  size_t busy;                // workers still in the current batch
+  bool shutdown;
+
+  // The current batch
+  Thread_Task task;
+  void *arg;
+  size_t count;
+  atomic_size_t next;  // the next index to hand out
+};
+
+// Runs tasks of the current batch until there are none left
+static void run_tasks(Thread_Pool *pool) {
+  for (;;) {
+    size_t index = atomic_fetch_add(&pool->next, 1);
+    if (index >= pool->count) {
+      return;
+    }
+    pool->task(pool->arg, index);
+  }
+}
+
+static void *worker_main(void *arg) {
+  Thread_Pool *pool = arg;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->shutdown && pool->batch == seen) {
+      pthread_cond_wait(&pool->work_ready, &pool->lock);
+    }
+    if (pool->shutdown) {
+      break;
+    }
+    seen = pool->batch;
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy == 0) {
+      pthread_cond_signal(&pool->work_done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+Thread_Pool *thread_pool_create(size_t threads) {
+  Thread_Pool *pool = calloc(1, sizeof(*pool));
+  if (!pool) {
+    fprintf(stderr, "ERROR: Failed to allocate the thread pool.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pool->num_workers = threads > 1 ? threads - 1 : 0;
+  pool->workers = calloc(pool->num_workers + 1, sizeof(pthread_t));
+  if (!pool->workers) {
+    fprintf(stderr, "ERROR: Failed to allocate the thread pool.\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_ready, NULL);
+  pthread_cond_init(&pool->work_done, NULL);
+  atomic_init(&pool->next, 0);
+
+  for (size_t i = 0; i < pool->num_workers; ++i) {
+    if (pthread_create(&pool->workers[i], NULL, worker_main, pool) != 0) {
+      fprintf(stderr, "ERROR: Failed to start worker thread %zu.\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return pool;
+}
+
+void thread_pool_destroy(Thread_Pool *pool) {
+  if (!pool) {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->num_workers; ++i) {
+    pthread_join(pool->workers[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->work_done);
+  pthread_cond_destroy(&pool->work_ready);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool);
+}
+
+size_t thread_pool_size(const Thread_Pool *pool) {
+  return pool->num_workers + 1;
+}
+
+void thread_pool_run(Thread_Pool *pool, Thread_Task task, void *arg,
+                     size_t count) {
+  if (pool->num_workers == 0 || count <= 1) {
+    for (size_t i = 0; i < count; ++i) {
+      task(arg, i);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->arg = arg;
+  pool->count = count;
+  atomic_store(&pool->next, 0);
+  pool->busy = pool->num_workers;
+  pool->batch += 1;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->lock);
+
+  run_tasks(pool);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy > 0) {
+    pthread_cond_wait(&pool->work_done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+size_t thread_pool_cpus(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (size_t)cpus : 1;
+}
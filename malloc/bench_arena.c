@@ -0,0 +1,138 @@
+#include "malloc_ext.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Same-size nodes: builds binary expression trees of NODES nodes and tears
+ * them down again, ROUNDS times, allocating the nodes with
+ * - malloc: malloc() and free() per node
+ * - pool:   malloc_pool_alloc() and malloc_pool_free() per node
+ * - arena:  malloc_arena_alloc() per node and one malloc_arena_reset()
+ * Every variant runs in its own process, so the heap growth it reports is
+ * its own.
+ *
+ * Run it against the custom allocator with
+ *   LD_PRELOAD=./build/malloc.so ./build/bench_arena
+ * Without LD_PRELOAD only the malloc variant runs, as the glibc baseline.
+ */
+
+#define NODES (1 << 20)
+#define ROUNDS 10
+
+typedef struct Node {
+  int kind;
+  double value;
+  struct Node *lhs;
+  struct Node *rhs;
+} Node;
+
+#pragma weak malloc_arena_create
+#pragma weak malloc_arena_alloc
+#pragma weak malloc_arena_reset
+#pragma weak malloc_pool_create
+#pragma weak malloc_pool_alloc
+#pragma weak malloc_pool_free
+
+typedef enum { VIA_MALLOC, VIA_POOL, VIA_ARENA } Via;
+
+static MallocPool *pool;
+static MallocArena *arena;
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+Node *node_alloc(Via via) {
+  Node *node;
+  switch (via) {
+  case VIA_POOL:
+    node = malloc_pool_alloc(pool);
+    break;
+  case VIA_ARENA:
+    node = malloc_arena_alloc(arena, sizeof(Node));
+    break;
+  default:
+    node = malloc(sizeof(Node));
+    break;
+  }
+  if (!node) {
+    fprintf(stderr, "node allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return node;
+}
+
+/* A complete tree of `count` nodes, built depth first */
+Node *build(Via via, size_t count) {
+  if (count == 0) {
+    return NULL;
+  }
+  Node *node = node_alloc(via);
+  node->kind = count > 1;
+  node->value = (double)count;
+  node->lhs = build(via, (count - 1) / 2);
+  node->rhs = build(via, count - 1 - (count - 1) / 2);
+  return node;
+}
+
+void destroy(Via via, Node *node) {
+  if (!node) {
+    return;
+  }
+  destroy(via, node->lhs);
+  destroy(via, node->rhs);
+  if (via == VIA_POOL) {
+    malloc_pool_free(pool, node);
+  } else {
+    free(node);
+  }
+}
+
+void run(Via via, const char *name) {
+  char *heap_start = sbrk(0);
+  size_t heap_peak = 0;
+
+  if (via == VIA_POOL) {
+    pool = malloc_pool_create(sizeof(Node));
+  } else if (via == VIA_ARENA) {
+    arena = malloc_arena_create(0);
+  }
+
+  double start = now();
+  for (int round = 0; round < ROUNDS; ++round) {
+    Node *root = build(via, NODES);
+    size_t heap = (char *)sbrk(0) - heap_start;
+    heap_peak = heap > heap_peak ? heap : heap_peak;
+
+    if (via == VIA_ARENA) {
+      malloc_arena_reset(arena);
+    } else {
+      destroy(via, root);
+    }
+  }
+  double elapsed = now() - start;
+
+  printf("%-8s %14.1f %16.1f\n", name, elapsed * 1e9 / ((double)NODES * ROUNDS),
+         (double)heap_peak / NODES);
+}
+
+int main(void) {
+  const char *names[] = {"malloc", "pool", "arena"};
+  int variants = malloc_pool_create ? 3 : 1;
+
+  printf("%-8s %14s %16s\n", "via", "ns per node", "heap per node");
+  fflush(stdout);
+  for (int via = 0; via < variants; ++via) {
+    if (fork() == 0) {
+      run(via, names[via]);
+      exit(EXIT_SUCCESS);
+    }
+    wait(NULL);
+  }
+  return 0;
+}
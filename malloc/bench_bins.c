@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Allocation latency as the number of live blocks grows.
+ *
+ * Every level pins a growing set of small blocks with a free hole between
+ * each pair, so a list-walking allocator has to step over all of them before
+ * it can serve a bigger request. A size-class allocator should stay flat.
+ *
+ * Run it against the custom allocator with
+ *   LD_PRELOAD=./build/malloc.so ./build/bench_bins
+ * and without LD_PRELOAD for the glibc baseline.
+ */
+
+#define MAX_LIVE_BLOCKS 65536
+#define NUM_OPS 20000
+#define HOLE_SIZE 16
+#define PIN_SIZE 16
+
+static void *live[MAX_LIVE_BLOCKS];
+static void *ops[NUM_OPS];
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Grows the live set from `from` to `to` blocks, leaving a free hole of
+ * HOLE_SIZE bytes in front of every pinned block
+ */
+void grow_live_set(size_t from, size_t to) {
+  for (size_t i = from; i < to; ++i) {
+    void *hole = malloc(HOLE_SIZE);
+    live[i] = malloc(PIN_SIZE);
+    free(hole);
+  }
+}
+
+/* Average nanoseconds for a malloc of `size` followed later by its free */
+double time_malloc(size_t size) {
+  double start = now();
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    ops[i] = malloc(size);
+  }
+  double end = now();
+
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    free(ops[i]);
+  }
+  return (end - start) * 1e9 / NUM_OPS;
+}
+
+/* Average nanoseconds for a malloc/free pair with mixed sizes */
+double time_mixed(void) {
+  srand(42);
+  double start = now();
+  for (size_t i = 0; i < NUM_OPS; ++i) {
+    ops[i] = malloc(32 + rand() % 2048);
+    if (i % 2) {
+      free(ops[i - 1]);
+      free(ops[i]);
+    }
+  }
+  return (now() - start) * 1e9 / NUM_OPS;
+}
+
+int main(void) {
+  printf("%12s %14s %14s %14s\n", "live blocks", "malloc(64) ns", "malloc(4k) ns",
+         "mixed ns");
+
+  size_t live_count = 0;
+  for (size_t target = 1024; target <= MAX_LIVE_BLOCKS; target *= 4) {
+    grow_live_set(live_count, target);
+    live_count = target;
+
+    // Warm-up pass so the first level doesn't pay for growing the heap
+    time_malloc(64);
+    time_malloc(4096);
+
+    printf("%12zu %14.1f %14.1f %14.1f\n", live_count, time_malloc(64),
+           time_malloc(4096), time_mixed());
+  }
+
+  for (size_t i = 0; i < live_count; ++i) {
+    free(live[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,229 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Fragmentation: replays a trace of malloc/realloc/free calls and reports how
+ * far the heap had to grow compared to the bytes that were live at worst.
+ *
+ * The trace is a text file with one call per line, `<id>` naming the block:
+ *   m <id> <size>    malloc
+ *   r <id> <size>    realloc
+ *   f <id>           free
+ * Without a file, a synthetic trace of a long-running server is replayed: a
+ * few long-lived blocks scattered among short-lived ones whose typical size
+ * drifts over time, which is what leaves holes that don't fit later
+ * requests. `-w <file>` writes that trace out instead of replaying it.
+ *
+ * Compare the placement policies with
+ *   for p in first best address; do
+ *     MALLOC_POLICY=$p LD_PRELOAD=./build/malloc.so ./build/bench_frag
+ *   done
+ * and run it without LD_PRELOAD for the glibc baseline. Everything is kept
+ * below the mmap threshold so the whole trace lands in the sbrk heap.
+ */
+
+#define SYNTH_OPS 2000000
+#define SYNTH_IDS 16384
+#define SYNTH_LONG_LIVED 1024 // The first ids are only rarely replaced
+#define SYNTH_PHASE 250000    // Ops before the typical size changes
+
+typedef struct {
+  char op; // 'm', 'r' or 'f'
+  uint32_t id;
+  uint32_t size;
+} Call;
+
+typedef struct {
+  Call *calls;
+  size_t count;
+  size_t num_ids;
+} Trace;
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The benchmark's own memory comes from mmap so it doesn't show up in the
+ * heap being measured
+ */
+void *map_zeroed(size_t size) {
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+static unsigned bench_rand(unsigned *seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 16;
+}
+
+static uint32_t synth_size(unsigned *seed, size_t step) {
+  unsigned kind = bench_rand(seed) % 10;
+  if (kind < 4) {
+    return 16 + bench_rand(seed) % 496;
+  }
+  if (kind < 9) {
+    uint32_t scale = 1 + (step / SYNTH_PHASE) % 4;
+    return scale * (1024 + bench_rand(seed) % 7168);
+  }
+  return 32 * 1024 + bench_rand(seed) % (64 * 1024);
+}
+
+Trace synthesize(void) {
+  Trace trace = {map_zeroed(SYNTH_OPS * sizeof(Call)), 0, SYNTH_IDS};
+  char *live = map_zeroed(SYNTH_IDS);
+  unsigned seed = 42;
+
+  for (size_t step = 0; step < SYNTH_OPS; ++step) {
+    uint32_t id;
+    do {
+      id = bench_rand(&seed) % SYNTH_IDS;
+      // Long-lived blocks are picked 64 times less often
+    } while (id < SYNTH_LONG_LIVED && live[id] && bench_rand(&seed) % 64);
+
+    Call *call = &trace.calls[trace.count++];
+    call->id = id;
+    if (!live[id]) {
+      call->op = 'm';
+      call->size = synth_size(&seed, step);
+      live[id] = 1;
+    } else if (bench_rand(&seed) % 4 == 0) {
+      call->op = 'r';
+      call->size = synth_size(&seed, step);
+    } else {
+      call->op = 'f';
+      live[id] = 0;
+    }
+  }
+
+  munmap(live, SYNTH_IDS);
+  return trace;
+}
+
+Trace load(const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+
+  size_t lines = 0;
+  for (int c; (c = fgetc(fp)) != EOF;) {
+    lines += (c == '\n');
+  }
+  rewind(fp);
+
+  Trace trace = {map_zeroed((lines + 1) * sizeof(Call)), 0, 0};
+  Call call;
+  while (fscanf(fp, " %c %u", &call.op, &call.id) == 2) {
+    call.size = 0;
+    if (call.op != 'f' && fscanf(fp, "%u", &call.size) != 1) {
+      fprintf(stderr, "%s:%zu: missing size\n", path, trace.count + 1);
+      exit(EXIT_FAILURE);
+    }
+    trace.calls[trace.count++] = call;
+    if (call.id >= trace.num_ids) {
+      trace.num_ids = call.id + 1;
+    }
+  }
+  fclose(fp);
+  return trace;
+}
+
+void write_trace(const Trace *trace, const char *path) {
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < trace->count; ++i) {
+    const Call *call = &trace->calls[i];
+    if (call->op == 'f') {
+      fprintf(fp, "f %u\n", call->id);
+    } else {
+      fprintf(fp, "%c %u %u\n", call->op, call->id, call->size);
+    }
+  }
+  fclose(fp);
+}
+
+void replay(const Trace *trace) {
+  void **ptrs = map_zeroed(trace->num_ids * sizeof(void *));
+  size_t *sizes = map_zeroed(trace->num_ids * sizeof(size_t));
+  size_t live = 0, peak_live = 0, peak_heap = 0;
+  char *heap_start = sbrk(0);
+
+  double start = now();
+  for (size_t i = 0; i < trace->count; ++i) {
+    const Call *call = &trace->calls[i];
+    void **ptr = &ptrs[call->id];
+
+    live -= sizes[call->id];
+    sizes[call->id] = 0;
+    switch (call->op) {
+    case 'm':
+      free(*ptr); // Traces may reuse an id without freeing it
+      *ptr = malloc(call->size);
+      break;
+    case 'r':
+      *ptr = realloc(*ptr, call->size);
+      break;
+    default:
+      free(*ptr);
+      *ptr = NULL;
+      continue;
+    }
+    if (!*ptr) {
+      fprintf(stderr, "allocation of %u bytes failed\n", call->size);
+      exit(EXIT_FAILURE);
+    }
+    memset(*ptr, 0, call->size < 64 ? call->size : 64);
+    sizes[call->id] = call->size;
+    live += call->size;
+
+    size_t heap = (char *)sbrk(0) - heap_start;
+    peak_heap = heap > peak_heap ? heap : peak_heap;
+    peak_live = live > peak_live ? live : peak_live;
+  }
+  double elapsed = now() - start;
+
+  for (size_t id = 0; id < trace->num_ids; ++id) {
+    free(ptrs[id]);
+  }
+
+  const char *policy = getenv("MALLOC_POLICY");
+  printf("%-10s %12s %12s %12s %10s %12s\n", "policy", "calls",
+         "peak live", "peak heap", "heap/live", "ns per call");
+  printf("%-10s %12zu %10zu K %10zu K %10.3f %12.1f\n",
+         policy ? policy : "-", trace->count, peak_live / 1024,
+         peak_heap / 1024, (double)peak_heap / peak_live,
+         elapsed * 1e9 / trace->count);
+}
+
+int main(int argc, char **argv) {
+  // Keep every block in the sbrk heap, for glibc too
+  mallopt(M_MMAP_THRESHOLD, 32 * 1024 * 1024);
+
+  if (argc == 3 && strcmp(argv[1], "-w") == 0) {
+    Trace trace = synthesize();
+    write_trace(&trace, argv[2]);
+    return 0;
+  }
+
+  Trace trace = argc > 1 ? load(argv[1]) : synthesize();
+  replay(&trace);
+  return 0;
+}
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Per-allocation overhead for small objects.
+ *
+ * For every request size, NUM_OBJECTS blocks are allocated and the growth of
+ * the heap break is divided by the number of blocks: whatever exceeds the
+ * requested size is header, footer, alignment or minimum-size padding. Blocks
+ * are never freed so no size reuses the memory of another.
+ *
+ * Run it against the custom allocator with
+ *   LD_PRELOAD=./build/malloc.so ./build/bench_overhead
+ * and without LD_PRELOAD for the glibc baseline.
+ */
+
+#define NUM_OBJECTS 100000
+
+int main(void) {
+  const size_t sizes[] = {1, 8, 16, 24, 32, 48, 64, 100, 128, 256};
+
+  printf("%10s %14s %16s %14s\n", "request", "bytes/object", "overhead bytes",
+         "overhead %");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    char *heap_before = sbrk(0);
+    for (size_t j = 0; j < NUM_OBJECTS; ++j) {
+      *(char *)malloc(sizes[i]) = 1;
+    }
+    char *heap_after = sbrk(0);
+
+    double per_object = (double)(heap_after - heap_before) / NUM_OBJECTS;
+    double overhead = per_object - sizes[i];
+    printf("%10zu %14.1f %16.1f %13.0f%%\n", sizes[i], per_object, overhead,
+           100.0 * overhead / per_object);
+  }
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Incrementally grown buffers: how often realloc has to move (and so copy)
+ * the data, and how long the growth takes.
+ *
+ * - doubling: a vector that doubles its capacity from 16 bytes to 64 KiB
+ * - builder:  a few string builders appended to in turn, each growing by
+ *             STEP bytes at a time, so they keep bumping into each other
+ *
+ * Run it against the custom allocator with
+ *   LD_PRELOAD=./build/malloc.so ./build/bench_realloc
+ * and without LD_PRELOAD for the glibc baseline.
+ */
+
+#define DOUBLING_ROUNDS 20000
+#define DOUBLING_MAX (64 * 1024)
+#define NUM_BUILDERS 4
+#define BUILDER_MAX (256 * 1024)
+#define STEP 16
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reallocs `ptr` and counts the calls where the data had to move */
+void *counted_realloc(void *ptr, size_t size, size_t *moves) {
+  void *new_ptr = realloc(ptr, size);
+  if (!new_ptr) {
+    fprintf(stderr, "realloc of %zu bytes failed\n", size);
+    exit(EXIT_FAILURE);
+  }
+  *moves += (new_ptr != ptr);
+  return new_ptr;
+}
+
+void bench_doubling(void) {
+  size_t calls = 0;
+  size_t moves = 0;
+
+  double start = now();
+  for (size_t round = 0; round < DOUBLING_ROUNDS; ++round) {
+    char *buf = malloc(16);
+    for (size_t cap = 32; cap <= DOUBLING_MAX; cap *= 2) {
+      buf = counted_realloc(buf, cap, &moves);
+      buf[cap - 1] = 1;
+      calls += 1;
+    }
+    free(buf);
+  }
+  double elapsed = now() - start;
+
+  printf("%-10s %10zu %10zu %9.1f%% %10.1f\n", "doubling", calls, moves,
+         100.0 * moves / calls, elapsed * 1e9 / calls);
+}
+
+void bench_builders(void) {
+  char *bufs[NUM_BUILDERS] = {0};
+  size_t calls = 0;
+  size_t moves = 0;
+
+  double start = now();
+  for (size_t len = STEP; len <= BUILDER_MAX; len += STEP) {
+    for (size_t i = 0; i < NUM_BUILDERS; ++i) {
+      bufs[i] = counted_realloc(bufs[i], len, &moves);
+      memset(bufs[i] + len - STEP, 'a' + i, STEP);
+      calls += 1;
+    }
+  }
+  double elapsed = now() - start;
+
+  for (size_t i = 0; i < NUM_BUILDERS; ++i) {
+    free(bufs[i]);
+  }
+
+  printf("%-10s %10zu %10zu %9.1f%% %10.1f\n", "builder", calls, moves,
+         100.0 * moves / calls, elapsed * 1e9 / calls);
+}
+
+int main(void) {
+  printf("%-10s %10s %10s %10s %10s\n", "workload", "reallocs", "moves",
+         "moved", "ns/call");
+  bench_doubling();
+  bench_builders();
+  return 0;
+}
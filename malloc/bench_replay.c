@@ -0,0 +1,362 @@
+#include "malloc_ext.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Replays a trace recorded with MALLOC_TRACE_FILE and reports throughput,
+ * per-call latency percentiles and peak RSS. Record a trace with
+ *   MALLOC_TRACE_FILE=/tmp/prog.trace LD_PRELOAD=./build/malloc.so ./prog
+ * then replay it against the custom allocator and glibc with
+ *   LD_PRELOAD=./build/malloc.so ./build/bench_replay /tmp/prog.trace
+ *   ./build/bench_replay /tmp/prog.trace
+ *
+ * Records are put back in time order and their addresses turned into block
+ * numbers before anything is timed. The calls of all threads are replayed
+ * by a single thread. The trace is replayed twice: once untimed per call, for
+ * throughput and RSS, then again timing every call.
+ *
+ * The replay's own memory comes from mmap, so the heap only holds the
+ * replayed blocks.
+ */
+
+#define RSS_SAMPLE_INTERVAL 4096 // Calls between RSS samples
+
+typedef struct {
+  uint32_t op; // MALLOC_TRACE_* from malloc_ext.h
+  uint32_t id; // Block number
+  uint64_t size;
+  uint64_t alignment; // For MALLOC_TRACE_MEMALIGN
+} Call;
+
+typedef struct {
+  Call *calls;
+  size_t count;
+  size_t num_ids;
+  uint32_t threads;
+  size_t skipped; // Frees of blocks allocated before tracing, failed calls
+} Replay;
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void *map_zeroed(size_t size) {
+  void *ptr = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+// ---------------------------------------------------------------------------
+// Turning addresses into block numbers
+// ---------------------------------------------------------------------------
+
+/* Open addressing with linear probing, of the blocks live in the trace */
+typedef struct {
+  uint64_t *addrs; // 0 for an empty slot
+  uint32_t *ids;
+  size_t mask;
+} AddrMap;
+
+static size_t addr_slot(const AddrMap *map, uint64_t addr) {
+  size_t slot = (addr * 0x9E3779B97F4A7C15ULL) >> 20 & map->mask;
+  while (map->addrs[slot] && map->addrs[slot] != addr) {
+    slot = (slot + 1) & map->mask;
+  }
+  return slot;
+}
+
+static int addr_find(const AddrMap *map, uint64_t addr, uint32_t *id) {
+  size_t slot = addr_slot(map, addr);
+  *id = map->ids[slot];
+  return map->addrs[slot] != 0;
+}
+
+static void addr_insert(AddrMap *map, uint64_t addr, uint32_t id) {
+  size_t slot = addr_slot(map, addr);
+  map->addrs[slot] = addr;
+  map->ids[slot] = id;
+}
+
+/* Backward-shift deletion, so lookups never need tombstones */
+static void addr_remove(AddrMap *map, uint64_t addr) {
+  size_t hole = addr_slot(map, addr);
+  if (!map->addrs[hole]) {
+    return;
+  }
+  map->addrs[hole] = 0;
+
+  for (size_t slot = (hole + 1) & map->mask; map->addrs[slot];
+       slot = (slot + 1) & map->mask) {
+    size_t home = (map->addrs[slot] * 0x9E3779B97F4A7C15ULL) >> 20 & map->mask;
+    // Move the entry into the hole unless its home lies between the two
+    if (((slot - home) & map->mask) >= ((slot - hole) & map->mask)) {
+      map->addrs[hole] = map->addrs[slot];
+      map->ids[hole] = map->ids[slot];
+      map->addrs[slot] = 0;
+      hole = slot;
+    }
+  }
+}
+
+// A record's time and its position in the file, which is what gets sorted
+typedef struct {
+  uint64_t time;
+  size_t index;
+} Order;
+
+static int by_time(const void *a, const void *b) {
+  const Order *x = a, *y = b;
+  if (x->time != y->time) {
+    return x->time < y->time ? -1 : 1;
+  }
+  // Same tick: keep each thread's calls in recorded order
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+Replay load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+
+  MallocTraceHeader header;
+  if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+      memcmp(header.magic, MALLOC_TRACE_MAGIC, 8) != 0 ||
+      header.record_size != sizeof(MallocTraceRecord)) {
+    fprintf(stderr, "%s: not a malloc trace of this version\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  size_t count = (st.st_size - sizeof(header)) / sizeof(MallocTraceRecord);
+  MallocTraceRecord *records = map_zeroed(count * sizeof(MallocTraceRecord));
+  size_t length = count * sizeof(MallocTraceRecord);
+  for (size_t done = 0; done < length;) {
+    ssize_t n = read(fd, (char *)records + done, length - done);
+    if (n <= 0) {
+      fprintf(stderr, "%s: short read\n", path);
+      exit(EXIT_FAILURE);
+    }
+    done += n;
+  }
+  close(fd);
+
+  // Stable, because equal timestamps are ordered by position in the file
+  Order *order = map_zeroed(count * sizeof(Order));
+  for (size_t i = 0; i < count; ++i) {
+    order[i].time = records[i].time;
+    order[i].index = i;
+  }
+  qsort(order, count, sizeof(Order), by_time);
+
+  size_t capacity = 1024;
+  while (capacity < 2 * count) {
+    capacity *= 2;
+  }
+  AddrMap map = {map_zeroed(capacity * sizeof(uint64_t)),
+                 map_zeroed(capacity * sizeof(uint32_t)), capacity - 1};
+  Replay replay = {map_zeroed(count * sizeof(Call)), 0, 0, 0, 0};
+
+  for (size_t i = 0; i < count; ++i) {
+    MallocTraceRecord *record = &records[order[i].index];
+    Call call = {record->op, 0, record->size, 0};
+    uint32_t id;
+    replay.threads =
+        record->thread > replay.threads ? record->thread : replay.threads;
+
+    switch (record->op) {
+    case MALLOC_TRACE_FREE:
+      if (!addr_find(&map, record->ptr, &id)) {
+        replay.skipped += 1;
+        continue;
+      }
+      addr_remove(&map, record->ptr);
+      call.id = id;
+      break;
+    case MALLOC_TRACE_REALLOC:
+      if (record->old_ptr && addr_find(&map, record->old_ptr, &id)) {
+        addr_remove(&map, record->old_ptr);
+      } else {
+        // realloc(NULL, ...), or a block from before the trace started: all
+        // we can do is allocate it
+        id = replay.num_ids++;
+      }
+      call.id = id;
+      if (record->ptr) {
+        addr_insert(&map, record->ptr, id);
+      } else if (record->size) {
+        replay.skipped += 1; // Failed, the old block is still there
+        addr_insert(&map, record->old_ptr, id);
+        continue;
+      }
+      break;
+    case MALLOC_TRACE_MEMALIGN:
+      call.alignment = record->old_ptr < sizeof(void *) ? sizeof(void *)
+                                                        : record->old_ptr;
+      // fall through
+    default:
+      if (!record->ptr) {
+        replay.skipped += 1;
+        continue;
+      }
+      call.id = replay.num_ids++;
+      addr_insert(&map, record->ptr, call.id);
+      break;
+    }
+    replay.calls[replay.count++] = call;
+  }
+
+  munmap(records, count * sizeof(MallocTraceRecord));
+  munmap(order, count * sizeof(Order));
+  munmap(map.addrs, capacity * sizeof(uint64_t));
+  munmap(map.ids, capacity * sizeof(uint32_t));
+  return replay;
+}
+
+// ---------------------------------------------------------------------------
+// Replaying
+// ---------------------------------------------------------------------------
+
+/* Resident set size in bytes, read without allocating */
+static size_t current_rss(int statm_fd) {
+  char buf[64];
+  ssize_t n = pread(statm_fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) {
+    return 0;
+  }
+  buf[n] = '\0';
+  char *field = strchr(buf, ' ');
+  return field ? strtoul(field + 1, NULL, 10) * sysconf(_SC_PAGESIZE) : 0;
+}
+
+static inline void play(const Call *call, void **ptrs) {
+  void **ptr = &ptrs[call->id];
+  switch (call->op) {
+  case MALLOC_TRACE_MALLOC:
+    *ptr = malloc(call->size);
+    break;
+  case MALLOC_TRACE_CALLOC:
+    *ptr = calloc(1, call->size);
+    break;
+  case MALLOC_TRACE_REALLOC:
+    *ptr = realloc(*ptr, call->size);
+    break;
+  case MALLOC_TRACE_MEMALIGN:
+    if (posix_memalign(ptr, call->alignment, call->size) != 0) {
+      *ptr = NULL;
+    }
+    break;
+  default:
+    free(*ptr);
+    *ptr = NULL;
+    return;
+  }
+  if (*ptr && call->size) {
+    *(char *)*ptr = 1; // Touch it, like the program would
+  }
+}
+
+static void free_all(const Replay *replay, void **ptrs) {
+  for (size_t id = 0; id < replay->num_ids; ++id) {
+    free(ptrs[id]);
+    ptrs[id] = NULL;
+  }
+}
+
+static int by_latency(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_percentiles(const char *name, uint32_t *latencies,
+                              size_t count) {
+  if (!count) {
+    return;
+  }
+  qsort(latencies, count, sizeof(uint32_t), by_latency);
+  printf("%-8s %10zu %8u %8u %8u %8u %10u\n", name, count,
+         latencies[count / 2], latencies[count * 9 / 10],
+         latencies[count * 99 / 100], latencies[count * 999 / 1000],
+         latencies[count - 1]);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Replay replay = load(argv[1]);
+  void **ptrs = map_zeroed(replay.num_ids * sizeof(void *));
+  uint32_t *latencies = map_zeroed(replay.count * sizeof(uint32_t));
+  int statm_fd = open("/proc/self/statm", O_RDONLY);
+
+  printf("%zu calls from %u threads, %zu blocks, %zu calls skipped\n",
+         replay.count, replay.threads, replay.num_ids, replay.skipped);
+
+  // Throughput and RSS
+  size_t rss_start = current_rss(statm_fd);
+  size_t rss_peak = rss_start;
+  double start = now();
+  for (size_t i = 0; i < replay.count; ++i) {
+    play(&replay.calls[i], ptrs);
+    if (i % RSS_SAMPLE_INTERVAL == 0) {
+      size_t rss = current_rss(statm_fd);
+      rss_peak = rss > rss_peak ? rss : rss_peak;
+    }
+  }
+  double elapsed = now() - start;
+  free_all(&replay, ptrs);
+
+  // Latency of every call
+  for (size_t i = 0; i < replay.count; ++i) {
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    play(&replay.calls[i], ptrs);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    int64_t ns = (after.tv_sec - before.tv_sec) * 1000000000LL +
+                 (after.tv_nsec - before.tv_nsec);
+    latencies[i] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+  }
+  free_all(&replay, ptrs);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("throughput: %.2f M calls/s (%.1f ns per call)\n",
+         replay.count / elapsed / 1e6, elapsed * 1e9 / replay.count);
+  printf("peak RSS:   %zu KiB above the %zu KiB at start (max RSS %ld KiB)\n",
+         (rss_peak - rss_start) / 1024, rss_start / 1024, usage.ru_maxrss);
+
+  // Percentiles per kind of call, grouped in place
+  const char *names[] = {"",       "malloc", "free",
+                         "realloc", "calloc", "memalign"};
+  uint32_t *grouped = map_zeroed(replay.count * sizeof(uint32_t));
+  printf("%-8s %10s %8s %8s %8s %8s %10s\n", "ns", "calls", "p50", "p90",
+         "p99", "p99.9", "max");
+  for (uint32_t op = MALLOC_TRACE_MALLOC; op <= MALLOC_TRACE_MEMALIGN; ++op) {
+    size_t count = 0;
+    for (size_t i = 0; i < replay.count; ++i) {
+      if (replay.calls[i].op == op) {
+        grouped[count++] = latencies[i];
+      }
+    }
+    print_percentiles(names[op], grouped, count);
+  }
+  print_percentiles("all", latencies, replay.count);
+  return 0;
+}
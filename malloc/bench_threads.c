@@ -0,0 +1,66 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Allocator throughput as the number of threads grows from 1 to MAX_THREADS.
+ *
+ * Every thread runs the same malloc/free churn over a private working set of
+ * mostly small blocks, so a global lock shows up as flat (or falling) total
+ * throughput while per-thread caches should scale with the cores available.
+ *
+ * Run it against the custom allocator with
+ *   LD_PRELOAD=./build/malloc.so ./build/bench_threads
+ * and without LD_PRELOAD for the glibc baseline.
+ */
+
+#define MAX_THREADS 16
+#define WORKING_SET 256
+#define OPS_PER_THREAD 1000000
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void *worker(void *arg) {
+  unsigned seed = (unsigned)(size_t)arg;
+  void *slots[WORKING_SET] = {0};
+
+  for (size_t i = 0; i < OPS_PER_THREAD; ++i) {
+    size_t slot = rand_r(&seed) % WORKING_SET;
+    free(slots[slot]);
+    // 7 in 8 allocations are small enough for the thread cache
+    size_t size = rand_r(&seed) % 8 ? 8 + rand_r(&seed) % 256
+                                    : 512 + rand_r(&seed) % 4096;
+    slots[slot] = malloc(size);
+    *(char *)slots[slot] = 1;
+  }
+
+  for (size_t i = 0; i < WORKING_SET; ++i) {
+    free(slots[i]);
+  }
+  return NULL;
+}
+
+int main(void) {
+  pthread_t threads[MAX_THREADS];
+
+  printf("%8s %14s %16s\n", "threads", "total Mops/s", "per-thread Mops/s");
+  for (size_t num_threads = 1; num_threads <= MAX_THREADS; num_threads *= 2) {
+    double start = now();
+    for (size_t i = 0; i < num_threads; ++i) {
+      pthread_create(&threads[i], NULL, worker, (void *)(i + 1));
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+      pthread_join(threads[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    double total = num_threads * OPS_PER_THREAD / elapsed / 1e6;
+    printf("%8zu %14.2f %16.2f\n", num_threads, total, total / num_threads);
+  }
+  return 0;
+}
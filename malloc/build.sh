@@ -0,0 +1,20 @@
+#!/bin/bash
+
+set -xe
+
+# -fno-builtin stops the compiler from treating our own malloc/free as the
+# libc builtins (it would otherwise fold away the malloc/free pairs in tests)
+CFLAGS="-O3 -W -Wall -Wextra -fno-builtin -pthread"
+
+mkdir -p build
+gcc $CFLAGS malloc.c -o build/malloc
+gcc $CFLAGS -shared -fPIC malloc.c -o build/malloc.so
+gcc -O3 -W -Wall -Wextra bench_bins.c -o build/bench_bins
+gcc -O3 -W -Wall -Wextra -pthread bench_threads.c -o build/bench_threads
+gcc -O3 -W -Wall -Wextra bench_overhead.c -o build/bench_overhead
+gcc -O3 -W -Wall -Wextra bench_realloc.c -o build/bench_realloc
+gcc -O3 -W -Wall -Wextra bench_frag.c -o build/bench_frag
+gcc -O3 -W -Wall -Wextra bench_arena.c -o build/bench_arena
+gcc -O3 -W -Wall -Wextra bench_replay.c -o build/bench_replay
+
+./build/malloc
@@ -3,211 +3,1692 @@
  * The OS reserves stack and heap space for processes and sbrk lets us
  * manipulate the heap. sbrk(0) returns the current top of the heap. sbrk(foo)
  * increments the heap size by foo and returns a pointer to the previous top
+ *
+ * Large requests skip the heap and get their own mapping from mmap, and a big
+ * enough free block at the top of the heap is handed back with a negative sbrk
  */
 
+#define _GNU_SOURCE // mremap
+
+#include "malloc_ext.h"
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-struct BlockMeta {
-  size_t size;
-  struct BlockMeta *next;
-  struct BlockMeta *prev; // This would be useful for merging together adjacent
-                          // free blocks for both ahead and behind
-  int free;
-};
+/*
+ * Boundary-tag layout: a block is a one-word header followed by the payload.
+ *
+ *   in use: [ size | flags ][ payload .................................. ]
+ *   free:   [ size | flags ][ next_free ][ prev_free ] ...... [ size ]
+ *
+ * `size` is the size of the whole block, header included, and is always a
+ * multiple of ALIGNMENT so its low bits are free to hold the flags. Only free
+ * blocks carry a footer, an in-use block lends that word to its payload. The
+ * block after a free one has PREV_FREE set, which is how we know the footer
+ * right before its header is valid.
+ *
+ * Physical neighbours are found by address arithmetic: the next block starts
+ * `size` bytes further, the previous one `footer` bytes back. Every sbrk
+ * segment ends with an in-use sentinel header of size 0 so walking forward
+ * always stops there.
+ *
+ * Payloads are aligned to ALIGNMENT, 16 bytes as for any SIMD or long double
+ * type, so headers sit 8 bytes below an aligned address.
+ */
+struct BlockMeta {
+  size_t size; // Block size with the flags below packed into the low bits
+};
+
+/*
+ * While a block is free its payload is unused, so the links of its size-class
+ * free list are stored right there instead of growing `BlockMeta`
+ */
+struct FreeLinks {
+  struct BlockMeta *next_free;
+  struct BlockMeta *prev_free;
+};
+
+#define ALIGNMENT 16
+#define ALIGN(size)                                                            \
+  (((size) + (ALIGNMENT - 1)) &                                                \
+   ~(ALIGNMENT - 1)) // Rounding up to the nearest multiple of ALIGNMENT
+#define META_SIZE sizeof(struct BlockMeta)
+#define FOOTER_SIZE sizeof(size_t)
+#define MIN_BLOCK_SIZE                                                         \
+  ALIGN(META_SIZE + sizeof(struct FreeLinks) + FOOTER_SIZE)
+#define FREE_LINKS(block) ((struct FreeLinks *)((block) + 1))
+
+#define BLOCK_FREE 0x1    // This block is free
+#define PREV_FREE 0x2     // The block physically before this one is free
+#define BLOCK_MMAPPED 0x4 // Owns a private mapping, outside the sbrk heap
+#define FLAG_MASK (ALIGNMENT - 1)
+
+#define BLOCK_SIZE(block) ((block)->size & ~(size_t)FLAG_MASK)
+#define IS_FREE(block) ((block)->size & BLOCK_FREE)
+#define IS_MMAPPED(block) ((block)->size & BLOCK_MMAPPED)
+#define NEXT_BLOCK(block)                                                      \
+  ((struct BlockMeta *)((char *)(block) + BLOCK_SIZE(block)))
+#define FOOTER(block)                                                          \
+  ((size_t *)((char *)(block) + BLOCK_SIZE(block) - FOOTER_SIZE))
+
+/*
+ * Size classes:
+ * - small: one bin per ALIGNMENT step below SMALL_BIN_LIMIT, every block in a
+ *          bin has exactly the same size so push/pop is O(1). A bitmap of
+ *          non-empty bins lets us jump straight to the next usable bin
+ *          instead of walking empty ones
+ * - large: everything from SMALL_BIN_LIMIT up lives in one balanced tree
+ *          ordered by size, so the placement policy is an O(log n) search
+ * Large blocks are still counted in one class per power of two for the
+ * statistics
+ */
+#define SMALL_BIN_LIMIT 1024
+#define SMALL_BIN_SHIFT 10 // log2(SMALL_BIN_LIMIT)
+#define NUM_SMALL_BINS (SMALL_BIN_LIMIT / ALIGNMENT)
+#define NUM_LARGE_CLASSES 64
+#define NUM_CLASSES (NUM_SMALL_BINS + NUM_LARGE_CLASSES)
+
+#define TCACHE_MAX_SIZE 512 // Sizes below this are cached per thread
+#define TCACHE_BINS (TCACHE_MAX_SIZE / ALIGNMENT)
+#define TCACHE_COUNT 16 // Max cached blocks per size class and thread
+#define TCACHE_BATCH 8  // Blocks moved into the cache on a miss
+
+void *global_base = NULL; // The first block of the heap
+static struct BlockMeta *heap_sentinel = NULL; // End of the current segment
+static struct BlockMeta *bins[NUM_SMALL_BINS];
+static uint64_t bin_map[NUM_SMALL_BINS / 64];
+static struct BlockMeta *large_tree = NULL; // Root of the large block tree
+static int placement_policy = MALLOC_BEST_FIT;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+_Static_assert(NUM_CLASSES == MALLOC_STATS_CLASSES,
+               "malloc_ext.h must report one class per size class");
+
+/*
+ * Counters behind malloc_get_stats(). They are plain increments on paths that
+ * already hold `heap_lock`; the lock-free mmap path uses relaxed atomics and
+ * thread caches count their own hits.
+ */
+static struct {
+  size_t heap_bytes;
+  size_t heap_peak_bytes;
+  size_t sbrk_calls;
+  size_t trimmed_bytes;
+  size_t mmap_bytes;
+  size_t mmap_blocks;
+  size_t mmap_total;
+  size_t bytes_in_use; // Heap blocks not in a bin, thread caches included
+  size_t blocks_in_use;
+  size_t bytes_free;
+  size_t blocks_free;
+  size_t bin_searches;
+  size_t walk_steps;
+  size_t class_hits[NUM_CLASSES];
+  size_t class_misses[NUM_CLASSES];
+} stats;
+
+static void stats_heap_moved(intptr_t delta) {
+  stats.heap_bytes += delta;
+  stats.sbrk_calls += 1;
+  if (stats.heap_bytes > stats.heap_peak_bytes) {
+    stats.heap_peak_bytes = stats.heap_bytes;
+  }
+}
+
+/*
+ * Tunables, same meaning and parameter numbers as glibc's mallopt(3). They can
+ * also be set through the MALLOC_MMAP_THRESHOLD_ and MALLOC_TRIM_THRESHOLD_
+ * environment variables. The placement policy is our own M_PLACEMENT, or
+ * MALLOC_POLICY=first|best|address.
+ */
+#ifndef M_TRIM_THRESHOLD
+#define M_TRIM_THRESHOLD -1
+#endif
+#ifndef M_MMAP_THRESHOLD
+#define M_MMAP_THRESHOLD -3
+#endif
+#define DEFAULT_MMAP_THRESHOLD (128 * 1024)
+#define DEFAULT_TRIM_THRESHOLD (128 * 1024)
+#define HEAP_GROW_SIZE (64 * 1024) // Minimum sbrk step, also kept on trimming
+
+static size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+static size_t trim_threshold = DEFAULT_TRIM_THRESHOLD;
+static int params_loaded = 0;
+
+static void heap_lock_prepare(void) { pthread_mutex_lock(&heap_lock); }
+static void heap_lock_release(void) { pthread_mutex_unlock(&heap_lock); }
+
+static void heap_init(void) {
+  // Keep the heap consistent in the child if another thread held the lock
+  pthread_atfork(heap_lock_prepare, heap_lock_release, heap_lock_release);
+}
+
+static void stats_signal_handler(int signum);
+static int trace_open(const char *path);
+static void trace_stop(void);
+
+static void load_params(void) {
+  const char *env;
+  params_loaded = 1; // Set first, atexit() below may allocate
+
+  // Every way into the heap loads the parameters first
+  pthread_once(&heap_once, heap_init);
+
+  if ((env = getenv("MALLOC_MMAP_THRESHOLD_"))) {
+    mmap_threshold = strtoul(env, NULL, 0);
+  }
+  if ((env = getenv("MALLOC_TRIM_THRESHOLD_"))) {
+    trim_threshold = strtoul(env, NULL, 0);
+  }
+  if ((env = getenv("MALLOC_POLICY"))) {
+    if (strcmp(env, "first") == 0) {
+      placement_policy = MALLOC_FIRST_FIT;
+    } else if (strcmp(env, "best") == 0) {
+      placement_policy = MALLOC_BEST_FIT;
+    } else if (strcmp(env, "address") == 0) {
+      placement_policy = MALLOC_ADDRESS_ORDERED;
+    }
+  }
+
+  if ((env = getenv("MALLOC_TRACE_FILE")) && trace_open(env)) {
+    atexit(trace_stop);
+  }
+  if ((env = getenv("MALLOC_STATS")) && *env == '1') {
+    atexit(malloc_stats);
+  }
+  if ((env = getenv("MALLOC_STATS_SIGNAL"))) {
+    struct sigaction action = {0};
+    action.sa_handler = stats_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigaction(atoi(env), &action, NULL);
+  }
+}
+
+int mallopt(int param, int value) {
+  if (!params_loaded) {
+    load_params();
+  }
+  if (value < 0) {
+    return 0;
+  }
+
+  switch (param) {
+  case M_MMAP_THRESHOLD:
+    mmap_threshold = value;
+    return 1;
+  case M_TRIM_THRESHOLD:
+    trim_threshold = value;
+    return 1;
+  case M_PLACEMENT:
+    if (value > MALLOC_ADDRESS_ORDERED) {
+      return 0;
+    }
+    pthread_mutex_lock(&heap_lock);
+    placement_policy = value;
+    pthread_mutex_unlock(&heap_lock);
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static size_t size_to_bin(size_t size) {
+  if (size < SMALL_BIN_LIMIT) {
+    return size / ALIGNMENT;
+  }
+
+  size_t bin = NUM_SMALL_BINS + (63 - __builtin_clzll(size)) - SMALL_BIN_SHIFT;
+  return bin < NUM_CLASSES ? bin : NUM_CLASSES - 1;
+}
+
+// ---------------------------------------------------------------------------
+// Large block tree
+// ---------------------------------------------------------------------------
+
+/*
+ * Free large blocks form a treap: a binary search tree ordered by (size,
+ * address), which makes every key unique, and a heap on a priority hashed
+ * from the address, which keeps it balanced in expectation without storing
+ * any balance information. Every node also remembers the lowest-addressed
+ * block of its subtree, so the address-ordered search is O(log n) as well.
+ * Like the bin links, the node lives in the payload of the free block.
+ */
+struct TreeNode {
+  struct BlockMeta *left;
+  struct BlockMeta *right;
+  struct BlockMeta *lowest; // Lowest-addressed block in this subtree
+};
+
+#define TREE_NODE(block) ((struct TreeNode *)((block) + 1))
+
+static uint32_t tree_priority(struct BlockMeta *block) {
+  return ((uintptr_t)block * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+static int tree_less(struct BlockMeta *a, struct BlockMeta *b) {
+  if (BLOCK_SIZE(a) != BLOCK_SIZE(b)) {
+    return BLOCK_SIZE(a) < BLOCK_SIZE(b);
+  }
+  return a < b;
+}
+
+static void tree_update(struct BlockMeta *block) {
+  struct TreeNode *node = TREE_NODE(block);
+  node->lowest = block;
+  if (node->left && TREE_NODE(node->left)->lowest < node->lowest) {
+    node->lowest = TREE_NODE(node->left)->lowest;
+  }
+  if (node->right && TREE_NODE(node->right)->lowest < node->lowest) {
+    node->lowest = TREE_NODE(node->right)->lowest;
+  }
+}
+
+static struct BlockMeta *tree_rotate_right(struct BlockMeta *root) {
+  struct BlockMeta *left = TREE_NODE(root)->left;
+  TREE_NODE(root)->left = TREE_NODE(left)->right;
+  tree_update(root);
+  TREE_NODE(left)->right = root;
+  tree_update(left);
+  return left;
+}
+
+static struct BlockMeta *tree_rotate_left(struct BlockMeta *root) {
+  struct BlockMeta *right = TREE_NODE(root)->right;
+  TREE_NODE(root)->right = TREE_NODE(right)->left;
+  tree_update(root);
+  TREE_NODE(right)->left = root;
+  tree_update(right);
+  return right;
+}
+
+static struct BlockMeta *tree_insert(struct BlockMeta *root,
+                                     struct BlockMeta *block) {
+  if (!root) {
+    TREE_NODE(block)->left = TREE_NODE(block)->right = NULL;
+    TREE_NODE(block)->lowest = block;
+    return block;
+  }
+
+  struct TreeNode *node = TREE_NODE(root);
+  if (tree_less(block, root)) {
+    node->left = tree_insert(node->left, block);
+    if (tree_priority(node->left) > tree_priority(root)) {
+      return tree_rotate_right(root);
+    }
+  } else {
+    node->right = tree_insert(node->right, block);
+    if (tree_priority(node->right) > tree_priority(root)) {
+      return tree_rotate_left(root);
+    }
+  }
+  tree_update(root);
+  return root;
+}
+
+/* Joins two treaps where every key of `left` is below every key of `right` */
+static struct BlockMeta *tree_merge(struct BlockMeta *left,
+                                    struct BlockMeta *right) {
+  if (!left || !right) {
+    return left ? left : right;
+  }
+  if (tree_priority(left) > tree_priority(right)) {
+    TREE_NODE(left)->right = tree_merge(TREE_NODE(left)->right, right);
+    tree_update(left);
+    return left;
+  }
+  TREE_NODE(right)->left = tree_merge(left, TREE_NODE(right)->left);
+  tree_update(right);
+  return right;
+}
+
+static struct BlockMeta *tree_remove(struct BlockMeta *root,
+                                     struct BlockMeta *block) {
+  struct TreeNode *node = TREE_NODE(root);
+  if (root == block) {
+    return tree_merge(node->left, node->right);
+  }
+  if (tree_less(block, root)) {
+    node->left = tree_remove(node->left, block);
+  } else {
+    node->right = tree_remove(node->right, block);
+  }
+  tree_update(root);
+  return root;
+}
+
+/*
+ * The placement policies, all of them a single walk down the tree:
+ * - first fit: the first block on the way down that is big enough. The
+ *   cheapest search, with no preference between the blocks that fit
+ * - best fit: the smallest block that fits, the lowest-addressed one among
+ *   blocks of that size. Leaves the biggest blocks alone for big requests
+ * - address-ordered: the lowest-addressed block that fits. Packs the heap
+ *   towards its start so the top stays free and can be trimmed
+ */
+static struct BlockMeta *tree_find(size_t size) {
+  struct BlockMeta *block = large_tree;
+  struct BlockMeta *fit = NULL;
+
+  while (block) {
+    struct TreeNode *node = TREE_NODE(block);
+    stats.walk_steps += 1;
+    if (BLOCK_SIZE(block) < size) {
+      block = node->right;
+      continue;
+    }
+
+    switch (placement_policy) {
+    case MALLOC_FIRST_FIT:
+      return block;
+    case MALLOC_BEST_FIT:
+      fit = block;
+      break;
+    case MALLOC_ADDRESS_ORDERED:
+      // This block and its whole right subtree fit, the left one may not
+      if (!fit || block < fit) {
+        fit = block;
+      }
+      if (node->right && TREE_NODE(node->right)->lowest < fit) {
+        fit = TREE_NODE(node->right)->lowest;
+      }
+      break;
+    }
+    block = node->left;
+  }
+  return fit;
+}
+
+// ---------------------------------------------------------------------------
+// Free block index
+// ---------------------------------------------------------------------------
+
+static void bin_insert(struct BlockMeta *block) {
+  stats.bytes_free += BLOCK_SIZE(block);
+  stats.blocks_free += 1;
+
+  if (BLOCK_SIZE(block) >= SMALL_BIN_LIMIT) {
+    large_tree = tree_insert(large_tree, block);
+    return;
+  }
+
+  size_t bin = size_to_bin(BLOCK_SIZE(block));
+  struct FreeLinks *links = FREE_LINKS(block);
+
+  links->prev_free = NULL;
+  links->next_free = bins[bin];
+  if (bins[bin]) {
+    FREE_LINKS(bins[bin])->prev_free = block;
+  }
+  bins[bin] = block;
+  bin_map[bin / 64] |= 1ULL << (bin % 64);
+}
+
+static void bin_remove(struct BlockMeta *block) {
+  stats.bytes_free -= BLOCK_SIZE(block);
+  stats.blocks_free -= 1;
+
+  if (BLOCK_SIZE(block) >= SMALL_BIN_LIMIT) {
+    large_tree = tree_remove(large_tree, block);
+    return;
+  }
+
+  size_t bin = size_to_bin(BLOCK_SIZE(block));
+  struct FreeLinks *links = FREE_LINKS(block);
+
+  if (links->prev_free) {
+    FREE_LINKS(links->prev_free)->next_free = links->next_free;
+  } else {
+    bins[bin] = links->next_free;
+    if (!bins[bin]) {
+      bin_map[bin / 64] &= ~(1ULL << (bin % 64));
+    }
+  }
+  if (links->next_free) {
+    FREE_LINKS(links->next_free)->prev_free = links->prev_free;
+  }
+}
+
+/*
+ * Index of the first non-empty small bin at or after `bin`, or NUM_SMALL_BINS
+ * if there is none
+ */
+static size_t next_nonempty_bin(size_t bin) {
+  while (bin < NUM_SMALL_BINS) {
+    uint64_t word = bin_map[bin / 64] & (~0ULL << (bin % 64));
+    if (word) {
+      return (bin & ~(size_t)63) + __builtin_ctzll(word);
+    }
+    bin = (bin & ~(size_t)63) + 64;
+  }
+  return NUM_SMALL_BINS;
+}
+
+/*
+ * Small requests are answered by their exact bin, or else the next non-empty
+ * one, which holds the smallest small block that fits. Everything else is up
+ * to the placement policy in the large block tree.
+ */
+struct BlockMeta *find_free_block(size_t size) {
+  stats.bin_searches += 1;
+
+  if (size < SMALL_BIN_LIMIT) {
+    size_t bin = next_nonempty_bin(size_to_bin(size));
+    if (bin < NUM_SMALL_BINS) {
+      stats.walk_steps += 1;
+      return bins[bin];
+    }
+  }
+  return tree_find(size);
+}
+
+static size_t page_round(size_t size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/* Marks `block` free, writes its footer and tells the next block about it */
+static void set_free(struct BlockMeta *block, size_t size) {
+  block->size = size | BLOCK_FREE | (block->size & PREV_FREE);
+  *FOOTER(block) = size;
+  NEXT_BLOCK(block)->size |= PREV_FREE;
+}
+
+static void set_in_use(struct BlockMeta *block) {
+  block->size &= ~(size_t)BLOCK_FREE;
+  NEXT_BLOCK(block)->size &= ~(size_t)PREV_FREE;
+}
+
+/*
+ * Just a Helper Function, does not return the pointer to the allocated memory
+ * to the client directly. Need to modify the pointer to only point to the
+ * eequested size, and not the metadata
+ *
+ * Returns an in-use block of at least `size` bytes at the top of the heap. If
+ * the heap still ends where we left it, the new block takes the place of the
+ * sentinel and absorbs a free block in front of it, so only the difference is
+ * requested from the OS. Otherwise a new segment is started. The heap grows
+ * by at least HEAP_GROW_SIZE so that a run of small requests doesn't turn
+ * into one sbrk call each, the caller splits off what it doesn't need.
+ */
+struct BlockMeta *request_space(size_t size) {
+  struct BlockMeta *block;
+  char *top = sbrk(0);
+
+  if (heap_sentinel && top == (char *)heap_sentinel + META_SIZE) {
+    block = heap_sentinel;
+    size_t have = 0;
+    if (block->size & PREV_FREE) {
+      block = (struct BlockMeta *)((char *)block - *((size_t *)block - 1));
+      have = BLOCK_SIZE(block);
+      bin_remove(block);
+    }
+    if (have < size) {
+      size_t grow = page_round(size - have);
+      grow = grow < HEAP_GROW_SIZE ? HEAP_GROW_SIZE : grow;
+      if (sbrk(grow) == (void *)-1) {
+        if (have) {
+          bin_insert(block);
+        }
+        return NULL;
+      }
+      have += grow;
+      stats_heap_moved(grow);
+    }
+    block->size = have; // The block before a free one is never free itself
+  } else {
+    // Start a new segment, with its payload aligned and room for a sentinel
+    size_t pad = ALIGN((uintptr_t)top + META_SIZE) - META_SIZE - (uintptr_t)top;
+    size = size < HEAP_GROW_SIZE ? HEAP_GROW_SIZE : size;
+    if (sbrk(pad + size + META_SIZE) == (void *)-1) {
+      return NULL;
+    }
+    block = (struct BlockMeta *)(top + pad);
+    block->size = size;
+    stats_heap_moved(pad + size + META_SIZE);
+    if (!global_base) { // First call
+      global_base = block;
+    }
+  }
+
+  heap_sentinel = NEXT_BLOCK(block);
+  heap_sentinel->size = 0;
+  return block;
+}
+
+/*
+ * A mapped block starts wherever its payload comes out aligned, and the word
+ * before its header holds how far into the mapping that is
+ */
+#define MMAP_OFFSET(block) (((size_t *)(block))[-1])
+#define MMAP_BASE(block) ((char *)(block) - MMAP_OFFSET(block))
+#define MMAP_LENGTH(block) page_round(MMAP_OFFSET(block) + BLOCK_SIZE(block))
+
+/*
+ * Large blocks get a private mapping. They have no neighbours, so the whole
+ * mapping goes back to the OS on free. The payload is `alignment` bytes into
+ * the mapping, or a page for bigger alignments, where we map extra and unmap
+ * whatever is left in front of and after the aligned block.
+ */
+static struct BlockMeta *mmap_block(size_t size, size_t alignment) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t payload = alignment < page_size ? alignment : page_size;
+  payload = payload < ALIGNMENT ? ALIGNMENT : payload;
+  size_t length = page_round(payload - META_SIZE + size);
+  size_t slack = alignment > page_size ? alignment : 0;
+
+  char *base = mmap(NULL, length + slack, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  if (slack) {
+    char *start = base;
+    base = (char *)(((uintptr_t)base + payload + alignment - 1) &
+                    ~(uintptr_t)(alignment - 1)) -
+           payload;
+    if (base > start) {
+      munmap(start, base - start);
+    }
+    munmap(base + length, start + length + slack - (base + length));
+  }
+
+  struct BlockMeta *block = (struct BlockMeta *)(base + payload - META_SIZE);
+  MMAP_OFFSET(block) = payload - META_SIZE;
+  block->size = ((length - MMAP_OFFSET(block)) & ~(size_t)FLAG_MASK) |
+                BLOCK_MMAPPED;
+
+  __atomic_fetch_add(&stats.mmap_bytes, length, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.mmap_blocks, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.mmap_total, 1, __ATOMIC_RELAXED);
+  return block;
+}
+
+static void munmap_block(struct BlockMeta *block) {
+  size_t length = MMAP_LENGTH(block);
+  __atomic_fetch_sub(&stats.mmap_bytes, length, __ATOMIC_RELAXED);
+  __atomic_fetch_sub(&stats.mmap_blocks, 1, __ATOMIC_RELAXED);
+  munmap(MMAP_BASE(block), length);
+}
+
+/*
+ * Gives a free block at the very top of the heap back to the OS once it
+ * reaches the trim threshold, keeping HEAP_GROW_SIZE of it around for the
+ * next requests. Must be called before `block` goes into a bin.
+ */
+static void heap_trim(struct BlockMeta *block) {
+  size_t length = BLOCK_SIZE(block);
+  if (NEXT_BLOCK(block) != heap_sentinel || length < trim_threshold ||
+      length < HEAP_GROW_SIZE + MIN_BLOCK_SIZE) {
+    return;
+  }
+  // Someone else moved the break past us, the top isn't ours to release
+  if ((char *)sbrk(0) != (char *)heap_sentinel + META_SIZE) {
+    return;
+  }
+
+  size_t release = (length - HEAP_GROW_SIZE) & ~(size_t)FLAG_MASK;
+  sbrk(-(intptr_t)release);
+  stats_heap_moved(-(intptr_t)release);
+  stats.trimmed_bytes += release;
+  set_free(block, length - release);
+  heap_sentinel = NEXT_BLOCK(block);
+  heap_sentinel->size = PREV_FREE;
+}
+
+/*
+ * Given a pointer to a memory block, return a pointer that points to the
+ * starting of the associated metadata for that particular block
+ */
+struct BlockMeta *get_block_ptr(void *ptr) {
+  // Going through an integer keeps the compiler from assuming `ptr` is the
+  // start of the object malloc() returned and warning about the negative index
+  return (struct BlockMeta *)((uintptr_t)ptr - META_SIZE);
+}
+
+/*
+ * Shrink the in-use `block` to `size` if the tail is big enough to hold a
+ * block of its own, and hand the tail back to its bin
+ */
+static void split_block(struct BlockMeta *block, size_t size) {
+  size_t block_size = BLOCK_SIZE(block);
+  if (block_size - size < MIN_BLOCK_SIZE) {
+    return;
+  }
+
+  block->size = size | (block->size & FLAG_MASK);
+
+  struct BlockMeta *split = NEXT_BLOCK(block);
+  split->size = 0;
+  set_free(split, block_size - size);
+  bin_insert(split);
+}
+
+/*
+ * Everything below touches the shared heap and must be called with
+ * `heap_lock` held
+ */
+static struct BlockMeta *heap_alloc(size_t size) {
+  struct BlockMeta *block = find_free_block(size);
+
+  if (!block) { // Couldn't find a suitable free block
+    block = request_space(size);
+    if (!block) {
+      return NULL;
+    }
+    stats.class_misses[size_to_bin(size)] += 1;
+  } else { // found a free block
+    bin_remove(block);
+    set_in_use(block);
+    stats.class_hits[size_to_bin(size)] += 1;
+  }
+  split_block(block, size);
+
+  stats.bytes_in_use += BLOCK_SIZE(block);
+  stats.blocks_in_use += 1;
+  return block;
+}
+
+static void heap_free(struct BlockMeta *block_ptr) {
+  assert(!IS_FREE(block_ptr));
+  size_t size = BLOCK_SIZE(block_ptr);
+  stats.bytes_in_use -= size;
+  stats.blocks_in_use -= 1;
+
+  // -------------------------------------------------------------------------
+  // coalescing adjacent free blocks together into one to avoid fragmentation
+  // -------------------------------------------------------------------------
+
+  // Merge with the next block if free
+  struct BlockMeta *next = NEXT_BLOCK(block_ptr);
+  if (IS_FREE(next)) {
+    bin_remove(next);
+    size += BLOCK_SIZE(next);
+  }
+  // Merge with the previous block if free, its size is in the footer
+  if (block_ptr->size & PREV_FREE) {
+    size_t prev_size = *((size_t *)block_ptr - 1);
+    block_ptr = (struct BlockMeta *)((char *)block_ptr - prev_size);
+    bin_remove(block_ptr);
+    size += prev_size;
+  }
+
+  set_free(block_ptr, size);
+  heap_trim(block_ptr);
+  bin_insert(block_ptr);
+}
+
+/*
+ * Shrinks the in-use `block` to `size` in place. The tail is released like any
+ * freed block, so it merges with a free successor.
+ */
+static void heap_shrink(struct BlockMeta *block, size_t size) {
+  size_t block_size = BLOCK_SIZE(block);
+  if (block_size - size < MIN_BLOCK_SIZE) {
+    return;
+  }
+
+  block->size = size | (block->size & FLAG_MASK);
+  struct BlockMeta *tail = NEXT_BLOCK(block);
+  tail->size = block_size - size; // In use, and so is the block before it
+  stats.blocks_in_use += 1;       // heap_free() is about to count it out
+  heap_free(tail);
+}
+
+/*
+ * Grows the in-use `block` to at least `size` without moving it, by absorbing
+ * a free successor and, if that puts us at the top of the heap, by moving the
+ * break. Returns 0 if the block has to move instead.
+ */
+static int heap_grow_in_place(struct BlockMeta *block, size_t size) {
+  size_t avail = BLOCK_SIZE(block);
+  struct BlockMeta *next = NEXT_BLOCK(block);
+  struct BlockMeta *after = next;
+  if (IS_FREE(next)) {
+    avail += BLOCK_SIZE(next);
+    after = NEXT_BLOCK(next);
+  }
+
+  size_t old_size = BLOCK_SIZE(block);
+  size_t grow = 0;
+  if (avail < size) {
+    if (after != heap_sentinel ||
+        (char *)sbrk(0) != (char *)heap_sentinel + META_SIZE) {
+      return 0;
+    }
+    grow = page_round(size - avail);
+    grow = grow < HEAP_GROW_SIZE ? HEAP_GROW_SIZE : grow;
+    if (sbrk(grow) == (void *)-1) {
+      return 0;
+    }
+    stats_heap_moved(grow);
+  }
+
+  if (IS_FREE(next)) {
+    bin_remove(next);
+  }
+  block->size = (avail + grow) | (block->size & FLAG_MASK);
+  if (grow) {
+    heap_sentinel = NEXT_BLOCK(block);
+    heap_sentinel->size = 0;
+  } else {
+    NEXT_BLOCK(block)->size &= ~(size_t)PREV_FREE;
+  }
+  split_block(block, size);
+  stats.bytes_in_use += BLOCK_SIZE(block) - old_size;
+  return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Per-thread cache (tcache)
+// ---------------------------------------------------------------------------
+
+/*
+ * Each thread keeps a few freed blocks of every small size class for itself.
+ * Cached blocks stay marked as in use, so the shared heap never coalesces
+ * them, and the owning thread pushes/pops them without taking `heap_lock`.
+ * The heap is only touched on a miss (refilled in batches from the exact bin)
+ * or when a bin overflows (half of it is flushed back under one lock).
+ */
+struct TCache {
+  struct BlockMeta *entries[TCACHE_BINS];
+  unsigned counts[TCACHE_BINS];
+  size_t hits[TCACHE_BINS];
+  int registered; // Thread exit destructor installed
+  // Every registered cache is on a list so statistics can sum them up
+  struct TCache *next_thread;
+  struct TCache *prev_thread;
+};
+
+static __thread struct TCache tcache
+    __attribute__((tls_model("initial-exec")));
+static struct TCache *tcache_threads = NULL; // Guarded by `heap_lock`
+static size_t retired_tcache_hits[TCACHE_BINS]; // From threads that exited
+
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+
+static void tcache_push(struct BlockMeta *block, size_t bin) {
+  FREE_LINKS(block)->next_free = tcache.entries[bin];
+  tcache.entries[bin] = block;
+  tcache.counts[bin] += 1;
+}
+
+static struct BlockMeta *tcache_pop(size_t bin) {
+  struct BlockMeta *block = tcache.entries[bin];
+  tcache.entries[bin] = FREE_LINKS(block)->next_free;
+  tcache.counts[bin] -= 1;
+  return block;
+}
+
+/* Hand `count` cached blocks of `bin` back to the shared heap */
+static void tcache_flush(size_t bin, unsigned count) {
+  pthread_mutex_lock(&heap_lock);
+  while (count-- > 0 && tcache.entries[bin]) {
+    heap_free(tcache_pop(bin));
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+static void tcache_thread_exit(void *unused) {
+  (void)unused;
+  for (size_t bin = 0; bin < TCACHE_BINS; ++bin) {
+    tcache_flush(bin, TCACHE_COUNT);
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  for (size_t bin = 0; bin < TCACHE_BINS; ++bin) {
+    retired_tcache_hits[bin] += tcache.hits[bin];
+    tcache.hits[bin] = 0;
+  }
+  if (tcache.prev_thread) {
+    tcache.prev_thread->next_thread = tcache.next_thread;
+  } else {
+    tcache_threads = tcache.next_thread;
+  }
+  if (tcache.next_thread) {
+    tcache.next_thread->prev_thread = tcache.prev_thread;
+  }
+  pthread_mutex_unlock(&heap_lock);
+
+  // A later malloc() or free() in this thread registers the cache again
+  tcache.registered = 0;
+}
+
+static void tcache_init(void) {
+  pthread_key_create(&tcache_key, tcache_thread_exit);
+}
+
+static void tcache_register(void) {
+  pthread_once(&tcache_once, tcache_init);
+  pthread_setspecific(tcache_key, &tcache);
+  tcache.registered = 1;
+
+  pthread_mutex_lock(&heap_lock);
+  tcache.prev_thread = NULL;
+  tcache.next_thread = tcache_threads;
+  if (tcache_threads) {
+    tcache_threads->prev_thread = &tcache;
+  }
+  tcache_threads = &tcache;
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * Moves up to TCACHE_BATCH blocks that fit `bin` exactly from the shared
+ * heap into the cache, so the next few misses don't need the lock
+ */
+static void tcache_refill(size_t bin) {
+  while (tcache.counts[bin] < TCACHE_BATCH && bins[bin]) {
+    struct BlockMeta *block = bins[bin];
+    bin_remove(block);
+    set_in_use(block);
+    tcache_push(block, bin);
+    stats.bytes_in_use += BLOCK_SIZE(block);
+    stats.blocks_in_use += 1;
+  }
+}
+
+/*
+ * Block size needed to serve a request of `size` bytes: the header plus the
+ * payload, rounded up, and never less than what a free block needs
+ */
+static size_t request_to_block_size(size_t size) {
+  size = ALIGN(size + META_SIZE);
+  return size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : size;
+}
+
+// ---------------------------------------------------------------------------
+// Tracing
+// ---------------------------------------------------------------------------
+
+/*
+ * With MALLOC_TRACE_FILE set, every malloc/free/realloc/calloc call is
+ * appended to that file as a MallocTraceRecord. Records are collected in a
+ * per-thread buffer and written out a buffer at a time, so the cost per call
+ * is a clock read and a few stores. Buffers are flushed when they fill up,
+ * when their thread exits and at exit. A forked child stops tracing, since
+ * its addresses would be mixed up with the parent's.
+ */
+#define TRACE_BUFFER 256 // Records per thread between writes
+
+struct TraceBuffer {
+  MallocTraceRecord records[TRACE_BUFFER];
+  unsigned count;
+  uint32_t thread; // 0 until the thread records its first call
+  // Every buffer is on a list so they can all be flushed at exit
+  struct TraceBuffer *next_thread;
+  struct TraceBuffer *prev_thread;
+};
+
+static int trace_fd = -1;
+static uint64_t trace_start;
+static uint32_t trace_threads = 0; // Thread numbers handed out so far
+static struct TraceBuffer *trace_buffers = NULL; // Guarded by `trace_lock`
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct TraceBuffer trace_buffer
+    __attribute__((tls_model("initial-exec")));
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+
+static uint64_t trace_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Must be called with `trace_lock` held */
+static void trace_flush_locked(struct TraceBuffer *buffer) {
+  if (buffer->count && trace_fd >= 0) {
+    size_t length = buffer->count * sizeof(MallocTraceRecord);
+    if (write(trace_fd, buffer->records, length) != (ssize_t)length) {
+      trace_fd = -1; // Give up rather than write a trace with holes
+    }
+  }
+  buffer->count = 0;
+}
+
+static void trace_thread_exit(void *unused) {
+  (void)unused;
+  pthread_mutex_lock(&trace_lock);
+  trace_flush_locked(&trace_buffer);
+  if (trace_buffer.prev_thread) {
+    trace_buffer.prev_thread->next_thread = trace_buffer.next_thread;
+  } else {
+    trace_buffers = trace_buffer.next_thread;
+  }
+  if (trace_buffer.next_thread) {
+    trace_buffer.next_thread->prev_thread = trace_buffer.prev_thread;
+  }
+  pthread_mutex_unlock(&trace_lock);
+
+  // Calls made by later destructors register the buffer again
+  trace_buffer.thread = 0;
+}
+
+/* Flushes every thread's buffer, others may still be running */
+static void trace_stop(void) {
+  pthread_mutex_lock(&trace_lock);
+  for (struct TraceBuffer *buffer = trace_buffers; buffer;
+       buffer = buffer->next_thread) {
+    trace_flush_locked(buffer);
+  }
+  if (trace_fd >= 0) {
+    close(trace_fd);
+    trace_fd = -1;
+  }
+  pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_fork_child(void) {
+  trace_fd = -1;
+  trace_buffer.count = 0;
+}
+
+static void trace_init(void) {
+  pthread_key_create(&trace_key, trace_thread_exit);
+  pthread_atfork(NULL, NULL, trace_fork_child);
+}
+
+/* Starts a trace in `path`, replacing what it held. Returns 0 on failure */
+static int trace_open(const char *path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                0644);
+  if (fd < 0) {
+    return 0;
+  }
+
+  MallocTraceHeader header = {MALLOC_TRACE_MAGIC, MALLOC_TRACE_VERSION,
+                              sizeof(MallocTraceRecord)};
+  if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+    close(fd);
+    return 0;
+  }
+
+  pthread_once(&trace_once, trace_init);
+  trace_start = trace_clock();
+  trace_fd = fd;
+  return 1;
+}
+
+static void trace_register(void) {
+  trace_buffer.thread = __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED);
+  pthread_setspecific(trace_key, &trace_buffer);
+
+  pthread_mutex_lock(&trace_lock);
+  trace_buffer.prev_thread = NULL;
+  trace_buffer.next_thread = trace_buffers;
+  if (trace_buffers) {
+    trace_buffers->prev_thread = &trace_buffer;
+  }
+  trace_buffers = &trace_buffer;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_record(uint32_t op, void *ptr, void *old_ptr, size_t size) {
+  if (!trace_buffer.thread) {
+    trace_register();
+  }
+
+  MallocTraceRecord *record = &trace_buffer.records[trace_buffer.count++];
+  record->time = trace_clock() - trace_start;
+  record->ptr = (uintptr_t)ptr;
+  record->old_ptr = (uintptr_t)old_ptr;
+  record->size = size;
+  record->thread = trace_buffer.thread;
+  record->op = op;
+
+  if (trace_buffer.count == TRACE_BUFFER) {
+    pthread_mutex_lock(&trace_lock);
+    trace_flush_locked(&trace_buffer);
+    pthread_mutex_unlock(&trace_lock);
+  }
+}
+
+#define TRACE(op, ptr, old_ptr, size)                                          \
+  do {                                                                         \
+    if (__builtin_expect(trace_fd >= 0, 0)) {                                  \
+      trace_record(op, ptr, old_ptr, size);                                    \
+    }                                                                          \
+  } while (0)
+
+// ---------------------------------------------------------------------------
+// Entry points
+// ---------------------------------------------------------------------------
+
+static void *do_malloc(size_t size) {
+  struct BlockMeta *block;
+
+  if (size <= 0 || size > SIZE_MAX / 2) {
+    return NULL;
+  }
+
+  size = request_to_block_size(size);
+
+  if (!params_loaded) {
+    load_params();
+  }
+  if (size >= mmap_threshold) {
+    block = mmap_block(size, ALIGNMENT);
+    return block ? block + 1 : NULL;
+  }
+
+  size_t bin = size_to_bin(size);
+  if (bin < TCACHE_BINS && tcache.entries[bin]) {
+    tcache.hits[bin] += 1;
+    return tcache_pop(bin) + 1;
+  }
+
+  // Refilled blocks must be on a registered cache, or they'd leak when the
+  // thread exits
+  if (bin < TCACHE_BINS && !tcache.registered) {
+    tcache_register();
+  }
+  pthread_mutex_lock(&heap_lock);
+  block = heap_alloc(size);
+  if (block && bin < TCACHE_BINS) {
+    tcache_refill(bin);
+  }
+  pthread_mutex_unlock(&heap_lock);
+
+  if (!block) {
+    return NULL;
+  }
+
+  // return a pointer to the region after block_meta
+  // +1 increments the address by one sizeof(struct BlockMeta)
+  return (block + 1);
+}
+
+static void do_free(void *ptr) {
+  if (!ptr)
+    return;
+
+  struct BlockMeta *block_ptr = get_block_ptr(ptr);
+  assert(!IS_FREE(block_ptr));
+
+  if (IS_MMAPPED(block_ptr)) {
+    munmap_block(block_ptr);
+    return;
+  }
+
+  size_t bin = size_to_bin(BLOCK_SIZE(block_ptr));
+  if (bin < TCACHE_BINS) {
+    if (!tcache.registered) {
+      tcache_register();
+    }
+    if (tcache.counts[bin] >= TCACHE_COUNT) {
+      tcache_flush(bin, TCACHE_COUNT / 2);
+    }
+    tcache_push(block_ptr, bin);
+    return;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  heap_free(block_ptr);
+  pthread_mutex_unlock(&heap_lock);
+}
+
+// Leaves freeing the old block, if it has to go, to the caller: it's set in
+// `*release`
+static void *do_realloc(void *ptr, size_t size, void **release) {
+  if (size <= 0) {
+    *release = ptr;
+    return NULL;
+  }
+  if (!ptr) {
+    // NULL pointer, realloc should act like malloc
+    return do_malloc(size);
+  }
+
+  struct BlockMeta *block_ptr = get_block_ptr(ptr);
+  size_t usable = BLOCK_SIZE(block_ptr) - META_SIZE;
+  if (size > SIZE_MAX / 2) {
+    return NULL;
+  }
+  size_t block_size = request_to_block_size(size);
+
+  if (!IS_MMAPPED(block_ptr)) {
+    // Shrink by splitting off the tail, grow into the free space after us or
+    // the top of the heap; either way nothing needs to be copied
+    int in_place = 1;
+    pthread_mutex_lock(&heap_lock);
+    if (block_size <= BLOCK_SIZE(block_ptr)) {
+      heap_shrink(block_ptr, block_size);
+    } else {
+      in_place = heap_grow_in_place(block_ptr, block_size);
+    }
+    pthread_mutex_unlock(&heap_lock);
+
+    if (in_place) {
+      return ptr;
+    }
+  } else if (usable >= size) {
+    // Enough space available already
+    return ptr;
+  }
+
+  // Let the kernel move the pages instead of copying them, unless tracing:
+  // mremap() frees the old pages, which can't be recorded before it
+  if (IS_MMAPPED(block_ptr) && size >= mmap_threshold && trace_fd < 0) {
+    size_t offset = MMAP_OFFSET(block_ptr);
+    size_t old_length = MMAP_LENGTH(block_ptr);
+    size_t length = page_round(offset + request_to_block_size(size));
+    char *base = mremap(MMAP_BASE(block_ptr), old_length, length,
+                        MREMAP_MAYMOVE);
+    if (base == MAP_FAILED) {
+      return NULL;
+    }
+    __atomic_fetch_add(&stats.mmap_bytes, length - old_length,
+                       __ATOMIC_RELAXED);
+    block_ptr = (struct BlockMeta *)(base + offset);
+    block_ptr->size = ((length - offset) & ~(size_t)FLAG_MASK) | BLOCK_MMAPPED;
+    return block_ptr + 1;
+  }
+
+  // Need to realloc. Malloc new space and free old space.
+  // Then copy the data to the new space
+  void *new_ptr;
+  new_ptr = do_malloc(size);
+  if (!new_ptr) {
+    return NULL;
+  }
+
+  memcpy(new_ptr, ptr, usable); // Only the old payload holds data, and it is
+                                // smaller than the new one
+  *release = ptr;
+  return new_ptr;
+}
+
+static void *do_calloc(size_t nelem, size_t elsize) {
+  if (nelem && (elsize > (SIZE_MAX / nelem))) {
+    return NULL; // Overflow
+  }
+  size_t size = nelem * elsize;
+  void *ptr = do_malloc(size);
+  // Fresh mappings are already zero-filled by the kernel
+  if (ptr && !IS_MMAPPED(get_block_ptr(ptr))) {
+    memset(ptr, 0, size);
+  }
+  return ptr;
+}
+
+/*
+ * Over-aligned blocks are carved out of a bigger heap block: the part in front
+ * of the aligned payload becomes a free block of its own, and so does the
+ * tail, so at most MIN_BLOCK_SIZE bytes are lost to alignment. `alignment`
+ * must be a power of two.
+ */
+static void *do_memalign(size_t alignment, size_t size) {
+  if (alignment <= ALIGNMENT) {
+    return do_malloc(size);
+  }
+  if (size <= 0 || size > SIZE_MAX / 4 || alignment > SIZE_MAX / 4) {
+    return NULL;
+  }
+
+  size = request_to_block_size(size);
+  if (!params_loaded) {
+    load_params();
+  }
+  if (size + alignment >= mmap_threshold) {
+    struct BlockMeta *block = mmap_block(size, alignment);
+    return block ? block + 1 : NULL;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  // Enough for the block plus a leading block to split off
+  struct BlockMeta *block = heap_alloc(size + alignment + MIN_BLOCK_SIZE);
+  if (!block) {
+    pthread_mutex_unlock(&heap_lock);
+    return NULL;
+  }
+
+  uintptr_t payload = ((uintptr_t)(block + 1) + alignment - 1) &
+                      ~(uintptr_t)(alignment - 1);
+  size_t lead = payload - (uintptr_t)(block + 1);
+  if (lead && lead < MIN_BLOCK_SIZE) {
+    payload += alignment; // Too small to stand on its own
+    lead += alignment;
+  }
+
+  if (lead) {
+    struct BlockMeta *aligned = (struct BlockMeta *)(payload - META_SIZE);
+    aligned->size = BLOCK_SIZE(block) - lead; // In use, like the lead for now
+    block->size = lead | (block->size & FLAG_MASK);
+    stats.blocks_in_use += 1; // heap_free() is about to count the lead out
+    heap_free(block);
+    block = aligned;
+  }
+  stats.bytes_in_use -= BLOCK_SIZE(block);
+  split_block(block, size);
+  stats.bytes_in_use += BLOCK_SIZE(block);
+  pthread_mutex_unlock(&heap_lock);
+
+  return block + 1;
+}
+
+void *malloc(size_t size) {
+  void *ptr = do_malloc(size);
+  TRACE(MALLOC_TRACE_MALLOC, ptr, NULL, size);
+  return ptr;
+}
+
+void free(void *ptr) {
+  if (ptr) {
+    // Recorded first: once it is free, another thread may get it back
+    TRACE(MALLOC_TRACE_FREE, ptr, NULL, 0);
+  }
+  do_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size) {
+  void *release = NULL;
+  void *new_ptr = do_realloc(ptr, size, &release);
+  // Recorded before the old block is freed, like in free()
+  TRACE(MALLOC_TRACE_REALLOC, new_ptr, ptr, size);
+  do_free(release);
+  return new_ptr;
+}
+
+void *calloc(size_t nelem, size_t elsize) {
+  void *ptr = do_calloc(nelem, elsize);
+  TRACE(MALLOC_TRACE_CALLOC, ptr, NULL, nelem * elsize);
+  return ptr;
+}
+
+static int is_power_of_two(size_t value) {
+  return value && !(value & (value - 1));
+}
+
+static void *traced_memalign(size_t alignment, size_t size) {
+  void *ptr = do_memalign(alignment, size);
+  TRACE(MALLOC_TRACE_MEMALIGN, ptr, (void *)alignment, size);
+  return ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  if (!is_power_of_two(alignment) || alignment % sizeof(void *)) {
+    return EINVAL;
+  }
+  void *ptr = traced_memalign(alignment, size);
+  if (!ptr && size) {
+    return ENOMEM;
+  }
+  *memptr = ptr;
+  return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  if (!is_power_of_two(alignment)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return traced_memalign(alignment, size);
+}
+
+/* Like glibc, rounds an alignment that isn't a power of two up to one */
+void *memalign(size_t alignment, size_t size) {
+  if (alignment > SIZE_MAX / 2) {
+    errno = EINVAL;
+    return NULL;
+  }
+  while (!is_power_of_two(alignment)) {
+    alignment = (alignment | (alignment - 1)) + 1;
+  }
+  return traced_memalign(alignment, size);
+}
+
+void *valloc(size_t size) {
+  return traced_memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+/* Page-aligned, and the size rounded up to whole pages */
+void *pvalloc(size_t size) {
+  if (size > SIZE_MAX / 2) {
+    return NULL;
+  }
+  return traced_memalign(sysconf(_SC_PAGESIZE), page_round(size ? size : 1));
+}
 
-#define ALIGNMENT 8
-#define ALIGN(size)                                                            \
-  (((size) + (ALIGNMENT - 1)) &                                                \
-   ~(ALIGNMENT - 1)) // Rounding up to the nearest multiple of ALIGNMENT
-#define META_SIZE ALIGN(sizeof(struct BlockMeta))
+size_t malloc_usable_size(void *ptr) {
+  return ptr ? BLOCK_SIZE(get_block_ptr(ptr)) - META_SIZE : 0;
+}
 
-void *global_base = NULL; // The head of our linkedlist of memory blocks
+// ---------------------------------------------------------------------------
+// Arenas and pools
+// ---------------------------------------------------------------------------
 
 /*
- * `**last` to keep track of the previous block while we're traversing the list
- * of blocks Leads to an efficient traversal and insertion of the new blocks in
- * the linkedlist
+ * Arenas hand out memory from big chunks by bumping a pointer, so their
+ * objects have no header and are never freed one by one. The chunks are
+ * ordinary blocks: they come from the sbrk heap, or their own mapping past the
+ * mmap threshold, just like malloc()'s, but skip the thread cache.
  */
-struct BlockMeta *find_free_block(struct BlockMeta **last, size_t size) {
-  struct BlockMeta *current = global_base;
-  while (current && !(current->free && current->size >= size)) {
-    *last = current;
-    current = current->next;
-  }
-  return current;
-}
+#define ARENA_CHUNK_SIZE (HEAP_GROW_SIZE - META_SIZE) // Fills one heap step
+
+struct ArenaChunk {
+  struct ArenaChunk *next;
+  char *end; // First byte past the chunk's payload
+};
+
+struct MallocArena {
+  struct ArenaChunk *chunks; // The one we bump from first, then older ones
+  char *cursor;              // Next free byte of `chunks`
+  size_t chunk_size;
+};
 
 /*
- * Just a Helper Function, does not return the pointer to the allocated memory
- * to the client directly. Need to modify the pointer to only point to the
- * eequested size, and not the metadata
+ * A pool is an arena of equal-sized objects plus a list of freed ones, linked
+ * through the objects themselves
  */
-struct BlockMeta *request_space(struct BlockMeta *last, size_t size) {
-  struct BlockMeta *block = sbrk(0);
-  void *request = sbrk(size + META_SIZE);
+struct MallocPool {
+  MallocArena *arena;
+  size_t object_size;
+  void *free_list;
+};
+
+#define CHUNK_HEADER_SIZE ALIGN(sizeof(struct ArenaChunk))
 
-  assert((void *)block == request); // not thread-safe
-  if (request == (void *)-1) {
+static struct ArenaChunk *chunk_alloc(size_t payload) {
+  struct BlockMeta *block;
+  if (payload > SIZE_MAX / 2) {
     return NULL;
   }
+  size_t size = request_to_block_size(CHUNK_HEADER_SIZE + payload);
 
-  if (last) {
-    last->next = block;
-    block->prev = last;
+  if (!params_loaded) {
+    load_params();
+  }
+  if (size >= mmap_threshold) {
+    block = mmap_block(size, ALIGNMENT);
   } else {
-    block->prev = NULL;
+    pthread_mutex_lock(&heap_lock);
+    block = heap_alloc(size);
+    pthread_mutex_unlock(&heap_lock);
+  }
+  if (!block) {
+    return NULL;
   }
 
-  block->size = size;
-  block->next = NULL;
-  block->free = 0;
-  return block;
+  struct ArenaChunk *chunk = (struct ArenaChunk *)(block + 1);
+  chunk->next = NULL;
+  chunk->end = (char *)block + BLOCK_SIZE(block);
+  return chunk;
 }
 
-/*
- * Given a pointer to a memory block, return a pointer that points to the
- * starting of the associated metadata for that particular block
- */
-struct BlockMeta *get_block_ptr(void *ptr) {
-  return (struct BlockMeta *)ptr - 1;
+static void chunk_free(struct ArenaChunk *chunk) {
+  struct BlockMeta *block = get_block_ptr(chunk);
+  if (IS_MMAPPED(block)) {
+    munmap_block(block);
+    return;
+  }
+  pthread_mutex_lock(&heap_lock);
+  heap_free(block);
+  pthread_mutex_unlock(&heap_lock);
 }
 
-void *malloc(size_t size) {
-  struct BlockMeta *block;
+#define CHUNK_START(chunk) ((char *)(chunk) + CHUNK_HEADER_SIZE)
+// The arena itself lives at the start of its first chunk
+#define ARENA_START(arena)                                                     \
+  ((char *)(arena) + ALIGN(sizeof(struct MallocArena)))
 
-  if (size <= 0) {
+MallocArena *malloc_arena_create(size_t chunk_size) {
+  chunk_size = chunk_size ? ALIGN(chunk_size) : ARENA_CHUNK_SIZE;
+  struct ArenaChunk *chunk =
+      chunk_alloc(ALIGN(sizeof(struct MallocArena)) + chunk_size);
+  if (!chunk) {
     return NULL;
   }
 
+  MallocArena *arena = (MallocArena *)CHUNK_START(chunk);
+  arena->chunks = chunk;
+  arena->cursor = ARENA_START(arena);
+  arena->chunk_size = chunk_size;
+  return arena;
+}
+
+void *malloc_arena_alloc(MallocArena *arena, size_t size) {
   size = ALIGN(size);
-  if (!global_base) { // First call
-    block = request_space(NULL, size);
-    if (!block) {
+  if (size <= (size_t)(arena->chunks->end - arena->cursor)) {
+    void *ptr = arena->cursor;
+    arena->cursor += size;
+    return ptr;
+  }
+
+  // Objects too big to leave most of a chunk behind get a chunk of their
+  // own, tucked behind the current one so we keep bumping from it
+  if (size > arena->chunk_size / 4) {
+    struct ArenaChunk *chunk = chunk_alloc(size);
+    if (!chunk) {
       return NULL;
     }
-    global_base = block;
-  } else {
-    struct BlockMeta *last = global_base;
-    block = find_free_block(&last, size);
-    if (!block) { // Couldn't find a suitable free block
-      block = request_space(last, size);
-      if (!block) {
-        return NULL;
-      }
-    } else { // found a free block
-      if ((block->size - size) >= (META_SIZE + ALIGNMENT)) {
-        // split the block
-        struct BlockMeta *split =
-            (struct BlockMeta *)((char *)block + META_SIZE + size);
-
-        // Initialize the fields of the `split` block
-        split->size = block->size - size - META_SIZE;
-        split->next = block->next;
-        if (split->next) {
-          split->next->prev = split;
-        }
-        split->prev = block;
-        split->free = 1;
+    chunk->next = arena->chunks->next;
+    arena->chunks->next = chunk;
+    return CHUNK_START(chunk);
+  }
 
-        // Updating the original block
-        block->next = split;
-        block->size = size;
-      }
+  struct ArenaChunk *chunk = chunk_alloc(arena->chunk_size);
+  if (!chunk) {
+    return NULL;
+  }
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+  arena->cursor = CHUNK_START(chunk) + size;
+  return CHUNK_START(chunk);
+}
 
-      block->free = 0;
+/* Frees every chunk but the one holding the arena, and starts over there */
+void malloc_arena_reset(MallocArena *arena) {
+  struct ArenaChunk *first =
+      (struct ArenaChunk *)((char *)arena - CHUNK_HEADER_SIZE);
+  struct ArenaChunk *chunk = arena->chunks;
+  while (chunk) {
+    struct ArenaChunk *next = chunk->next;
+    if (chunk != first) {
+      chunk_free(chunk);
     }
+    chunk = next;
   }
 
-  // return a pointer to the region after block_meta
-  // +1 increments the address by one sizeof(struct BlockMeta)
-  return (block + 1);
+  first->next = NULL;
+  arena->chunks = first;
+  arena->cursor = ARENA_START(arena);
 }
 
-void free(void *ptr) {
-  if (!ptr)
+void malloc_arena_destroy(MallocArena *arena) {
+  malloc_arena_reset(arena);
+  chunk_free(arena->chunks);
+}
+
+MallocPool *malloc_pool_create(size_t object_size) {
+  // Freed objects hold the free list link
+  object_size = ALIGN(object_size < sizeof(void *) ? sizeof(void *)
+                                                    : object_size);
+  MallocArena *arena = malloc_arena_create(0);
+  if (!arena) {
+    return NULL;
+  }
+
+  MallocPool *pool = malloc_arena_alloc(arena, sizeof(MallocPool));
+  pool->arena = arena;
+  pool->object_size = object_size;
+  pool->free_list = NULL;
+  return pool;
+}
+
+void *malloc_pool_alloc(MallocPool *pool) {
+  if (pool->free_list) {
+    void *ptr = pool->free_list;
+    pool->free_list = *(void **)ptr;
+    return ptr;
+  }
+  return malloc_arena_alloc(pool->arena, pool->object_size);
+}
+
+void malloc_pool_free(MallocPool *pool, void *ptr) {
+  if (!ptr) {
     return;
+  }
+  *(void **)ptr = pool->free_list;
+  pool->free_list = ptr;
+}
 
-  struct BlockMeta *block_ptr = get_block_ptr(ptr);
-  assert(block_ptr->free == 0);
-  block_ptr->free = 1;
+void malloc_pool_destroy(MallocPool *pool) {
+  malloc_arena_destroy(pool->arena);
+}
 
-  // -------------------------------------------------------------------------
-  // coalescing adjacent free blocks together into one to avoid fragmentation
-  // -------------------------------------------------------------------------
+// ---------------------------------------------------------------------------
+// Statistics
+// ---------------------------------------------------------------------------
+
+size_t malloc_stats_class_size(size_t size_class) {
+  if (size_class < NUM_SMALL_BINS) {
+    return size_class * ALIGNMENT;
+  }
+  return (size_t)1 << (size_class - NUM_SMALL_BINS + SMALL_BIN_SHIFT);
+}
 
-  // Merge with the previous block if free
-  if (block_ptr->prev && block_ptr->prev->free == 1) {
-    block_ptr->prev->size += (META_SIZE + block_ptr->size);
-    block_ptr->prev->next = block_ptr->next;
-    if (block_ptr->next) {
-      block_ptr->next->prev = block_ptr->prev;
+static size_t largest_free_block(void) {
+  if (large_tree) {
+    struct BlockMeta *block = large_tree;
+    while (TREE_NODE(block)->right) {
+      block = TREE_NODE(block)->right;
     }
-    block_ptr =
-        block_ptr->prev; // Move back to the previous block after merging
+    return BLOCK_SIZE(block);
   }
-  // Merge with the next block if free
-  if (block_ptr->next && block_ptr->next->free == 1) {
-    block_ptr->size += (META_SIZE + block_ptr->next->size);
-    block_ptr->next = block_ptr->next->next;
-    if (block_ptr->next) {
-      block_ptr->next->prev = block_ptr;
+
+  for (size_t bin = NUM_SMALL_BINS; bin-- > 0;) {
+    if (bins[bin]) {
+      return bin * ALIGNMENT;
     }
   }
+  return 0;
 }
 
-void *realloc(void *ptr, size_t size) {
-  if (size <= 0) {
-    free(ptr);
-    return NULL;
-  }
-  if (!ptr) {
-    // NULL pointer, realloc should act like malloc
-    return malloc(size);
+/*
+ * Thread cache counters are read while their owners keep running, so a
+ * snapshot taken with other threads active is only approximately consistent
+ */
+void malloc_get_stats(MallocStats *out) {
+  memset(out, 0, sizeof(*out));
+
+  pthread_mutex_lock(&heap_lock);
+  out->heap_bytes = stats.heap_bytes;
+  out->heap_peak_bytes = stats.heap_peak_bytes;
+  out->sbrk_calls = stats.sbrk_calls;
+  out->trimmed_bytes = stats.trimmed_bytes;
+  out->bytes_free = stats.bytes_free;
+  out->blocks_free = stats.blocks_free;
+  out->largest_free = largest_free_block();
+  out->bin_searches = stats.bin_searches;
+  if (stats.bin_searches) {
+    out->avg_walk_length = (double)stats.walk_steps / stats.bin_searches;
   }
+  memcpy(out->class_hits, stats.class_hits, sizeof(stats.class_hits));
+  memcpy(out->class_misses, stats.class_misses, sizeof(stats.class_misses));
 
-  struct BlockMeta *block_ptr = get_block_ptr(ptr);
-  if (block_ptr->size >= size) {
-    // Enough space available already
-    return ptr;
+  for (size_t bin = 0; bin < TCACHE_BINS; ++bin) {
+    out->class_hits[bin] += retired_tcache_hits[bin];
+    out->tcache_hits += retired_tcache_hits[bin];
+  }
+  for (struct TCache *cache = tcache_threads; cache;
+       cache = cache->next_thread) {
+    for (size_t bin = 0; bin < TCACHE_BINS; ++bin) {
+      out->class_hits[bin] += cache->hits[bin];
+      out->tcache_hits += cache->hits[bin];
+      out->blocks_cached += cache->counts[bin];
+      out->bytes_cached += cache->counts[bin] * bin * ALIGNMENT;
+    }
   }
 
-  // Need to realloc. Malloc new space and free old space.
-  // Then copy the data to the new space
-  void *new_ptr;
-  new_ptr = malloc(size);
-  if (!new_ptr) {
-    return NULL;
+  out->bytes_in_use = stats.bytes_in_use - out->bytes_cached;
+  out->blocks_in_use = stats.blocks_in_use - out->blocks_cached;
+  pthread_mutex_unlock(&heap_lock);
+
+  out->mmap_bytes = __atomic_load_n(&stats.mmap_bytes, __ATOMIC_RELAXED);
+  out->mmap_blocks = __atomic_load_n(&stats.mmap_blocks, __ATOMIC_RELAXED);
+  out->mmap_total = __atomic_load_n(&stats.mmap_total, __ATOMIC_RELAXED);
+  out->bytes_in_use += out->mmap_bytes;
+  out->blocks_in_use += out->mmap_blocks;
+
+  if (out->bytes_free) {
+    out->fragmentation = 1.0 - (double)out->largest_free / out->bytes_free;
   }
+}
 
-  memcpy(new_ptr, ptr,
-         size < block_ptr->size
-             ? size
-             : block_ptr
-                   ->size); // A check to avoid memory corruption if the new
-                            // size is smaller than the original one Only need
-                            // to write the minimum of the old and the new sizes
-  free(ptr);
-  return new_ptr;
+/*
+ * Formats into a stack buffer and write(2)s it, so printing never allocates
+ * and doesn't go through stdio locks (it also runs from a signal handler)
+ */
+void malloc_stats(void) {
+  MallocStats st;
+  char buf[256];
+  int len;
+
+  malloc_get_stats(&st);
+
+#define STATS_OUT(...)                                                         \
+  do {                                                                         \
+    len = snprintf(buf, sizeof(buf), __VA_ARGS__);                             \
+    if (write(STDERR_FILENO, buf, len) < 0) {                                  \
+      return;                                                                  \
+    }                                                                          \
+  } while (0)
+
+  STATS_OUT("------------------------- malloc stats -------------------------\n");
+  STATS_OUT("heap:   %zu bytes (peak %zu), %zu sbrk calls, %zu trimmed\n",
+            st.heap_bytes, st.heap_peak_bytes, st.sbrk_calls,
+            st.trimmed_bytes);
+  STATS_OUT("mmap:   %zu bytes in %zu blocks, %zu mapped in total\n",
+            st.mmap_bytes, st.mmap_blocks, st.mmap_total);
+  STATS_OUT("in use: %zu bytes in %zu blocks\n", st.bytes_in_use,
+            st.blocks_in_use);
+  STATS_OUT("cached: %zu bytes in %zu blocks\n", st.bytes_cached,
+            st.blocks_cached);
+  STATS_OUT("free:   %zu bytes in %zu blocks, largest %zu, fragmentation "
+            "%.3f\n",
+            st.bytes_free, st.blocks_free, st.largest_free, st.fragmentation);
+  STATS_OUT("lookup: %zu thread cache hits, %zu heap searches, %.2f blocks "
+            "walked per search\n",
+            st.tcache_hits, st.bin_searches, st.avg_walk_length);
+  STATS_OUT("%12s %12s %12s\n", "class from", "hits", "misses");
+  for (size_t i = 0; i < MALLOC_STATS_CLASSES; ++i) {
+    if (st.class_hits[i] || st.class_misses[i]) {
+      STATS_OUT("%12zu %12zu %12zu\n", malloc_stats_class_size(i),
+                st.class_hits[i], st.class_misses[i]);
+    }
+  }
+#undef STATS_OUT
 }
 
-void *calloc(size_t nelem, size_t elsize) {
-  if (nelem && (elsize > (SIZE_MAX / nelem))) {
-    return NULL; // Overflow
+static void stats_signal_handler(int signum) {
+  (void)signum;
+  // If the interrupted code holds the heap lock, taking it here would
+  // deadlock, so skip this dump instead
+  if (pthread_mutex_trylock(&heap_lock) != 0) {
+    return;
   }
-  size_t size = nelem * elsize;
-  void *ptr = malloc(size);
-  memset(ptr, 0, size);
-  return ptr;
+  pthread_mutex_unlock(&heap_lock);
+  malloc_stats();
 }
 
 /* Helper function to print memory block's size and free status */
 void print_block(struct BlockMeta *block) {
-  printf("Block at %p: size=%zu, free=%d\n", block, block->size, block->free);
+  printf("Block at %p: size=%zu, free=%d, prev_free=%d, mmapped=%d\n", block,
+         BLOCK_SIZE(block), !!IS_FREE(block), !!(block->size & PREV_FREE),
+         !!IS_MMAPPED(block));
 }
 
 void test_malloc_and_free() {
@@ -273,7 +1754,7 @@ void test_alignment() {
   assert(ptr1 != NULL);
 
   uintptr_t ptr_value = (uintptr_t)ptr1;
-  assert(ptr_value % ALIGNMENT == 0); // Should be aligned to 8-byte boundary
+  assert(ptr_value % ALIGNMENT == 0); // Should be aligned to 16-byte boundary
 
   free(ptr1);
 
@@ -320,13 +1801,561 @@ void test_realloc() {
   printf("test_realloc passed.\n");
 }
 
+void test_realloc_in_place() {
+  printf("Running test_realloc_in_place...\n");
+
+  // Sizes above TCACHE_MAX_SIZE, so freed neighbours really go back to the
+  // heap instead of the thread cache
+  char *grown = malloc(600);
+  void *neighbour = malloc(2000);
+  void *pin = malloc(600);
+  memset(grown, 'g', 600);
+  free(neighbour);
+
+  // Growing absorbs the free neighbour
+  assert(realloc(grown, 1500) == grown);
+  assert(grown[0] == 'g' && grown[599] == 'g');
+
+  // Shrinking splits off the tail, which merges with what's left after it
+  assert(realloc(grown, 600) == grown);
+  struct BlockMeta *tail = NEXT_BLOCK(get_block_ptr(grown));
+  assert(IS_FREE(tail));
+  assert(NEXT_BLOCK(tail) == get_block_ptr(pin));
+
+  // A block at the top of the heap grows by moving the break. Nothing free is
+  // big enough for this one, so it's carved from the top
+  char *top = malloc(DEFAULT_MMAP_THRESHOLD / 2);
+  memset(top, 't', DEFAULT_MMAP_THRESHOLD / 2);
+  void *heap_top = sbrk(0);
+  assert(realloc(top, DEFAULT_MMAP_THRESHOLD * 2) == top);
+  assert((char *)sbrk(0) > (char *)heap_top);
+  assert(top[0] == 't' && top[DEFAULT_MMAP_THRESHOLD / 2 - 1] == 't');
+
+  free(top);
+  free(grown);
+  free(pin);
+
+  printf("test_realloc_in_place passed.\n");
+}
+
+void test_size_classes() {
+  printf("Running test_size_classes...\n");
+
+  // A freed small block is handed back from its exact bin
+  void *small = malloc(48);
+  void *pin1 = malloc(16);
+  free(small);
+  void *heap_top = sbrk(0);
+  void *small_again = malloc(48);
+  assert(BLOCK_SIZE(get_block_ptr(small_again)) >= 48 + META_SIZE);
+  assert(sbrk(0) == heap_top);
+
+  // A freed large block is found in the tree and split
+  void *medium = malloc(4000);
+  void *pin2 = malloc(16);
+  free(medium);
+  heap_top = sbrk(0);
+  void *medium_again = malloc(3000);
+  assert(IS_FREE(NEXT_BLOCK(get_block_ptr(medium_again))));
+  assert(sbrk(0) == heap_top);
+
+  // Small requests with no fitting bin fall through to the tree
+  void *from_higher = malloc(500);
+  assert(sbrk(0) == heap_top);
+
+  free(small_again);
+  free(medium_again);
+  free(from_higher);
+  free(pin1);
+  free(pin2);
+
+  printf("test_size_classes passed.\n");
+}
+
+#define STRESS_THREADS 8
+#define STRESS_SLOTS 64
+#define STRESS_ITERATIONS 50000
+
+static void *stress_leftovers[STRESS_THREADS][STRESS_SLOTS];
+
+static unsigned stress_rand(unsigned *seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 16;
+}
+
+/*
+ * Each thread churns through malloc/aligned_alloc/realloc/free with random
+ * sizes, filling every block with its own tag and checking it is intact
+ * before letting go. Whatever is still live at the end is freed by the main
+ * thread, so blocks also cross thread caches.
+ */
+static void *stress_worker(void *arg) {
+  size_t id = (size_t)arg;
+  unsigned seed = (unsigned)id + 1;
+  unsigned char tag = (unsigned char)(id + 1);
+  void **slots = stress_leftovers[id];
+  size_t sizes[STRESS_SLOTS] = {0};
+
+  for (int i = 0; i < STRESS_ITERATIONS; ++i) {
+    size_t slot = stress_rand(&seed) % STRESS_SLOTS;
+    size_t size = 1 + stress_rand(&seed) % (stress_rand(&seed) % 8 ? 256 : 4096);
+
+    for (size_t j = 0; j < sizes[slot]; ++j) {
+      assert(((unsigned char *)slots[slot])[j] == tag);
+    }
+
+    if (slots[slot] && stress_rand(&seed) % 4 == 0) {
+      slots[slot] = realloc(slots[slot], size);
+    } else if (stress_rand(&seed) % 8 == 0) {
+      free(slots[slot]);
+      slots[slot] = aligned_alloc(32 << stress_rand(&seed) % 6, size);
+    } else {
+      free(slots[slot]);
+      slots[slot] = malloc(size);
+    }
+    assert(slots[slot] != NULL);
+    memset(slots[slot], tag, size);
+    sizes[slot] = size;
+  }
+  return NULL;
+}
+
+void test_threads() {
+  printf("Running test_threads...\n");
+
+  pthread_t threads[STRESS_THREADS];
+  for (size_t i = 0; i < STRESS_THREADS; ++i) {
+    assert(pthread_create(&threads[i], NULL, stress_worker, (void *)i) == 0);
+  }
+  for (size_t i = 0; i < STRESS_THREADS; ++i) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+
+  for (size_t i = 0; i < STRESS_THREADS; ++i) {
+    for (size_t j = 0; j < STRESS_SLOTS; ++j) {
+      free(stress_leftovers[i][j]);
+    }
+  }
+
+  printf("test_threads passed.\n");
+}
+
+static void *malloc_only_worker(void *arg) {
+  (void)arg;
+  return malloc(64);
+}
+
+void test_malloc_only_threads() {
+  printf("Running test_malloc_only_threads...\n");
+
+  // Free blocks for the threads' caches to be refilled from
+  void *blocks[400];
+  for (size_t i = 0; i < 400; ++i) {
+    blocks[i] = malloc(64);
+  }
+  for (size_t i = 0; i < 400; i += 2) {
+    free(blocks[i]);
+  }
+
+  // glibc allocates what it needs for threads on the first one, and reuses it
+  // when they run one at a time, so nothing else comes and goes meanwhile
+  pthread_t thread;
+  void *results[21];
+  assert(pthread_create(&thread, NULL, malloc_only_worker, NULL) == 0);
+  assert(pthread_join(thread, &results[0]) == 0);
+
+  // Threads that never free still hand their cache back when they exit
+  MallocStats before, after;
+  malloc_get_stats(&before);
+  for (size_t i = 1; i <= 20; ++i) {
+    assert(pthread_create(&thread, NULL, malloc_only_worker, NULL) == 0);
+    assert(pthread_join(thread, &results[i]) == 0);
+  }
+  malloc_get_stats(&after);
+  assert(after.blocks_in_use == before.blocks_in_use + 20);
+
+  for (size_t i = 0; i <= 20; ++i) {
+    free(results[i]);
+  }
+  for (size_t i = 1; i < 400; i += 2) {
+    free(blocks[i]);
+  }
+
+  printf("test_malloc_only_threads passed.\n");
+}
+
+void test_mmap_blocks() {
+  printf("Running test_mmap_blocks...\n");
+
+  size_t size = DEFAULT_MMAP_THRESHOLD * 4;
+  void *heap_top = sbrk(0);
+  char *big = malloc(size);
+  assert(big != NULL);
+  assert(IS_MMAPPED(get_block_ptr(big)));
+  assert(sbrk(0) == heap_top); // Didn't touch the sbrk heap
+  memset(big, 'x', size);
+
+  // Growing moves the mapping and keeps the contents
+  big = realloc(big, size * 4);
+  assert(big != NULL);
+  assert(big[0] == 'x' && big[size - 1] == 'x');
+  free(big);
+
+  char *zeroed = calloc(size, 1);
+  for (size_t i = 0; i < size; i += 4096) {
+    assert(zeroed[i] == 0);
+  }
+  free(zeroed);
+
+  printf("test_mmap_blocks passed.\n");
+}
+
+/* Resident set size of this process in bytes, from /proc/self/statm */
+static size_t current_rss(void) {
+  long pages = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  assert(fp != NULL);
+  assert(fscanf(fp, "%*s %ld", &pages) == 1);
+  fclose(fp);
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+void test_trim_rss() {
+  printf("Running test_trim_rss...\n");
+
+#define BURST_BLOCKS 2048
+#define BURST_BLOCK_SIZE (16 * 1024) // Below the mmap threshold, so sbrk
+  static void *burst[BURST_BLOCKS];
+  size_t burst_bytes = (size_t)BURST_BLOCKS * BURST_BLOCK_SIZE;
+
+  size_t rss_before = current_rss();
+  for (size_t i = 0; i < BURST_BLOCKS; ++i) {
+    burst[i] = malloc(BURST_BLOCK_SIZE);
+    assert(burst[i] != NULL);
+    memset(burst[i], 1, BURST_BLOCK_SIZE);
+  }
+  size_t rss_peak = current_rss();
+
+  for (size_t i = 0; i < BURST_BLOCKS; ++i) {
+    free(burst[i]);
+  }
+  size_t rss_after = current_rss();
+
+  printf("RSS before: %zu KiB, peak: %zu KiB, after: %zu KiB\n",
+         rss_before / 1024, rss_peak / 1024, rss_after / 1024);
+  assert(rss_peak >= rss_before + burst_bytes / 2);
+  assert(rss_after < rss_before + burst_bytes / 16);
+
+  printf("test_trim_rss passed.\n");
+}
+
+void test_stats() {
+  printf("Running test_stats...\n");
+
+  MallocStats before, after;
+  malloc_get_stats(&before);
+
+  void *big = malloc(DEFAULT_MMAP_THRESHOLD * 2);
+  void *medium = malloc(3000);
+  malloc_get_stats(&after);
+  assert(after.mmap_blocks == before.mmap_blocks + 1);
+  assert(after.mmap_total == before.mmap_total + 1);
+  assert(after.blocks_in_use == before.blocks_in_use + 2);
+  assert(after.bytes_in_use >= before.bytes_in_use + 3000 +
+                                   DEFAULT_MMAP_THRESHOLD * 2);
+
+  // Freeing and asking again is a hit for that size class
+  size_t size_class = size_to_bin(request_to_block_size(3000));
+  free(medium);
+  medium = malloc(3000);
+  malloc_get_stats(&after);
+  assert(after.class_hits[size_class] > before.class_hits[size_class]);
+  assert(after.bin_searches > before.bin_searches);
+  assert(after.fragmentation >= 0.0 && after.fragmentation <= 1.0);
+
+  free(big);
+  free(medium);
+  malloc_get_stats(&after);
+  assert(after.mmap_blocks == before.mmap_blocks);
+  assert(after.heap_bytes <= after.heap_peak_bytes);
+
+  printf("test_stats passed.\n");
+}
+
+/*
+ * Checks the treap invariants below `block`: search order, heap order on the
+ * priorities and the lowest address of every subtree. Returns the number of
+ * blocks in it.
+ */
+static size_t tree_check(struct BlockMeta *block) {
+  if (!block) {
+    return 0;
+  }
+
+  struct TreeNode *node = TREE_NODE(block);
+  struct BlockMeta *lowest = block;
+  assert(IS_FREE(block) && BLOCK_SIZE(block) >= SMALL_BIN_LIMIT);
+  if (node->left) {
+    assert(tree_less(node->left, block));
+    assert(tree_priority(node->left) <= tree_priority(block));
+    lowest = TREE_NODE(node->left)->lowest < lowest
+                 ? TREE_NODE(node->left)->lowest
+                 : lowest;
+  }
+  if (node->right) {
+    assert(tree_less(block, node->right));
+    assert(tree_priority(node->right) <= tree_priority(block));
+    lowest = TREE_NODE(node->right)->lowest < lowest
+                 ? TREE_NODE(node->right)->lowest
+                 : lowest;
+  }
+  assert(node->lowest == lowest);
+  return 1 + tree_check(node->left) + tree_check(node->right);
+}
+
+/*
+ * The answers each policy should give for `size`, found by visiting every
+ * block in the tree
+ */
+static void tree_scan(struct BlockMeta *block, size_t size,
+                      struct BlockMeta **best, struct BlockMeta **lowest) {
+  if (!block) {
+    return;
+  }
+  if (BLOCK_SIZE(block) >= size) {
+    if (!*best || tree_less(block, *best)) {
+      *best = block;
+    }
+    if (!*lowest || block < *lowest) {
+      *lowest = block;
+    }
+  }
+  tree_scan(TREE_NODE(block)->left, size, best, lowest);
+  tree_scan(TREE_NODE(block)->right, size, best, lowest);
+}
+
+void test_placement_policy() {
+  printf("Running test_placement_policy...\n");
+
+  // Lots of free large blocks of random sizes, every other one so they
+  // don't merge
+#define TREE_BLOCKS 2000
+  static void *blocks[TREE_BLOCKS];
+  unsigned seed = 7;
+  for (size_t i = 0; i < TREE_BLOCKS; ++i) {
+    blocks[i] = malloc(SMALL_BIN_LIMIT + stress_rand(&seed) % 8192);
+  }
+  for (size_t i = 0; i < TREE_BLOCKS; i += 2) {
+    free(blocks[i]);
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  assert(tree_check(large_tree) >= TREE_BLOCKS / 2);
+
+  // Each policy picks what a scan of the whole tree says it should
+  for (size_t size = SMALL_BIN_LIMIT; size < 10 * 1024; size += 320) {
+    struct BlockMeta *best = NULL, *lowest = NULL;
+    tree_scan(large_tree, size, &best, &lowest);
+
+    placement_policy = MALLOC_BEST_FIT;
+    assert(find_free_block(size) == best);
+    placement_policy = MALLOC_ADDRESS_ORDERED;
+    assert(find_free_block(size) == lowest);
+    placement_policy = MALLOC_FIRST_FIT;
+    struct BlockMeta *first = find_free_block(size);
+    assert(!best == !first);
+    assert(!first || BLOCK_SIZE(first) >= size);
+  }
+  placement_policy = MALLOC_BEST_FIT;
+  pthread_mutex_unlock(&heap_lock);
+
+  assert(mallopt(M_PLACEMENT, MALLOC_ADDRESS_ORDERED + 1) == 0);
+  assert(mallopt(M_PLACEMENT, MALLOC_ADDRESS_ORDERED) == 1);
+  void *fit = malloc(3000);
+  assert(fit != NULL);
+  assert(mallopt(M_PLACEMENT, MALLOC_BEST_FIT) == 1);
+
+  for (size_t i = 1; i < TREE_BLOCKS; i += 2) {
+    free(blocks[i]);
+  }
+  free(fit);
+  pthread_mutex_lock(&heap_lock);
+  tree_check(large_tree);
+  pthread_mutex_unlock(&heap_lock);
+
+  printf("test_placement_policy passed.\n");
+}
+
+void test_arena_and_pool() {
+  printf("Running test_arena_and_pool...\n");
+
+  MallocStats before, after;
+  malloc_get_stats(&before);
+
+  MallocArena *arena = malloc_arena_create(0);
+  assert(arena != NULL);
+  char *first = malloc_arena_alloc(arena, 24);
+  char *prev = first;
+  memset(first, 1, 24);
+  // Bump allocation packs objects back to back, across several chunks
+  for (int i = 0; i < 10000; ++i) {
+    char *ptr = malloc_arena_alloc(arena, 40);
+    assert(ptr != NULL && (uintptr_t)ptr % ALIGNMENT == 0);
+    memset(ptr, 2, 40);
+    assert(ptr != prev);
+    prev = ptr;
+  }
+  char *big = malloc_arena_alloc(arena, ARENA_CHUNK_SIZE * 2);
+  memset(big, 3, ARENA_CHUNK_SIZE * 2);
+  assert(first[0] == 1 && first[23] == 1);
+
+  // After a reset the arena starts over from its first chunk
+  malloc_arena_reset(arena);
+  assert(malloc_arena_alloc(arena, 24) == first);
+  malloc_arena_destroy(arena);
+
+  MallocPool *pool = malloc_pool_create(48);
+  assert(pool != NULL);
+  void *objects[1000];
+  for (int i = 0; i < 1000; ++i) {
+    objects[i] = malloc_pool_alloc(pool);
+    memset(objects[i], i, 48);
+  }
+  assert((char *)objects[1] - (char *)objects[0] == 48); // No header
+  malloc_pool_free(pool, objects[500]);
+  assert(malloc_pool_alloc(pool) == objects[500]);
+  malloc_pool_destroy(pool);
+
+  // Everything went back to the heap
+  malloc_get_stats(&after);
+  assert(after.blocks_in_use == before.blocks_in_use);
+  assert(after.bytes_in_use == before.bytes_in_use);
+
+  printf("test_arena_and_pool passed.\n");
+}
+
+void test_trace() {
+  printf("Running test_trace...\n");
+
+  char path[] = "/tmp/malloc_test_trace.XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  assert(trace_open(path));
+
+  void *ptr = malloc(100);
+  void *moved = realloc(ptr, 5000);
+  void *zeroed = calloc(4, 8);
+  free(moved);
+  free(zeroed);
+  free(NULL); // Not recorded
+  trace_stop();
+
+  MallocTraceHeader header;
+  MallocTraceRecord records[8];
+  fd = open(path, O_RDONLY);
+  assert(read(fd, &header, sizeof(header)) == sizeof(header));
+  assert(memcmp(header.magic, MALLOC_TRACE_MAGIC, 8) == 0);
+  assert(header.record_size == sizeof(MallocTraceRecord));
+  assert(read(fd, records, sizeof(records)) == 5 * sizeof(MallocTraceRecord));
+  close(fd);
+  unlink(path);
+
+  uint32_t ops[] = {MALLOC_TRACE_MALLOC, MALLOC_TRACE_REALLOC,
+                    MALLOC_TRACE_CALLOC, MALLOC_TRACE_FREE, MALLOC_TRACE_FREE};
+  for (int i = 0; i < 5; ++i) {
+    assert(records[i].op == ops[i]);
+    assert(records[i].thread == records[0].thread);
+    assert(i == 0 || records[i].time >= records[i - 1].time);
+  }
+  assert(records[0].ptr == (uintptr_t)ptr && records[0].size == 100);
+  assert(records[1].old_ptr == (uintptr_t)ptr);
+  assert(records[1].ptr == (uintptr_t)moved && records[1].size == 5000);
+  assert(records[2].ptr == (uintptr_t)zeroed && records[2].size == 32);
+  assert(records[3].ptr == (uintptr_t)moved);
+
+  printf("test_trace passed.\n");
+}
+
+void test_aligned_alloc() {
+  printf("Running test_aligned_alloc...\n");
+
+  // Every alignment from the default up to beyond a page, heap and mmap
+  size_t sizes[] = {1, 100, 3000, DEFAULT_MMAP_THRESHOLD * 2};
+  for (size_t alignment = 8; alignment <= 64 * 1024; alignment *= 2) {
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+      void *ptr = NULL;
+      assert(posix_memalign(&ptr, alignment, sizes[i]) == 0);
+      assert(ptr != NULL && (uintptr_t)ptr % alignment == 0);
+      assert((uintptr_t)ptr % ALIGNMENT == 0);
+      assert(malloc_usable_size(ptr) >= sizes[i]);
+      memset(ptr, 'a', sizes[i]);
+
+      // Still an ordinary block to realloc and free
+      ptr = realloc(ptr, sizes[i] * 2);
+      assert(((char *)ptr)[sizes[i] - 1] == 'a');
+      free(ptr);
+    }
+  }
+
+  void *ptr = NULL;
+  assert(posix_memalign(&ptr, 24, 100) == EINVAL);
+  assert(posix_memalign(&ptr, 4, 100) == EINVAL);
+  assert(aligned_alloc(48, 100) == NULL && errno == EINVAL);
+
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  char *page = valloc(100);
+  assert((uintptr_t)page % page_size == 0);
+  free(page);
+  page = pvalloc(100);
+  assert((uintptr_t)page % page_size == 0);
+  assert(malloc_usable_size(page) >= page_size);
+  free(page);
+  char *odd = memalign(48, 100); // Rounded up to 64
+  assert((uintptr_t)odd % 64 == 0);
+  free(odd);
+
+  // The space skipped to reach an aligned address goes back to the heap:
+  // page-aligned blocks leave free room between them for other requests
+#define ALIGNED_BLOCKS 64
+  void *aligned[ALIGNED_BLOCKS], *fillers[ALIGNED_BLOCKS];
+  for (size_t i = 0; i < ALIGNED_BLOCKS; ++i) {
+    aligned[i] = aligned_alloc(page_size, 100);
+    assert(aligned[i] != NULL && (uintptr_t)aligned[i] % page_size == 0);
+  }
+  void *heap_top = sbrk(0);
+  for (size_t i = 0; i < ALIGNED_BLOCKS; ++i) {
+    fillers[i] = malloc(page_size / 2);
+  }
+  assert(sbrk(0) == heap_top);
+  for (size_t i = 0; i < ALIGNED_BLOCKS; ++i) {
+    free(aligned[i]);
+    free(fillers[i]);
+  }
+
+  assert(malloc_usable_size(NULL) == 0);
+
+  printf("test_aligned_alloc passed.\n");
+}
+
 int main() {
   test_malloc_and_free();
   test_split_blocks();
   test_coalescing();
   test_alignment();
   test_realloc();
+  test_realloc_in_place();
   test_calloc();
+  test_size_classes();
+  test_placement_policy();
+  test_malloc_only_threads();
+  test_threads();
+  test_mmap_blocks();
+  test_trim_rss();
+  test_stats();
+  test_arena_and_pool();
+  test_trace();
+  test_aligned_alloc();
 
   printf("All tests passed!\n");
   return 0;
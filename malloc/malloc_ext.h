@@ -0,0 +1,143 @@
+#ifndef MALLOC_EXT_H
+#define MALLOC_EXT_H
+
+/*
+ * Extensions of the custom allocator in malloc.c that go beyond the standard
+ * malloc/free/realloc/calloc interface.
+ *
+ * When the allocator is loaded through LD_PRELOAD, declare these as weak
+ * symbols (or look them up with dlsym) so the program still runs on glibc.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ---------------------------------------------------------------------------
+// Placement policy
+// ---------------------------------------------------------------------------
+
+/*
+ * How a free block of 1 KiB or more is picked for a request, set with
+ * mallopt(M_PLACEMENT, policy) or MALLOC_POLICY=first|best|address. Smaller
+ * blocks are kept in exact-size bins and don't depend on the policy.
+ */
+#define M_PLACEMENT -100
+
+#define MALLOC_FIRST_FIT 0       // Any block that fits, found fastest
+#define MALLOC_BEST_FIT 1        // The smallest block that fits (default)
+#define MALLOC_ADDRESS_ORDERED 2 // The lowest-addressed block that fits
+
+int mallopt(int param, int value);
+
+// ---------------------------------------------------------------------------
+// Arenas and pools
+// ---------------------------------------------------------------------------
+
+/*
+ * An arena bump-allocates objects with no per-object header and frees them
+ * all at once. Its memory comes in chunks of `chunk_size` bytes (64 KiB if 0)
+ * from the same heap as malloc(). Arenas and pools are not thread-safe, give
+ * each thread its own.
+ */
+typedef struct MallocArena MallocArena;
+
+MallocArena *malloc_arena_create(size_t chunk_size);
+void *malloc_arena_alloc(MallocArena *arena, size_t size);
+void malloc_arena_reset(MallocArena *arena); // Frees everything, keeps one chunk
+void malloc_arena_destroy(MallocArena *arena);
+
+/*
+ * A pool hands out objects of one size from an arena, and takes them back one
+ * at a time for reuse by the next malloc_pool_alloc()
+ */
+typedef struct MallocPool MallocPool;
+
+MallocPool *malloc_pool_create(size_t object_size);
+void *malloc_pool_alloc(MallocPool *pool);
+void malloc_pool_free(MallocPool *pool, void *ptr);
+void malloc_pool_destroy(MallocPool *pool);
+
+// ---------------------------------------------------------------------------
+// Tracing
+// ---------------------------------------------------------------------------
+
+/*
+ * MALLOC_TRACE_FILE=<path> records every malloc/free/realloc/calloc (and
+ * aligned allocation) call of the process into <path>: a MallocTraceHeader
+ * followed by one MallocTraceRecord per call, in the byte order of the
+ * machine. Records of different threads are interleaved a buffer at a time,
+ * sort them by `time` to get the order of the calls.
+ */
+#define MALLOC_TRACE_MAGIC "MALTRACE"
+#define MALLOC_TRACE_VERSION 1
+
+typedef struct {
+  char magic[8]; // MALLOC_TRACE_MAGIC, without the terminating zero
+  uint32_t version;
+  uint32_t record_size;
+} MallocTraceHeader;
+
+#define MALLOC_TRACE_MALLOC 1
+#define MALLOC_TRACE_FREE 2
+#define MALLOC_TRACE_REALLOC 3  // old_ptr is the block passed in
+#define MALLOC_TRACE_CALLOC 4   // size is nelem * elsize
+#define MALLOC_TRACE_MEMALIGN 5 // Any aligned call, old_ptr is the alignment
+
+typedef struct {
+  uint64_t time;    // Nanoseconds since tracing started
+  uint64_t ptr;     // The pointer returned, or passed to free()
+  uint64_t old_ptr; // The pointer passed to realloc(), or the alignment
+  uint64_t size;    // Bytes requested
+  uint32_t thread;  // Numbered from 1, in the order threads first call in
+  uint32_t op;
+} MallocTraceRecord;
+
+// ---------------------------------------------------------------------------
+// Statistics
+// ---------------------------------------------------------------------------
+
+/*
+ * Number of size classes reported per class in `MallocStats`. Class `i`
+ * starts at the block size returned by `malloc_stats_class_size(i)`; block
+ * sizes include the 8-byte header.
+ */
+#define MALLOC_STATS_CLASSES 128
+
+typedef struct {
+  size_t heap_bytes;      // Currently obtained with sbrk
+  size_t heap_peak_bytes; // Largest `heap_bytes` seen so far
+  size_t sbrk_calls;      // Times the break was moved, up or down
+  size_t trimmed_bytes;   // Given back to the OS with a negative sbrk, total
+
+  size_t mmap_bytes;  // Currently held in private mappings
+  size_t mmap_blocks; // Live mappings
+  size_t mmap_total;  // Mappings created so far
+
+  size_t bytes_in_use;  // Held by the application, headers included
+  size_t blocks_in_use;
+  size_t bytes_cached;  // Freed, but parked in a thread cache
+  size_t blocks_cached;
+  size_t bytes_free;    // In free heap blocks
+  size_t blocks_free;
+  size_t largest_free;  // Largest free heap block
+  double fragmentation; // 1 - largest_free / bytes_free, 0 if nothing is free
+
+  size_t tcache_hits;     // Requests served by a thread cache
+  size_t bin_searches;    // Lookups of a free block in the shared heap
+  double avg_walk_length; // Free blocks looked at per lookup
+
+  size_t class_hits[MALLOC_STATS_CLASSES];   // Served from free memory
+  size_t class_misses[MALLOC_STATS_CLASSES]; // Had to grow the heap
+} MallocStats;
+
+void malloc_get_stats(MallocStats *stats);
+size_t malloc_stats_class_size(size_t size_class);
+
+/*
+ * Prints the statistics to stderr, like glibc's malloc_stats(3). Setting
+ * MALLOC_STATS=1 prints them at exit, and MALLOC_STATS_SIGNAL=<signal number>
+ * prints them whenever that signal is received.
+ */
+void malloc_stats(void);
+
+#endif